@@ -0,0 +1,33 @@
+#ifndef LODEBACKENDS_H
+#define LODEBACKENDS_H
+#include "ioBackend.cpp"
+#include "epollBackend.cpp"
+#include "uringBackend.cpp"
+
+namespace Lodestar{
+    /**
+     * Creates the socket layer of an event loop.
+     *
+     * io_uring is only used if asked for and if the running kernel supports
+     * what uringBackend needs; otherwise an epollBackend is created.
+     *
+     * @param preferUring if an uringBackend should be tried first.
+     * @returns the created backend, NULL if not even epoll could be set up.
+     * */
+    inline ioBackend* createBackend(bool preferUring){
+        if(preferUring){
+            uringBackend* uring = new uringBackend;
+            if(uring->ok())
+                return uring;
+            delete uring;
+        }
+
+        epollBackend* epoll = new epollBackend;
+        if(epoll->ok())
+            return epoll;
+        delete epoll;
+        return NULL;
+    }
+}
+
+#endif
@@ -4,30 +4,31 @@
 #include <cstdint>
 #include <cstring>
 #include <chrono>
-#include <stdexcept>
-#include <tuple>
+#include <array>
+#include <atomic>
+#include <algorithm>
 #include <sys/socket.h>
+#include <sys/poll.h>
 #include "types.h"
+#include "eventLoop.cpp"
 #include <errno.h>
 
 // NOTE: maybe should extract string copying into separate function
 
 namespace Lodestar {
+    static const int maxField = 1024; ///< size of the arrays variable length fields are deserialized into
 
-    //communication-specific exceptions
-    class timeoutException: public std::runtime_error{
-        public:
-            using std::runtime_error::runtime_error;
-
-            std::chrono::milliseconds timeout(){
-                return time;
-            }
-
-            timeoutException(std::chrono::milliseconds time, std::string message):time(time), std::runtime_error(message){}
-
-        private:
-            std::chrono::milliseconds time;
-    };
+    /**
+     * Checks a variable length field a peer declared against what it really sent.
+     *
+     * @param end offset one past the field's last byte.
+     * @param fieldLen declared length of the field.
+     * @param len size of the frame; -1 if unknown, in which case only the field's size is checked.
+     * @returns if the field fits both the frame and the array it's deserialized into.
+     * */
+    inline bool fieldFits(int end, int fieldLen, int len){
+        return fieldLen <= maxField && (len < 0 || end <= len);
+    }
 
     //basic message types
     struct registration: public transmittable{
@@ -39,7 +40,7 @@ namespace Lodestar {
         char* registrarName; ///< registrar name
 
         registration(){
-            dataType = msgtype::authNode;
+            dataType = msgtype::topicReg;
         }
         
         int serialize(char* buffer){
@@ -71,16 +72,28 @@ namespace Lodestar {
         }
 
         void deserialize(char* buffer){
-            name = new char[1024];
-            registrarName = new char[1024];
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
             uint16_t i, j;
             int offset;
             
+            if(len >= 0 && len < 4)
+                return false;
             type = buffer[0];
             topicType = buffer[1];
             //copy 16 bits of buffer (offset by 2) into nameLen's address (which was cast into a char)
             std::memcpy((char*)&(nameLen), &buffer[2], sizeof(uint16_t));
-            
+            //the name is followed by the registrar's length
+            if(!fieldFits(4 + nameLen + 2, nameLen, len))
+                return false;
+            std::memcpy((char*)&(registrarLen), &buffer[4 + nameLen], sizeof(uint16_t));
+            if(!fieldFits(4 + nameLen + 2 + registrarLen, registrarLen, len))
+                return false;
+
+            name = new char[maxField];
+            registrarName = new char[maxField];
             offset = 4;
             for(i = offset; i - offset < nameLen; i++){
                 name[i - offset] = buffer[i];
@@ -92,11 +105,12 @@ namespace Lodestar {
             for(j = offset; j - offset < registrarLen; j++){
                 registrarName[j - offset] = buffer[j];
             }
+            return true;
         }
     };
 
     struct topicUpdate: public transmittable{
-        uint8_t type;          ///< type of update; 0 for addition, 1 for removal
+        uint8_t type;          ///< type of update; 0 for addition, 1 for removal, plus 2 if the registrar is a subscriber
         uint16_t registrarLen; ///< registrar name length
         char* registrarName;   ///< name of registrar, used by the node and master to differentiate registrars
         uint16_t addressLen;   ///< address length
@@ -131,30 +145,41 @@ namespace Lodestar {
         }
 
         void deserialize(char* buffer){
-            registrarName = new char[1024];
-            address = new char[1024];
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
             uint16_t i, j;
             int offset;
             
+            if(len >= 0 && len < 3)
+                return false;
             type = buffer[0];
             std::memcpy((char*)&(registrarLen), &buffer[1], sizeof(uint16_t));
+            if(!fieldFits(3 + registrarLen + 2, registrarLen, len))
+                return false;
+            std::memcpy((char*)&(addressLen), &buffer[3 + registrarLen], sizeof(uint16_t));
+            if(!fieldFits(3 + registrarLen + 2 + addressLen, addressLen, len))
+                return false;
+
+            registrarName = new char[maxField];
+            address = new char[maxField];
             
             offset = 3;
             for(i = offset; i - offset < registrarLen; i++){
                 registrarName[i - offset] = buffer[i];
             }
             
-            std::memcpy((char*)&(addressLen), &buffer[i], sizeof(uint16_t));
-            
             offset = i + 2;
             for(j = offset; j - offset < addressLen; j++){
                 address[j - offset] = buffer[j];
             }
+            return true;
         }
     };
 
     struct shutdown: public transmittable{
-        uint8_t code; ///< code of shutdown, denoting reason for it.
+        uint8_t code; ///< code of shutdown, denoting reason for it; see shutdownCode.
 
         shutdown(){
             dataType = msgtype::shutdwn;
@@ -168,11 +193,26 @@ namespace Lodestar {
         void deserialize(char* buffer){
             code = buffer[0];
         }
+
+        bool deserialize(char* buffer, int len){
+            if(len >= 0 && len < 1)
+                return false;
+            deserialize(buffer);
+            return true;
+        }
     };
 
+    /**
+     * The first frame a node sends, authenticating it.
+     *
+     * Nodes that negotiate features append the protocol version and the features
+     * they offer after the identifier; older nodes don't, and get a version of 0.
+     * */
     struct auth: public transmittable{
         int8_t size;        ///< negative for size of session id, positive for size of master password
         char* identifier;    ///< either password or session id; see size
+        uint8_t version = 0;   ///< protocol version of the node; 0 if it doesn't negotiate
+        uint32_t features = 0; ///< features offered by the node; see feature
 
             auth(){
                 dataType = msgtype::authNode;
@@ -191,36 +231,324 @@ namespace Lodestar {
             for(i = offset; i - offset < size; i++){
                 buffer[i] = identifier[i - offset];
             }
-            
-            return i;
+
+            if(!version)
+                return i;
+
+            buffer[i] = version;
+            std::memcpy(&buffer[i + 1], (char*)&features, sizeof(uint32_t));
+            return i + 1 + sizeof(uint32_t);
         }
         
         void deserialize(char* buffer){
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
             uint8_t i;
+            if(len >= 0 && len < 1)
+                return false;
             size = buffer[0];
-            identifier = new char[128];
-            
             if(size < 0){
                 size = -size;
             }
+            if(size < 0 || (len >= 0 && 1 + size > len))
+                return false;
+            identifier = new char[128];
             
             int offset = 1;
             for(i = offset; i - offset < size; i++){
                 identifier[i - offset] = buffer[i];
             }
+
+            version = 0;
+            features = 0;
+            if(len >= i + 1 + (int)sizeof(uint32_t)){
+                version = buffer[i];
+                std::memcpy((char*)&features, &buffer[i + 1], sizeof(uint32_t));
+            }
+            return true;
+        }
+    };
+
+    /**
+     * The master's answer to an auth frame that offered features.
+     * */
+    struct authAnswer: public transmittable{
+        uint8_t version;        ///< protocol version of the master
+        uint32_t features;      ///< features agreed on; the ones offered that the master supports
+        uint32_t leaseTime = 0; ///< milliseconds a lease lasts without heartbeats; 0 unless leases were agreed on
+
+        authAnswer(){
+            dataType = msgtype::authAns;
+        }
+
+        int serialize(char* buffer){
+            buffer[0] = version;
+            std::memcpy(&buffer[1], (char*)&features, sizeof(uint32_t));
+            std::memcpy(&buffer[5], (char*)&leaseTime, sizeof(uint32_t));
+            return 1 + 2 * sizeof(uint32_t);
+        }
+
+        void deserialize(char* buffer){
+            version = buffer[0];
+            std::memcpy((char*)&features, &buffer[1], sizeof(uint32_t));
+            std::memcpy((char*)&leaseTime, &buffer[5], sizeof(uint32_t));
+        }
+
+        bool deserialize(char* buffer, int len){
+            if(len >= 0 && len < 1 + 2 * (int)sizeof(uint32_t))
+                return false;
+            deserialize(buffer);
+            return true;
+        }
+    };
+
+    /**
+     * Renews the lease of a node that had nothing else to send.
+     *
+     * Carries nothing; any frame renews the lease, this one is just the smallest.
+     * */
+    struct heartbeat: public transmittable{
+        heartbeat(){
+            dataType = msgtype::heartbt;
+        }
+
+        int serialize(char*){
+            return 0;
+        }
+
+        void deserialize(char*){}
+    };
+
+    struct topicQuery: public transmittable{
+        uint8_t topicType; ///< relation being queried; 0 for publishers, 1 for subscribers
+        uint16_t nameLen;  ///< length of topic name
+        char* name;        ///< topic name
+
+        topicQuery(){
+            dataType = msgtype::topicQry;
+        }
+
+        int serialize(char* buffer){
+            buffer[0] = topicType;
+            buffer[1] = nameLen;
+            buffer[2] = nameLen >> 8;
+            std::memcpy(&buffer[3], name, nameLen);
+            return nameLen + 3;
+        }
+
+        void deserialize(char* buffer){
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
+            if(len >= 0 && len < 3)
+                return false;
+            topicType = buffer[0];
+            std::memcpy((char*)&(nameLen), &buffer[1], sizeof(uint16_t));
+            if(!fieldFits(3 + nameLen, nameLen, len))
+                return false;
+            name = new char[maxField];
+            std::memcpy(name, &buffer[3], nameLen);
+            return true;
+        }
+    };
+
+    struct endpointList: public transmittable{
+        uint16_t count;   ///< amount of endpoints in the list
+        uint16_t dataLen; ///< length of data
+        char* data;       ///< endpoints, each packed as a 2 byte length followed by the address
+
+        endpointList(){
+            dataType = msgtype::endpointLst;
+        }
+
+        int serialize(char* buffer){
+            buffer[0] = count;
+            buffer[1] = count >> 8;
+            buffer[2] = dataLen;
+            buffer[3] = dataLen >> 8;
+            std::memcpy(&buffer[4], data, dataLen);
+            return dataLen + 4;
+        }
+
+        void deserialize(char* buffer){
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
+            if(len >= 0 && len < 4)
+                return false;
+            std::memcpy((char*)&(count), &buffer[0], sizeof(uint16_t));
+            std::memcpy((char*)&(dataLen), &buffer[2], sizeof(uint16_t));
+            if(!fieldFits(4 + dataLen, dataLen, len))
+                return false;
+            data = new char[maxField];
+            std::memcpy(data, &buffer[4], dataLen);
+            return true;
+        }
+    };
+
+    struct subtreeQuery: public transmittable{
+        uint16_t nameLen; ///< length of directory path
+        char* name;       ///< path of the directory to be listed; empty for the whole tree
+
+        subtreeQuery(){
+            dataType = msgtype::subtreeQry;
+        }
+
+        int serialize(char* buffer){
+            buffer[0] = nameLen;
+            buffer[1] = nameLen >> 8;
+            std::memcpy(&buffer[2], name, nameLen);
+            return nameLen + 2;
+        }
+
+        void deserialize(char* buffer){
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
+            if(len >= 0 && len < 2)
+                return false;
+            std::memcpy((char*)&(nameLen), &buffer[0], sizeof(uint16_t));
+            if(!fieldFits(2 + nameLen, nameLen, len))
+                return false;
+            name = new char[maxField];
+            std::memcpy(name, &buffer[2], nameLen);
+            return true;
         }
     };
 
+    struct subtreeListing: public transmittable{
+        uint8_t last;     ///< 1 if this is the last frame of the listing, 0 if more will follow
+        uint16_t count;   ///< amount of entries in this frame
+        uint16_t dataLen; ///< length of data
+        char* data;       ///< entries, each packed as a nodeType byte, a 2 byte length and the path
+
+        subtreeListing(){
+            dataType = msgtype::subtreeLst;
+        }
+
+        int serialize(char* buffer){
+            buffer[0] = last;
+            buffer[1] = count;
+            buffer[2] = count >> 8;
+            buffer[3] = dataLen;
+            buffer[4] = dataLen >> 8;
+            std::memcpy(&buffer[5], data, dataLen);
+            return dataLen + 5;
+        }
+
+        void deserialize(char* buffer){
+            deserialize(buffer, -1);
+        }
+
+        bool deserialize(char* buffer, int len){
+            if(len >= 0 && len < 5)
+                return false;
+            last = buffer[0];
+            std::memcpy((char*)&(count), &buffer[1], sizeof(uint16_t));
+            std::memcpy((char*)&(dataLen), &buffer[3], sizeof(uint16_t));
+            if(!fieldFits(5 + dataLen, dataLen, len))
+                return false;
+            data = new char[maxField];
+            std::memcpy(data, &buffer[5], dataLen);
+            return true;
+        }
+    };
+
+    typedef transmittable* (*messageFactory)(); ///< allocates an empty message of some type
+
+    template <class T>
+    transmittable* makeMessage(){
+        return new T;
+    }
+
+    /**
+     * Table of the message types frames can be decoded into, indexed by type byte.
+     *
+     * Built-in types are in the table from the start; applications add theirs
+     * with add(), so decoding a frame is a single lookup instead of a switch
+     * every new type has to be added to.
+     * */
+    class messageRegistry{
+        public:
+            static const int maxTypes = 128; ///< the type byte's high bit marks correlated frames
+
+            /**
+             * Adds a message type frames can be decoded into.
+             *
+             * Meant to be called at startup, before frames of [type] arrive.
+             *
+             * @param type the type byte of the message; at least firstUserType.
+             * @param factory allocates an empty message of the type, e.g. makeMessage<T>.
+             * @returns false if [type] is reserved or already taken.
+             * */
+            static bool add(uint8_t type, messageFactory factory){
+                if(type < msgtype::firstUserType || type >= maxTypes || !factory)
+                    return false;
+
+                messageFactory vacant = NULL;
+                return table()[type].compare_exchange_strong(vacant, factory);
+            }
+
+            /**
+             * @returns an empty message of [type], NULL if the type is unknown.
+             * */
+            static transmittable* create(uint8_t type){
+                if(type >= maxTypes)
+                    return NULL;
+
+                messageFactory factory = table()[type].load(std::memory_order_acquire);
+                return factory ? factory() : NULL;
+            }
+
+        private:
+            static constexpr std::array<messageFactory, msgtype::firstUserType> builtIn(){
+                std::array<messageFactory, msgtype::firstUserType> factories {};
+                factories[msgtype::authNode] = &makeMessage<auth>;
+                factories[msgtype::topicReg] = &makeMessage<registration>;
+                factories[msgtype::topicUpd] = &makeMessage<topicUpdate>;
+                factories[msgtype::shutdwn] = &makeMessage<shutdown>;
+                factories[msgtype::topicQry] = &makeMessage<topicQuery>;
+                factories[msgtype::endpointLst] = &makeMessage<endpointList>;
+                factories[msgtype::subtreeQry] = &makeMessage<subtreeQuery>;
+                factories[msgtype::subtreeLst] = &makeMessage<subtreeListing>;
+                factories[msgtype::authAns] = &makeMessage<authAnswer>;
+                factories[msgtype::heartbt] = &makeMessage<heartbeat>;
+                return factories;
+            }
+
+            static std::array<std::atomic<messageFactory>, maxTypes>& table(){
+                static constexpr std::array<messageFactory, msgtype::firstUserType> builtIns = builtIn();
+                static std::array<std::atomic<messageFactory>, maxTypes> factories;
+                static bool filled = [](){
+                    for(size_t i = 0; i < maxTypes; i++)
+                        factories[i].store(i < builtIns.size() ? builtIns[i] : NULL, std::memory_order_relaxed);
+                    return true;
+                }();
+                (void)filled;
+                return factories;
+            }
+    };
+
     class message{
         public:
+            static const uint8_t correlated = 0x80; ///< set on the type byte of frames which carry an id
+
             transmittable* data = NULL;      ///< pointer to an object that implements transmittable
             msgStatus state = msgStatus::ok; ///< current state; see msgStatus
+            uint32_t id = 0;                 ///< correlation id of the request; 0 if not correlated
             
             /**
              * Serializes a message.
              *
              * data.type goes into the first byte and the next byte is given as an argument
              * to the serialization function of data.
+             * If the message has an id, the high bit of the type byte is set and the
+             * id goes into the 4 bytes after it, so frames without one stay valid.
              *
              * @param[out] buffer the buffer data will be serialized to.
              * 
@@ -229,7 +557,12 @@ namespace Lodestar {
             uint16_t serializeMessage(char* buffer){
                 uint16_t size = 1;
                 buffer[0] = data->dataType;
-                size += data->serialize(&buffer[1]);
+                if(id){
+                    buffer[0] |= correlated;
+                    std::memcpy(&buffer[1], (char*)&(id), sizeof(uint32_t));
+                    size += sizeof(uint32_t);
+                }
+                size += data->serialize(&buffer[size]);
                 return size;
             }
             
@@ -240,30 +573,35 @@ namespace Lodestar {
              * it's best to delete the object data points to.
              *
              * @param[in] buffer the buffer containing the serialized message.
+             * @param len size of the frame in [buffer], without its size header; -1 if unknown,
+             * in which case declared lengths are only checked against the arrays they're copied into.
+             * @returns false (with errno set to EBADMSG) if the message is of a type not in
+             * messageRegistry or the frame is malformed, in which case data is left NULL.
              * */
-            void deserializeMessage(char* lbuffer){
-                msgtype type = static_cast<msgtype>(lbuffer[0]);
-                switch (type){ 
-                    case msgtype::authNode:
-                        data = new auth;
-                        data->deserialize(&lbuffer[1]);
-                        break;
-                    case msgtype::topicReg:
-                        data = new registration;
-                        data->deserialize(&lbuffer[1]);
-                        break;
-                    case msgtype::topicUpd:
-                        data = new topicUpdate;
-                        data->deserialize(&lbuffer[1]);
-                        break;
-                    case msgtype::shutdwn:
-                        data = new shutdown;
-                        data->deserialize(&lbuffer[1]);
-                        break;
-                    default:
-                        throw "Unknown message type";
+            bool deserializeMessage(char* lbuffer, int len = -1){
+                data = NULL;
+                if(len == 0)
+                    return malformed();
+                msgtype type = static_cast<msgtype>(lbuffer[0] & ~correlated);
+                int offset = 1;
+                id = 0;
+                if(lbuffer[0] & correlated){
+                    if(len >= 0 && len < offset + (int)sizeof(uint32_t))
+                        return malformed();
+                    std::memcpy((char*)&(id), &lbuffer[1], sizeof(uint32_t));
+                    offset += sizeof(uint32_t);
+                }
+
+                data = messageRegistry::create(type);
+                if(!data)
+                    return malformed();
+                if(!data->deserialize(&lbuffer[offset], len < 0 ? -1 : len - offset)){
+                    delete data;
+                    data = NULL;
+                    return malformed();
                 }
                 data->dataType = type;
+                return true;
             }
             
             /**
@@ -271,9 +609,85 @@ namespace Lodestar {
              *
              * Simply calls deserializeMessage(char* buffer) with this object's
              * buffer as argument.
+             *
+             * @returns false if the message is of an unknown type or malformed.
              * */
-            void deserializeMessage(){
-                deserializeMessage(buffer + 2);
+            bool deserializeMessage(){
+                uint16_t len;
+                std::memcpy((char*)&len, buffer, sizeof(uint16_t));
+                return deserializeMessage(buffer + 2, len);
+            }
+            
+            /**
+             * Resets the receiving state of the message.
+             *
+             * Does not touch the data pointer, so the object it points to
+             * needs to be taken care of beforehand.
+             * */
+            void reset(){
+                state = msgStatus::ok;
+                size = 0;
+                received = 0;
+                headerBytes = 0;
+            }
+            
+            /**
+             * Assembles a message from bytes already received from a socket.
+             *
+             * Meant for event loops that receive on their own: [data] can hold any
+             * part of a frame, and only the bytes belonging to the frame being
+             * assembled are consumed, so the caller feeds the rest again once the
+             * message is handled. When the function returns with a status of ok, the
+             * frame is complete and can be deserialized with deserializeMessage().
+             *
+             * @param data bytes received.
+             * @param len amount of bytes in [data].
+             * @returns amount of bytes consumed, -1 if the frame does not fit the buffer.
+             * */
+            int feed(const char* data, int len){
+                if(state != msgStatus::receiving){
+                    state = msgStatus::receiving;
+                    headerBytes = 0;
+                    size = 0;
+                    received = 0;
+                }
+
+                int consumed = 0;
+                while(headerBytes < 2 && consumed < len){
+                    buffer[headerBytes++] = data[consumed++];
+                    if(headerBytes == 2){
+                        std::memcpy((char*)&(size), buffer, sizeof(uint16_t));
+                        if(size > sizeof(buffer) - 2)
+                            return -1;
+                    }
+                }
+
+                if(headerBytes < 2)
+                    return consumed;
+
+                int taken = std::min<int>(size, len - consumed);
+                std::memcpy(&buffer[received + 2], &data[consumed], taken);
+                received += taken;
+                size -= taken;
+                consumed += taken;
+
+                if(size == 0){
+                    state = msgStatus::ok;
+                    received = 0;
+                    headerBytes = 0;
+                }
+
+                return consumed;
+            }
+
+            /**
+             * @returns the bytes fed so far of a frame still being assembled, so
+             * that another message can be fed them and pick up where this one is.
+             * */
+            std::string partialFrame(){
+                if(state != msgStatus::receiving)
+                    return std::string();
+                return std::string(buffer, headerBytes < 2 ? headerBytes : received + 2);
             }
             
             /**
@@ -292,13 +706,140 @@ namespace Lodestar {
                 
                 int sent = 0;
                 
-                while(sent < size + 2 || sent == -1){
-                    sent = sent + send(sockfd, &buffer[sent], (size + 2) - sent, 0);
+                while(sent < size + 2){
+                    int rv = ::send(sockfd, &buffer[sent], (size + 2) - sent, MSG_NOSIGNAL);
+                    if(rv == -1){
+                        if(errno == EINTR)
+                            continue;
+                        return -1;
+                    }
+                    sent += rv;
                 }
                 
                 return sent;
             }
             
+            /**
+             * Serializes the data on the data pointer and sends it for [time] milliseconds.
+             *
+             * Never blocks on a full socket; if the peer isn't reading, waits for the
+             * socket to become writable again until [time] has elapsed, so a slow reader
+             * applies back-pressure to the caller instead of stalling it forever.
+             *
+             * @param sockfd the socket the message is to be sent.
+             * @param time the time which the function is to be executed for.
+             * @returns amount of sent bytes, -1 on error or if timed out before finishing.
+             * */
+            int sendMessage_for(int sockfd, std::chrono::milliseconds time){
+                auto timeout = std::chrono::steady_clock::now() + time;
+
+                size = serializeMessage(&buffer[2]);
+                buffer[0] = size;
+                buffer[1] = size >> 8;
+
+                int sent = 0;
+                while(sent < size + 2){
+                    int rv = ::send(sockfd, &buffer[sent], (size + 2) - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+                    if(rv >= 0){
+                        sent += rv;
+                        continue;
+                    }
+
+                    if(errno != EAGAIN && errno != EWOULDBLOCK)
+                        return -1;
+
+                    //socket is full; wait for the peer to drain it
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(timeout - std::chrono::steady_clock::now());
+                    if(remaining.count() <= 0)
+                        return -1;
+
+                    pollfd pfd;
+                    pfd.fd = sockfd;
+                    pfd.events = POLLOUT;
+                    if(poll(&pfd, 1, remaining.count()) <= 0)
+                        return -1;
+                }
+
+                return sent;
+            }
+            
+            /**
+             * Serializes the data on the data pointer and sends it from a task.
+             *
+             * Suspends the awaiting task whenever the socket is full, instead of
+             * blocking, and is resumed by the event loop running on the calling thread.
+             *
+             * @param sockfd the socket the message is to be sent.
+             * @returns amount of sent bytes, -1 on error.
+             * */
+            task<int> send(int sockfd){
+                eventLoop* loop = eventLoop::current();
+                if(!loop)
+                    throw "No event loop running on this thread";
+
+                size = serializeMessage(&buffer[2]);
+                buffer[0] = size;
+                buffer[1] = size >> 8;
+
+                int sent = 0;
+                while(sent < size + 2){
+                    int rv = ::send(sockfd, &buffer[sent], (size + 2) - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+                    if(rv >= 0){
+                        sent += rv;
+                        continue;
+                    }
+
+                    if(errno == EAGAIN || errno == EWOULDBLOCK)
+                        co_await loop->writable(sockfd);
+                    else if(errno != EINTR)
+                        co_return -1;
+                }
+
+                co_return sent;
+            }
+            
+            /**
+             * Receives a message from a task.
+             *
+             * Suspends the awaiting task until the whole message is received, and is
+             * resumed by the event loop running on the calling thread. Like
+             * recvMessage_for(), it does not deserialize the message.
+             *
+             * @param sockfd the socket in which the message will be received from.
+             * @returns ok once the message is received, nomsg if the peer closed
+             * the connection before sending any of it, broken if the socket errored
+             * out, the peer closed it midway or the frame doesn't fit the buffer.
+             * */
+            task<msgStatus> recv(int sockfd){
+                eventLoop* loop = eventLoop::current();
+                if(!loop)
+                    throw "No event loop running on this thread";
+
+                char chunk[sizeof(buffer)];
+                bool complete = false;
+                while(!complete){
+                    //only ask for what's left of this frame, so the next one stays in the socket
+                    int wanted = state != msgStatus::receiving ? 2 : headerBytes < 2 ? 2 - headerBytes : size;
+                    int rv = ::recv(sockfd, chunk, wanted, MSG_DONTWAIT);
+
+                    if(rv > 0){
+                        if(feed(chunk, rv) < 0)
+                            co_return fail(EMSGSIZE);
+                        complete = state == msgStatus::ok;
+                    }else if(rv == 0){
+                        if(state == msgStatus::receiving)
+                            co_return fail(ECONNRESET);
+                        co_return msgStatus::nomsg;
+                    }else if(errno == EAGAIN || errno == EWOULDBLOCK){
+                        co_await loop->readable(sockfd);
+                    }else if(errno != EINTR){
+                        co_return fail(errno);
+                    }
+                }
+
+                co_return msgStatus::ok;
+            }
+            
             /**
              * Receives a message into a buffer to be serialized later.
              *
@@ -306,10 +847,10 @@ namespace Lodestar {
              * so this function is better used asynchronously.
              *
              * @param sockfd the socket in which the message will be received from.
-             * @returns the received message.
+             * @returns the status of the message; see recvMessage_for().
              * */
-            void recvMessage(int sockfd){
-                recvMessage_for(sockfd, std::chrono::minutes(1));
+            msgStatus recvMessage(int sockfd){
+                return recvMessage_for(sockfd, std::chrono::minutes(1));
             }
             
             /**
@@ -320,58 +861,93 @@ namespace Lodestar {
              * so long that [time] microseconds has already elapsed and the function
              * executed for too much time.
              * Will not automatically deserialize data once it finishes receiving data.
-             * If the function runs for [time], a status of receiving is returned.
+             * If the function runs for [time] with part of the message received, a status
+             * of receiving is returned, and the next call picks up where this one stopped.
              * If the function finalized receiving, a status of ok is returned.
              *
              * @param sockfd the socket in which the message will be received from.
              * @param time the time which the function is to be executed for.
-             * @returns the status of the message.
+             * @returns the status of the message: nomsg if nothing arrived in [time], broken
+             * (with errno set) if the socket errored out or the peer closed it.
              * */
             msgStatus recvMessage_for(int sockfd, std::chrono::milliseconds time){
-                auto began = std::chrono::steady_clock::now();
                 auto timeout = std::chrono::steady_clock::now() + time;
-                auto now = std::chrono::steady_clock::now();
-                
-                //try to read first 2 bytes and interprete them as
-                //size to be read (if not already reading a message)
-                if(state == msgStatus::ok){
-                    auto firstResult = recv_for(2, sockfd, buffer, time);
-                    
-                    if(std::get<0>(firstResult) == 2){
+                if(state != msgStatus::receiving){
+                    headerBytes = 0;
+                    size = 0;
+                    received = 0;
+                }
+
+                //read the first 2 bytes and interpret them as the size to be read
+                int got = 0;
+                msgStatus result = msgStatus::ok;
+                if(headerBytes < 2){
+                    result = recv_for(2 - headerBytes, sockfd, &buffer[headerBytes], time, got);
+                    headerBytes += got;
+                    if(headerBytes == 2){
                         std::memcpy((char*)&(size), buffer, sizeof(uint16_t));
-                    }else if(std::get<0>(firstResult) == 0){
-                        return msgStatus::nomsg;
-                    }else{
-                        throw timeoutException(time, "Could not receive first two bytes");
+                        if(size > sizeof(buffer) - 2)
+                            return fail(EMSGSIZE);
                     }
                 }
-                
+
                 //actually receive the data
-                auto secondResult = recv_for(size, sockfd, &buffer[received + 2], time);
-                
-                //store total received and remaining size
-                received += std::get<0>(secondResult);
-                size -= std::get<0>(secondResult);
-                
-                if(std::get<1>(secondResult)){
-                    state = msgStatus::receiving;
-                    return state;
+                if(result == msgStatus::ok){
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(timeout - std::chrono::steady_clock::now());
+                    result = recv_for(size, sockfd, &buffer[received + 2], remaining, got);
+                    received += got;
+                    size -= got;
+                }
+
+                switch(result){
+                    case msgStatus::ok:
+                        state = msgStatus::ok;
+                        size = 0;
+                        received = 0;
+                        headerBytes = 0;
+                        return state;
+                    case msgStatus::receiving:
+                        if(headerBytes == 0){
+                            state = msgStatus::ok;
+                            return msgStatus::nomsg;
+                        }
+                        state = msgStatus::receiving;
+                        return state;
+                    default:
+                        return fail(errno);
                 }
-                
-                //only executes if all bytes were received
-                state = msgStatus::ok;
-                size = 0;
-                received = 0;
-                return state;
             }
 
         private:
             char buffer[1024];
             uint16_t size = 0;
             int received = 0;
+            int headerBytes = 0; ///< bytes of the size header received of the current frame
 
             // TODO: check if socket has non zero timeout sockopt on input and error out if not
 
+            /**
+             * Drops the frame being received, leaving [err] in errno.
+             *
+             * @returns broken, for the caller to return.
+             * */
+            msgStatus fail(int err){
+                state = msgStatus::broken;
+                size = 0;
+                received = 0;
+                headerBytes = 0;
+                errno = err;
+                return state;
+            }
+
+            /**
+             * @returns false with errno set to EBADMSG, for deserializeMessage to return.
+             * */
+            bool malformed(){
+                errno = EBADMSG;
+                return false;
+            }
+
             /**
              * Receives [size] bytes with [time] milliseconds as timeout.
              *
@@ -379,39 +955,34 @@ namespace Lodestar {
              * @param sockfd socket the data will be received from.
              * @param[out] buffer which data is to be received into.
              * @param time time in milliseconds which the function has to execute.
-             * @returns  tuple made of, respectivelly, amount of bytes sent, and if function timed out.
+             * @param[out] totalReceived amount of bytes received, even if not all of them were.
+             * @returns ok if all [size] bytes were received, receiving if [time] ran out first,
+             * broken if the socket errored out or the peer closed it, with errno set.
              * */
-            std::tuple<int, bool> recv_for(int size, int sockfd, char* buffer, std::chrono::milliseconds time){
-                auto began = std::chrono::steady_clock::now(); // when function began
+            msgStatus recv_for(int size, int sockfd, char* buffer, std::chrono::milliseconds time, int& totalReceived){
                 auto timeout = std::chrono::steady_clock::now() + time; // time limit
-                auto now = std::chrono::steady_clock::now(); // current time
+                totalReceived = 0;
 
-                int totalReceived = 0;
-                int received = 0;
+                while(totalReceived < size){
+                    if(std::chrono::steady_clock::now() >= timeout)
+                        return msgStatus::receiving;
 
-                while(size > 0 && now < timeout){
-                    received = recv(sockfd, &buffer[totalReceived], size, 0);
-                    now = std::chrono::steady_clock::now();
+                    int rv = ::recv(sockfd, &buffer[totalReceived], size - totalReceived, 0);
+                    if(rv == 0){
+                        errno = ECONNRESET;
+                        return msgStatus::broken;
+                    }
 
-                    //loop again if timed out
-                    if(received == -1){
-                        if(errno == EAGAIN || errno == EWOULDBLOCK){
-                            received = 0;
+                    //loop again if the socket's own timeout ran out
+                    if(rv == -1){
+                        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
                             continue;
-                        }else{
-                            throw errno;
-                        }
+                        return msgStatus::broken;
                     }
-                    totalReceived += received;
-                    size = size - received;
-                }
-
-                bool timedOut = false;
-                if(now > timeout){
-                    timedOut = true;
+                    totalReceived += rv;
                 }
 
-                return std::make_tuple(totalReceived, timedOut);
+                return msgStatus::ok;
             }
     };
 
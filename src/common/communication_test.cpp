@@ -126,6 +126,390 @@ TEST_CASE("auth - Node authentication message"){
     CHECK(dummyIdentifier == deserializedIdentifier);
 }
 
+TEST_CASE("auth - Version and features"){
+    char identifier[] = "samplepasswd";
+    Lodestar::auth versioned;
+    versioned.identifier = identifier;
+    versioned.size = 13;
+    versioned.version = Lodestar::protocolVersion;
+    versioned.features = Lodestar::feature::pushedUpdates | Lodestar::feature::pipelining;
+
+    char buffer[1024];
+    Lodestar::message msg;
+    msg.data = &versioned;
+    int size = msg.serializeMessage(buffer);
+
+    Lodestar::message received;
+    REQUIRE(received.deserializeMessage(buffer, size));
+    Lodestar::auth* decoded = static_cast<Lodestar::auth*>(received.data);
+    CHECK(decoded->version == Lodestar::protocolVersion);
+    CHECK(decoded->features == versioned.features);
+    CHECK(std::string(decoded->identifier) == "samplepasswd");
+    delete decoded;
+
+    SUBCASE("frames of older nodes carry neither"){
+        Lodestar::auth legacy;
+        legacy.identifier = identifier;
+        legacy.size = 13;
+        msg.data = &legacy;
+        int versionedSize = size;
+        size = msg.serializeMessage(buffer);
+        CHECK(size == versionedSize - 5);
+
+        REQUIRE(received.deserializeMessage(buffer, size));
+        decoded = static_cast<Lodestar::auth*>(received.data);
+        CHECK(decoded->version == 0);
+        CHECK(decoded->features == 0);
+        delete decoded;
+    }
+
+    SUBCASE("the master's answer"){
+        Lodestar::authAnswer answer;
+        answer.version = Lodestar::protocolVersion;
+        answer.features = Lodestar::feature::pushedUpdates;
+        msg.data = &answer;
+        size = msg.serializeMessage(buffer);
+
+        REQUIRE(received.deserializeMessage(buffer, size));
+        REQUIRE(received.data->dataType == Lodestar::msgtype::authAns);
+        CHECK(static_cast<Lodestar::authAnswer*>(received.data)->version == Lodestar::protocolVersion);
+        CHECK(static_cast<Lodestar::authAnswer*>(received.data)->features == Lodestar::feature::pushedUpdates);
+        delete received.data;
+    }
+}
+
+TEST_CASE("topicQuery - Topic endpoint query message"){
+    Lodestar::topicQuery dummyStruct;
+
+    dummyStruct.topicType = 1;
+    char testName[] = "test/topic";
+    dummyStruct.name = &testName[0];
+    dummyStruct.nameLen = 11;
+
+    char* buffer = (char*)std::malloc(1024);
+    dummyStruct.serialize(buffer);
+
+    Lodestar::topicQuery deserialized;
+    deserialized.deserialize(buffer);
+
+    std::string dummyNameString = dummyStruct.name;
+    std::string deserializedNameString = deserialized.name;
+
+    CHECK(dummyStruct.topicType == deserialized.topicType);
+    CHECK(dummyStruct.nameLen == deserialized.nameLen);
+    CHECK(dummyNameString == deserializedNameString);
+}
+
+TEST_CASE("endpointList - Topic endpoint list message"){
+    Lodestar::endpointList dummyStruct;
+
+    char testData[] = {4, 0, 'a', 'd', 'd', 'r'};
+    dummyStruct.count = 1;
+    dummyStruct.data = &testData[0];
+    dummyStruct.dataLen = 6;
+
+    char* buffer = (char*)std::malloc(1024);
+    int written = dummyStruct.serialize(buffer);
+
+    Lodestar::endpointList deserialized;
+    deserialized.deserialize(buffer);
+
+    CHECK(written == 10);
+    CHECK(dummyStruct.count == deserialized.count);
+    CHECK(dummyStruct.dataLen == deserialized.dataLen);
+    CHECK(std::memcmp(dummyStruct.data, deserialized.data, 6) == 0);
+}
+
+TEST_CASE("subtreeQuery - Subtree listing request message"){
+    Lodestar::subtreeQuery dummyStruct;
+
+    char testName[] = "dir1/dir2";
+    dummyStruct.name = &testName[0];
+    dummyStruct.nameLen = 10;
+
+    char* buffer = (char*)std::malloc(1024);
+    dummyStruct.serialize(buffer);
+
+    Lodestar::subtreeQuery deserialized;
+    deserialized.deserialize(buffer);
+
+    std::string dummyNameString = dummyStruct.name;
+    std::string deserializedNameString = deserialized.name;
+
+    CHECK(dummyStruct.nameLen == deserialized.nameLen);
+    CHECK(dummyNameString == deserializedNameString);
+}
+
+TEST_CASE("subtreeListing - Subtree listing frame message"){
+    Lodestar::subtreeListing dummyStruct;
+
+    char testData[] = {Lodestar::nodeType::topic, 1, 0, 't'};
+    dummyStruct.last = 1;
+    dummyStruct.count = 1;
+    dummyStruct.data = &testData[0];
+    dummyStruct.dataLen = 4;
+
+    char* buffer = (char*)std::malloc(1024);
+    int written = dummyStruct.serialize(buffer);
+
+    Lodestar::subtreeListing deserialized;
+    deserialized.deserialize(buffer);
+
+    CHECK(written == 9);
+    CHECK(dummyStruct.last == deserialized.last);
+    CHECK(dummyStruct.count == deserialized.count);
+    CHECK(dummyStruct.dataLen == deserialized.dataLen);
+    CHECK(std::memcmp(dummyStruct.data, deserialized.data, 4) == 0);
+}
+
+TEST_CASE("message - Correlation ids"){
+    Lodestar::topicQuery query;
+    char testName[] = "dir1/topic";
+    query.name = &testName[0];
+    query.nameLen = 11;
+    query.topicType = 1;
+
+    char buffer[1024];
+    Lodestar::message sent;
+    sent.data = &query;
+
+    SUBCASE("frames with an id"){
+        sent.id = 0xdeadbeef;
+        uint16_t size = sent.serializeMessage(buffer);
+        CHECK(size == 1 + 4 + 3 + 11);
+        CHECK((uint8_t)buffer[0] == (Lodestar::msgtype::topicQry | Lodestar::message::correlated));
+
+        Lodestar::message received;
+        received.deserializeMessage(buffer);
+        CHECK(received.id == 0xdeadbeef);
+        CHECK(received.data->dataType == Lodestar::msgtype::topicQry);
+        CHECK(std::string(static_cast<Lodestar::topicQuery*>(received.data)->name) == "dir1/topic");
+        delete received.data;
+    }
+
+    SUBCASE("frames without one stay as they were"){
+        uint16_t size = sent.serializeMessage(buffer);
+        CHECK(size == 1 + 3 + 11);
+        CHECK(buffer[0] == Lodestar::msgtype::topicQry);
+
+        Lodestar::message received;
+        received.id = 5;
+        received.deserializeMessage(buffer);
+        CHECK(received.id == 0);
+        CHECK(static_cast<Lodestar::topicQuery*>(received.data)->topicType == 1);
+        delete received.data;
+    }
+}
+
+TEST_CASE("message - Frame assembly from received bytes"){
+    Lodestar::subtreeQuery query;
+    char testName[] = "dir1";
+    query.name = &testName[0];
+    query.nameLen = 5;
+    query.dataType = Lodestar::msgtype::subtreeQry;
+
+    //two frames back to back, as a socket would deliver them
+    char frame[1024];
+    char payload[1024];
+    Lodestar::message sent;
+    sent.data = &query;
+    uint16_t size = sent.serializeMessage(payload);
+    frame[0] = size;
+    frame[1] = size >> 8;
+    std::memcpy(&frame[2], payload, size);
+    std::memcpy(&frame[size + 2], frame, size + 2);
+
+    Lodestar::message received;
+
+    //bytes trickling in one at a time don't complete the frame early
+    for(int i = 0; i < size + 1; i++){
+        CHECK(received.feed(&frame[i], 1) == 1);
+        CHECK(received.state == Lodestar::msgStatus::receiving);
+    }
+    CHECK(received.feed(&frame[size + 1], 1) == 1);
+    REQUIRE(received.state == Lodestar::msgStatus::ok);
+
+    //only the bytes of the first frame are consumed
+    CHECK(received.feed(frame, 2 * (size + 2)) == size + 2);
+    REQUIRE(received.state == Lodestar::msgStatus::ok);
+    received.deserializeMessage();
+    Lodestar::subtreeQuery* deserialized = static_cast<Lodestar::subtreeQuery*>(received.data);
+    CHECK(std::string(deserialized->name) == "dir1");
+    delete received.data;
+
+    //frames bigger than the buffer are refused
+    char oversized[] = {(char)0xff, (char)0xff};
+    Lodestar::message refused;
+    CHECK(refused.feed(oversized, 2) == -1);
+}
+
+//a message type an application could add
+struct counterMessage: public Lodestar::transmittable{
+    uint32_t count = 0;
+
+    counterMessage(){
+        dataType = (Lodestar::msgtype)100;
+    }
+
+    int serialize(char* buffer){
+        std::memcpy(buffer, &count, sizeof(uint32_t));
+        return sizeof(uint32_t);
+    }
+
+    void deserialize(char* buffer){
+        std::memcpy(&count, buffer, sizeof(uint32_t));
+    }
+};
+
+TEST_CASE("messageRegistry - Application message types"){
+    //built-in and reserved types can't be taken
+    CHECK(!Lodestar::messageRegistry::add(Lodestar::msgtype::topicReg, &Lodestar::makeMessage<counterMessage>));
+    CHECK(!Lodestar::messageRegistry::add(Lodestar::msgtype::firstUserType - 1, &Lodestar::makeMessage<counterMessage>));
+    CHECK(!Lodestar::messageRegistry::add(Lodestar::messageRegistry::maxTypes, &Lodestar::makeMessage<counterMessage>));
+
+    char buffer[1024];
+    counterMessage sentCounter;
+    sentCounter.count = 1234;
+    Lodestar::message sent;
+    sent.data = &sentCounter;
+    sent.id = 9;
+    sent.serializeMessage(buffer);
+
+    Lodestar::message received;
+    CHECK(!received.deserializeMessage(buffer));
+
+    REQUIRE(Lodestar::messageRegistry::add(100, &Lodestar::makeMessage<counterMessage>));
+    CHECK(!Lodestar::messageRegistry::add(100, &Lodestar::makeMessage<counterMessage>));
+
+    REQUIRE(received.deserializeMessage(buffer));
+    CHECK(received.id == 9);
+    CHECK(received.data->dataType == 100);
+    CHECK(static_cast<counterMessage*>(received.data)->count == 1234);
+    delete received.data;
+
+    //built-in types decode as before
+    Lodestar::shutdown shutdownMsg;
+    shutdownMsg.code = 3;
+    sent.data = &shutdownMsg;
+    sent.serializeMessage(buffer);
+    REQUIRE(received.deserializeMessage(buffer));
+    CHECK(static_cast<Lodestar::shutdown*>(received.data)->code == 3);
+    delete received.data;
+}
+
+TEST_CASE("message - Failed receptions are reported, not thrown"){
+    int fds[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+    timeval timeout {0, 20000};
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeval));
+
+    Lodestar::message received;
+
+    SUBCASE("nothing arriving"){
+        CHECK(received.recvMessage_for(fds[1], std::chrono::milliseconds(50)) == Lodestar::msgStatus::nomsg);
+    }
+
+    SUBCASE("a header split across calls"){
+        //a shutdown frame, its header sent a byte at a time
+        send(fds[0], "\x02", 1, 0);
+        CHECK(received.recvMessage_for(fds[1], std::chrono::milliseconds(50)) == Lodestar::msgStatus::receiving);
+        send(fds[0], "\x00\x03\x07", 3, 0);
+        REQUIRE(received.recvMessage_for(fds[1], std::chrono::milliseconds(50)) == Lodestar::msgStatus::ok);
+        REQUIRE(received.deserializeMessage());
+        CHECK(static_cast<Lodestar::shutdown*>(received.data)->code == 7);
+        delete received.data;
+    }
+
+    SUBCASE("the peer resetting mid frame"){
+        send(fds[0], "\x05\x00\x03", 3, 0);
+        close(fds[0]);
+        fds[0] = -1;
+        CHECK(received.recvMessage_for(fds[1], std::chrono::milliseconds(50)) == Lodestar::msgStatus::broken);
+        CHECK(errno == ECONNRESET);
+    }
+
+    SUBCASE("unknown message types"){
+        char frame[] = {0x7f, 0};
+        CHECK(!received.deserializeMessage(frame));
+        CHECK(received.data == NULL);
+    }
+
+    if(fds[0] >= 0)
+        close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("message - Malformed frames are rejected"){
+    Lodestar::message received;
+    errno = 0;
+
+    SUBCASE("a topic query naming more bytes than it carries"){
+        //type, topic type, a name of 600 bytes, then only 2 of them
+        char frame[] = {Lodestar::msgtype::topicQry, 1, 0x58, 0x02, 'a', 'b'};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(received.data == NULL);
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("an endpoint list past its array"){
+        //whatever the frame's size, 2000 bytes don't fit the array they'd be copied into
+        char frame[] = {Lodestar::msgtype::endpointLst, 1, 0, (char)0xd0, 0x07};
+        CHECK(!received.deserializeMessage(frame));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("a truncated subtree query"){
+        //a name of 1000 bytes declared, the frame cut after 3 of them
+        char frame[] = {Lodestar::msgtype::subtreeQry, (char)0xe8, 0x03, 'a', 'b', 'c'};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("a truncated subtree listing"){
+        char frame[] = {Lodestar::msgtype::subtreeLst, 1, 1, 0, (char)0xff, (char)0xff, 'a'};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("a registration whose registrar runs past the frame"){
+        char frame[] = {Lodestar::msgtype::topicReg, 1, 1, 1, 0, 'a', 0x20, 0, 'b'};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("a topic update cut before its address"){
+        char frame[] = {Lodestar::msgtype::topicUpd, 1, 1, 0, 'a', 4};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("an identifier longer than the frame"){
+        char frame[] = {Lodestar::msgtype::authNode, 100, 'a', 'b'};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("a short answer to authentication"){
+        char frame[] = {Lodestar::msgtype::authAns, 1, 0, 0};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("a frame cut in its fixed fields"){
+        char frame[] = {Lodestar::msgtype::endpointLst, 1};
+        CHECK(!received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(errno == EBADMSG);
+    }
+
+    SUBCASE("well formed frames still go through"){
+        char frame[] = {Lodestar::msgtype::topicQry, 1, 2, 0, 'a', 'b'};
+        REQUIRE(received.deserializeMessage(frame, sizeof(frame)));
+        CHECK(static_cast<Lodestar::topicQuery*>(received.data)->nameLen == 2);
+        delete[] static_cast<Lodestar::topicQuery*>(received.data)->name;
+        delete received.data;
+    }
+}
+
 TEST_CASE("Common Message Transmission and reception"){
     //setting up message
     Lodestar::auth dummyStruct;
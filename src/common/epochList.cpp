@@ -0,0 +1,214 @@
+#ifndef LODEELIST_H
+#define LODEELIST_H
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include <utility>
+
+namespace Lodestar{
+    /**
+     * A linked list that can be read while entries are being removed from it.
+     *
+     * Insertions and removals are serialized by an internal mutex, but readers
+     * never take it: they walk the list through atomic links. A removed entry is
+     * only unlinked, keeping its own link so a reader standing on it can still
+     * move on, and is retired into a garbage list tagged with the current epoch.
+     * Retired entries are only freed by reclaim() once every reader has passed a
+     * quiescent point (see pin() and unpin()) after they were retired.
+     *
+     * Readers which don't attach themselves must not run concurrently with removals.
+     * */
+    template <class T>
+    class EpochList{
+        private:
+            struct node {
+                T value;
+                std::atomic<node*> next;
+
+                node(const T& copied): value(copied), next(nullptr){}
+            };
+
+        public:
+            static const uint64_t quiescent = std::numeric_limits<uint64_t>::max();
+
+            /**
+             * A reader of the list; see attach().
+             * */
+            struct reader {
+                std::atomic<uint64_t> seen; ///< epoch seen when the current pass began, quiescent if not reading
+
+                reader(): seen(quiescent){}
+            };
+
+            class iterator{
+                public:
+                    iterator(node* n = nullptr): current(n){}
+
+                    T& operator*(){ return current->value; }
+                    T* operator->(){ return &current->value; }
+
+                    iterator& operator++(){
+                        current = current->next.load();
+                        return *this;
+                    }
+
+                    iterator operator++(int){
+                        iterator old = *this;
+                        current = current->next.load();
+                        return old;
+                    }
+
+                    bool operator==(const iterator& other) const { return current == other.current; }
+                    bool operator!=(const iterator& other) const { return current != other.current; }
+
+                private:
+                    node* current;
+            };
+
+            EpochList(){}
+
+            EpochList(const EpochList& list) = delete;
+
+            ~EpochList(){
+                node* n = head.next.load();
+                while(n){
+                    node* next = n->next.load();
+                    delete n;
+                    n = next;
+                }
+
+                for(auto it = garbage.begin(); it != garbage.end(); it++)
+                    delete it->second;
+            }
+
+            iterator begin(){ return iterator(head.next.load()); }
+            iterator end(){ return iterator(); }
+
+            T& front(){ return head.next.load()->value; }
+            T& back(){ return tail.load()->value; }
+
+            size_t size(){ return count.load(); }
+            bool empty(){ return count.load() == 0; }
+
+            /**
+             * Appends a copy of [value] to the list.
+             * */
+            void push_back(const T& value){
+                node* n = new node(value);
+
+                std::lock_guard<std::mutex> guard(lock);
+                tail.load()->next.store(n);
+                tail.store(n);
+                count++;
+            }
+
+            /**
+             * Unlinks every entry for which [predicate] returns true and retires it.
+             *
+             * @param predicate function which receives a const reference to an entry.
+             * @returns amount of retired entries.
+             * */
+            template <class Predicate>
+            int remove_if(Predicate predicate){
+                std::lock_guard<std::mutex> guard(lock);
+                uint64_t current = epoch.load();
+                int removed = 0;
+
+                node* pred = &head;
+                node* n = head.next.load();
+                while(n){
+                    node* next = n->next.load();
+                    if(predicate(static_cast<const T&>(n->value))){
+                        //only the predecessor's link changes, so readers
+                        //standing on n can still follow its link
+                        pred->next.store(next);
+                        if(tail.load() == n)
+                            tail.store(pred);
+
+                        garbage.push_back(std::make_pair(current, n));
+                        count--;
+                        removed++;
+                    }else{
+                        pred = n;
+                    }
+                    n = next;
+                }
+
+                //readers that begin a pass from now on can't reach retired entries
+                if(removed)
+                    epoch++;
+
+                return removed;
+            }
+
+            /**
+             * Frees the retired entries no reader can still be standing on.
+             *
+             * @returns amount of entries still waiting to be freed.
+             * */
+            size_t reclaim(){
+                uint64_t oldest = quiescent;
+                readersLock.lock();
+                for(auto it = readers.begin(); it != readers.end(); it++)
+                    oldest = std::min(oldest, it->seen.load());
+                readersLock.unlock();
+
+                std::lock_guard<std::mutex> guard(lock);
+                auto it = garbage.begin();
+                while(it != garbage.end()){
+                    if(it->first < oldest){
+                        delete it->second;
+                        it = garbage.erase(it);
+                    }else{
+                        it++;
+                    }
+                }
+
+                return garbage.size();
+            }
+
+            /**
+             * Registers a reader; readers must be detached before the list is destroyed.
+             * */
+            reader* attach(){
+                std::lock_guard<std::mutex> guard(readersLock);
+                readers.emplace_back();
+                return &readers.back();
+            }
+
+            void detach(reader* r){
+                std::lock_guard<std::mutex> guard(readersLock);
+                readers.remove_if([r](const reader& item){return &item == r;});
+            }
+
+            /**
+             * Marks the beginning of a pass of [r] over the list.
+             * */
+            void pin(reader* r){
+                r->seen.store(epoch.load());
+            }
+
+            /**
+             * Marks the end of a pass of [r]; it must not hold iterators past this point.
+             * */
+            void unpin(reader* r){
+                r->seen.store(quiescent);
+            }
+
+        private:
+            node head = node(T());                 ///< sentinel; head.next is the first entry
+            std::atomic<node*> tail = &head;       ///< last entry, or the sentinel if empty
+            std::atomic<size_t> count = 0;
+            std::atomic<uint64_t> epoch = 0;
+
+            std::mutex lock;                       ///< serializes insertions, removals and reclamation
+            std::vector<std::pair<uint64_t, node*>> garbage; ///< retired entries and the epoch they were retired on
+
+            std::mutex readersLock;
+            std::list<reader> readers;
+    };
+}
+#endif
@@ -0,0 +1,62 @@
+#include "epochList.cpp"
+#include "doctest.h"
+
+TEST_CASE("EpochList - concurrent removal and reclamation"){
+    Lodestar::EpochList<int> list;
+    for(int i = 0; i < 4; i++)
+        list.push_back(i);
+
+    REQUIRE(list.size() == 4);
+    REQUIRE(list.front() == 0);
+    REQUIRE(list.back() == 3);
+
+    SUBCASE("removal"){
+        REQUIRE(list.remove_if([](const int& item){return item % 2 == 1;}) == 2);
+        REQUIRE(list.size() == 2);
+        REQUIRE(list.back() == 2);
+
+        //appending after the tail was removed
+        list.push_back(4);
+        int sum = 0;
+        for(auto it = list.begin(); it != list.end(); it++)
+            sum += *it;
+        REQUIRE(sum == 6);
+
+        //with no readers everything is freed at once
+        REQUIRE(list.reclaim() == 0);
+    }
+
+    SUBCASE("reader standing on a removed entry"){
+        auto reader = list.attach();
+        list.pin(reader);
+
+        auto it = list.begin();
+        it++;
+        REQUIRE(*it == 1);
+
+        list.remove_if([](const int& item){return item == 1;});
+
+        //the reader can still move on from the removed entry
+        REQUIRE(list.reclaim() == 1);
+        it++;
+        REQUIRE(*it == 2);
+
+        //and it is freed once the reader passed a quiescent point
+        list.unpin(reader);
+        REQUIRE(list.reclaim() == 0);
+
+        list.detach(reader);
+    }
+
+    SUBCASE("readers pinned after removal don't hold entries"){
+        auto reader = list.attach();
+
+        list.remove_if([](const int& item){return item == 0;});
+        list.pin(reader);
+        REQUIRE(list.reclaim() == 0);
+        REQUIRE(list.front() == 1);
+
+        list.unpin(reader);
+        list.detach(reader);
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef LODEEPOLLB_H
+#define LODEEPOLLB_H
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include "ioBackend.cpp"
+
+namespace Lodestar{
+    /**
+     * ioBackend which polls for readiness with epoll and receives with recv().
+     * */
+    class epollBackend: public ioBackend{
+        public:
+            /**
+             * @param maxEvents max amount of events a single wait() call handles.
+             * @param bufferSize max amount of bytes received from a socket per event.
+             * */
+            epollBackend(int maxEvents = 64, int bufferSize = 4096):
+                epollfd(epoll_create1(0)),
+                bufferSize(bufferSize),
+                scratch(maxEvents * bufferSize),
+                polled(maxEvents)
+            {
+                wakefd = eventfd(0, EFD_NONBLOCK);
+                epoll_event event;
+                event.events = EPOLLIN;
+                event.data.u64 = wakefd;
+                if(epollfd >= 0 && wakefd >= 0)
+                    epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &event);
+            }
+
+            ~epollBackend(){
+                close(epollfd);
+                if(wakefd >= 0)
+                    close(wakefd);
+            }
+
+            bool ok(){
+                return epollfd >= 0 && wakefd >= 0;
+            }
+
+            bool watch(int fd, void* context){
+                setContext(fd, context);
+
+                epoll_event event;
+                event.events = EPOLLIN | EPOLLRDHUP;
+                event.data.u64 = fd;
+                return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) == 0;
+            }
+
+            void unwatch(int fd){
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+                setContext(fd, NULL);
+            }
+
+            void setWriting(int fd, void*, bool writing){
+                epoll_event event;
+                event.events = EPOLLIN | EPOLLRDHUP | (writing ? (uint32_t)EPOLLOUT : 0u);
+                event.data.u64 = fd;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+            }
+
+            int wait(ioEvent* events, int max, int timeout){
+                //each polled socket can become up to two events
+                int n = epoll_wait(epollfd, &polled[0], std::min<int>(max / 2, polled.size()), timeout);
+                int count = 0;
+
+                std::lock_guard<std::mutex> guard(contextLock);
+                for(int i = 0; i < n; i++){
+                    int fd = polled[i].data.u64;
+                    if(fd == wakefd){
+                        uint64_t wakes;
+                        read(wakefd, &wakes, sizeof(uint64_t));
+                        continue;
+                    }
+
+                    void* context = (size_t)fd < contexts.size() ? contexts[fd] : NULL;
+                    if(!context)
+                        continue;
+
+                    if(polled[i].events & EPOLLOUT){
+                        //writable events are delivered once; stop polling until set again
+                        setWriting(fd, context, false);
+                        events[count++] = ioEvent {ioEvent::writable, fd, context, NULL, 0, -1};
+                    }
+
+                    if(polled[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                        char* buffer = &scratch[i * bufferSize];
+                        int received = recv(fd, buffer, bufferSize, MSG_DONTWAIT);
+
+                        if(received > 0)
+                            events[count++] = ioEvent {ioEvent::received, fd, context, buffer, received, -1};
+                        else if(received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                            events[count++] = ioEvent {ioEvent::closed, fd, context, NULL, 0, -1};
+                    }
+                }
+
+                return count;
+            }
+
+            void wake(){
+                uint64_t one = 1;
+                write(wakefd, &one, sizeof(uint64_t));
+            }
+
+            void done(ioEvent&){}
+
+            const char* name(){
+                return "epoll";
+            }
+
+        private:
+            int epollfd;
+            int wakefd;                       ///< eventfd written to by wake()
+            int bufferSize;
+            std::vector<char> scratch;        ///< one receive buffer per polled event
+            std::vector<epoll_event> polled;
+            std::mutex contextLock;
+            std::vector<void*> contexts;      ///< context of each watched socket, indexed by fd
+
+            void setContext(int fd, void* context){
+                std::lock_guard<std::mutex> guard(contextLock);
+                if((size_t)fd >= contexts.size())
+                    contexts.resize(fd + 1, NULL);
+                contexts[fd] = context;
+            }
+    };
+}
+
+#endif
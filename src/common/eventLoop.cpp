@@ -0,0 +1,216 @@
+#ifndef LODEELOOP_H
+#define LODEELOOP_H
+#include <vector>
+#include <deque>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include "task.cpp"
+
+namespace Lodestar{
+    /**
+     * A single threaded event loop which drives tasks waiting on sockets.
+     *
+     * Tasks suspend on readable() or writable() and the loop resumes them once
+     * epoll reports their socket ready, so any amount of sockets can be waited
+     * on by the thread calling run(). Loops are independent from each other,
+     * so several can run on several threads.
+     * */
+    class eventLoop{
+        public:
+            /**
+             * Awaitable which suspends the awaiting task until a socket is ready.
+             * */
+            struct readiness {
+                eventLoop* loop;
+                int fd;
+                bool writing;
+
+                bool await_ready(){ return false; }
+                void await_suspend(std::coroutine_handle<> awaiting){ loop->suspend(fd, writing, awaiting); }
+                void await_resume(){}
+            };
+
+            eventLoop(): epollfd(epoll_create1(0)){}
+
+            eventLoop(const eventLoop& loop) = delete;
+
+            ~eventLoop(){
+                close(epollfd);
+            }
+
+            /**
+             * @returns the loop being run by the calling thread, NULL if none.
+             * */
+            static eventLoop* current(){
+                return running;
+            }
+
+            /**
+             * Hands a task to the loop; it starts once run() is called.
+             * */
+            void spawn(task<void> spawned){
+                tasks.push_back(supervise(std::move(spawned)));
+                ready.push_back(&tasks.back());
+                unfinished++;
+            }
+
+            /**
+             * Runs spawned tasks until every one of them finishes.
+             *
+             * If a task throws, the exception is rethrown from here and
+             * the remaining tasks are left suspended.
+             * */
+            void run(){
+                eventLoop* previous = running;
+                running = this;
+
+                try{
+                    while(true){
+                        resumeReady();
+                        if(error)
+                            std::rethrow_exception(std::exchange(error, nullptr));
+                        if(unfinished == 0)
+                            break;
+                        poll();
+                    }
+                }catch(...){
+                    running = previous;
+                    throw;
+                }
+
+                running = previous;
+                tasks.clear();
+            }
+
+            /**
+             * Suspends the awaiting task until [fd] can be read from or closes.
+             * */
+            readiness readable(int fd){
+                return readiness {this, fd, false};
+            }
+
+            /**
+             * Suspends the awaiting task until [fd] can be written to or errors.
+             * */
+            readiness writable(int fd){
+                return readiness {this, fd, true};
+            }
+
+        private:
+            /**
+             * Tasks suspended on a socket.
+             * */
+            struct waiters {
+                std::coroutine_handle<> reader;
+                std::coroutine_handle<> writer;
+            };
+
+            static inline thread_local eventLoop* running = NULL;
+
+            int epollfd;
+            std::deque<task<void>> tasks;                  ///< spawned tasks, finished or not
+            std::deque<task<void>*> ready;                 ///< spawned tasks yet to be started
+            size_t unfinished = 0;                         ///< amount of spawned tasks which haven't finished
+            std::exception_ptr error;                      ///< exception that escaped a spawned task
+            std::deque<std::coroutine_handle<>> woken;     ///< suspended coroutines whose socket is ready
+            std::vector<waiters> sockets;                  ///< indexed by fd
+
+            /**
+             * Runs a spawned task, keeping track of when it finishes.
+             * */
+            task<void> supervise(task<void> spawned){
+                try{
+                    co_await spawned;
+                }catch(...){
+                    if(!error)
+                        error = std::current_exception();
+                }
+                unfinished--;
+            }
+
+            /**
+             * Registers [awaiting] to be resumed once [fd] is ready.
+             * */
+            void suspend(int fd, bool writing, std::coroutine_handle<> awaiting){
+                if((size_t)fd >= sockets.size())
+                    sockets.resize(fd + 1);
+
+                if(writing)
+                    sockets[fd].writer = awaiting;
+                else
+                    sockets[fd].reader = awaiting;
+
+                //a socket epoll can't watch is resumed right away, and its next syscall reports why
+                if(!arm(fd))
+                    wake(fd, EPOLLERR);
+            }
+
+            /**
+             * Polls [fd] for what its waiters need, once.
+             * */
+            bool arm(int fd){
+                epoll_event event;
+                event.events = EPOLLONESHOT
+                    | (sockets[fd].reader ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u)
+                    | (sockets[fd].writer ? (uint32_t)EPOLLOUT : 0u);
+                event.data.fd = fd;
+
+                //oneshot entries stay registered once fired, and closed
+                //sockets leave epoll on their own, so either call may be the right one
+                if(epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) == 0)
+                    return true;
+                return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) == 0;
+            }
+
+            /**
+             * Moves the waiters of [fd] which [events] concern to the woken queue.
+             * */
+            void wake(int fd, uint32_t events){
+                bool failed = events & (EPOLLERR | EPOLLHUP);
+
+                if(sockets[fd].reader && (failed || events & (EPOLLIN | EPOLLRDHUP)))
+                    woken.push_back(std::exchange(sockets[fd].reader, nullptr));
+                if(sockets[fd].writer && (failed || events & EPOLLOUT))
+                    woken.push_back(std::exchange(sockets[fd].writer, nullptr));
+            }
+
+            /**
+             * Waits for sockets to become ready and moves their waiters to the woken queue.
+             * */
+            void poll(){
+                epoll_event events[64];
+                int n = epoll_wait(epollfd, events, 64, -1);
+
+                for(int i = 0; i < n; i++){
+                    int fd = events[i].data.fd;
+                    wake(fd, events[i].events);
+
+                    if(sockets[fd].reader || sockets[fd].writer)
+                        arm(fd);
+                }
+            }
+
+            /**
+             * Starts spawned tasks and resumes woken coroutines until there's nothing to run.
+             * */
+            void resumeReady(){
+                while(!ready.empty() || !woken.empty()){
+                    if(!ready.empty()){
+                        task<void>* started = ready.front();
+                        ready.pop_front();
+                        started->resume();
+                    }else{
+                        std::coroutine_handle<> resumed = woken.front();
+                        woken.pop_front();
+                        resumed.resume();
+                    }
+                }
+            }
+    };
+}
+
+#endif
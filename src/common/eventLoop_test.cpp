@@ -0,0 +1,109 @@
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "eventLoop.cpp"
+#include "communication.cpp"
+#include "doctest.h"
+
+static Lodestar::task<int> answer(){
+    co_return 42;
+}
+
+static Lodestar::task<void> chained(int* result){
+    *result = co_await answer() + co_await answer();
+}
+
+static Lodestar::task<void> failing(){
+    throw "failed";
+    co_return;
+}
+
+static Lodestar::task<void> sendQuery(int sockfd, const char* name, int* sent){
+    Lodestar::subtreeQuery query;
+    query.name = (char*)name;
+    query.nameLen = strlen(name) + 1;
+    query.dataType = Lodestar::msgtype::subtreeQry;
+
+    Lodestar::message msg;
+    msg.data = &query;
+    *sent = co_await msg.send(sockfd);
+}
+
+static Lodestar::task<void> recvQuery(int sockfd, std::string* name, Lodestar::msgStatus* status){
+    Lodestar::message msg;
+    *status = co_await msg.recv(sockfd);
+    if(*status != Lodestar::msgStatus::ok)
+        co_return;
+
+    msg.deserializeMessage();
+    *name = static_cast<Lodestar::subtreeQuery*>(msg.data)->name;
+    delete msg.data;
+}
+
+TEST_CASE("eventLoop - tasks"){
+    Lodestar::eventLoop loop;
+
+    SUBCASE("awaited tasks hand back their result"){
+        int result = 0;
+        loop.spawn(chained(&result));
+        loop.run();
+        REQUIRE(result == 84);
+    }
+
+    SUBCASE("exceptions reach run()"){
+        loop.spawn(failing());
+        REQUIRE_THROWS(loop.run());
+    }
+
+    SUBCASE("awaitable messages need a running loop"){
+        int sent = 0;
+        Lodestar::task<void> orphan = sendQuery(-1, "dir", &sent);
+        orphan.resume();
+        REQUIRE(orphan.done());
+        REQUIRE_THROWS(orphan.result());
+    }
+}
+
+TEST_CASE("eventLoop - awaitable messages"){
+    Lodestar::eventLoop loop;
+
+    SUBCASE("many sockets on a single thread"){
+        const int nPairs = 200;
+        std::vector<int> fds(2 * nPairs);
+        std::vector<std::string> names(nPairs);
+        std::vector<Lodestar::msgStatus> statuses(nPairs, Lodestar::msgStatus::receiving);
+        std::vector<int> sent(nPairs, 0);
+
+        //receivers are spawned first, so every one of them suspends on its socket
+        for(int i = 0; i < nPairs; i++){
+            REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, &fds[2 * i]) == 0);
+            loop.spawn(recvQuery(fds[2 * i], &names[i], &statuses[i]));
+        }
+        for(int i = 0; i < nPairs; i++)
+            loop.spawn(sendQuery(fds[2 * i + 1], "dir/topic", &sent[i]));
+
+        loop.run();
+
+        for(int i = 0; i < nPairs; i++){
+            CHECK(sent[i] > 0);
+            CHECK(statuses[i] == Lodestar::msgStatus::ok);
+            CHECK(names[i] == "dir/topic");
+            close(fds[2 * i]);
+            close(fds[2 * i + 1]);
+        }
+    }
+
+    SUBCASE("closed peers"){
+        int fds[2];
+        REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+        std::string name;
+        Lodestar::msgStatus status = Lodestar::msgStatus::receiving;
+        loop.spawn(recvQuery(fds[0], &name, &status));
+        close(fds[1]);
+        loop.run();
+
+        REQUIRE(status == Lodestar::msgStatus::nomsg);
+        close(fds[0]);
+    }
+}
@@ -0,0 +1,187 @@
+#ifndef LODEFREADER_H
+#define LODEFREADER_H
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include "communication.cpp"
+#include "eventLoop.cpp"
+#include "task.cpp"
+
+namespace Lodestar{
+    /**
+     * A read buffer for a connection, from which frames are parsed in place.
+     *
+     * Each fill() takes whatever the socket has, in a single recv, and next()
+     * then yields every complete frame in the buffer without another syscall.
+     * The partial frame at the end is kept and completed by the next fill(), so
+     * a burst of small frames costs one syscall per wakeup instead of two or
+     * more per frame like message::recvMessage_for() does.
+     * */
+    class frameReader{
+        public:
+            static const uint16_t maxFrame = 1022; ///< largest frame a message can deserialize, without its size header
+
+            /**
+             * @param capacity size of the buffer; at least room for one frame is always kept.
+             * */
+            frameReader(size_t capacity = 64 * 1024): buffer(std::max<size_t>(capacity, maxFrame + 2)){}
+
+            /**
+             * Receives as much as the socket has and the buffer fits, with a single recv.
+             *
+             * @param sockfd the socket to receive from.
+             * @param flags flags for recv, e.g. MSG_DONTWAIT.
+             * @returns what recv returned: bytes received, 0 if the peer closed, -1 on error.
+             * */
+            int fill(int sockfd, int flags = 0){
+                compact();
+                int rv = ::recv(sockfd, &buffer[tail], buffer.size() - tail, flags);
+                if(rv > 0)
+                    tail += rv;
+                return rv;
+            }
+
+            /**
+             * Deserializes the frame at the front of the buffer, if it's complete.
+             *
+             * @param[out] msg the message the frame is deserialized into.
+             * @returns ok once a frame is deserialized, receiving if there's no complete
+             * frame buffered, broken (with errno set to EBADMSG) if the frame is malformed.
+             * */
+            msgStatus next(message& msg){
+                if(tail - head < 2)
+                    return msgStatus::receiving;
+
+                uint16_t size;
+                std::memcpy((char*)&size, &buffer[head], sizeof(uint16_t));
+                if(size > maxFrame || size == 0)
+                    return malformed();
+                if(tail - head < size + 2u)
+                    return msgStatus::receiving;
+
+                //a frame is consumed even if it can't be deserialized, but the stream can't be trusted afterwards
+                head += size + 2;
+                if(!msg.deserializeMessage(&buffer[head - size], size))
+                    return malformed();
+                return msgStatus::ok;
+            }
+
+            /**
+             * Waits up to [time] for the next frame, receiving as needed.
+             *
+             * @param sockfd the socket to receive from.
+             * @param[out] msg the message the frame is deserialized into.
+             * @param time the longest this may block for.
+             * @returns ok once a frame is deserialized, receiving if [time] ran out first,
+             * nomsg if the peer closed the connection between frames, broken (with errno
+             * set) if the socket errored out, or the peer closed it or sent a malformed frame.
+             * */
+            msgStatus recv_for(int sockfd, message& msg, std::chrono::milliseconds time){
+                auto deadline = std::chrono::steady_clock::now() + time;
+
+                msgStatus status;
+                while((status = next(msg)) == msgStatus::receiving){
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    if(remaining.count() <= 0)
+                        return msgStatus::receiving;
+
+                    pollfd pfd {sockfd, POLLIN, 0};
+                    if(poll(&pfd, 1, remaining.count()) <= 0)
+                        continue;
+
+                    int rv = fill(sockfd, MSG_DONTWAIT);
+                    if(rv == 0)
+                        return closed();
+                    if(rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        return msgStatus::broken;
+                }
+
+                return status;
+            }
+
+            /**
+             * Receives the next frame from a task.
+             *
+             * Suspends the awaiting task until a frame is complete, and is resumed by
+             * the event loop running on the calling thread.
+             *
+             * @param sockfd the socket to receive from.
+             * @param[out] msg the message the frame is deserialized into.
+             * @returns ok once a frame is deserialized, nomsg if the peer closed the connection
+             * between frames, broken as recv_for() does.
+             * */
+            task<msgStatus> recv(int sockfd, message& msg){
+                eventLoop* loop = eventLoop::current();
+                if(!loop)
+                    throw "No event loop running on this thread";
+
+                msgStatus status;
+                while((status = next(msg)) == msgStatus::receiving){
+                    int rv = fill(sockfd, MSG_DONTWAIT);
+                    if(rv == 0)
+                        co_return closed();
+                    if(rv > 0 || errno == EINTR)
+                        continue;
+                    if(errno != EAGAIN && errno != EWOULDBLOCK)
+                        co_return msgStatus::broken;
+
+                    co_await loop->readable(sockfd);
+                }
+
+                co_return status;
+            }
+
+            /**
+             * @returns amount of bytes received but not yet yielded as frames.
+             * */
+            size_t buffered(){
+                return tail - head;
+            }
+
+            /**
+             * Drops everything buffered, e.g. when the connection is replaced.
+             * */
+            void clear(){
+                head = 0;
+                tail = 0;
+            }
+
+        private:
+            std::vector<char> buffer;
+            size_t head = 0;  ///< start of the first frame not yet yielded
+            size_t tail = 0;  ///< end of the bytes received
+
+            /**
+             * Moves the partial frame at the end to the front, if there's little room left after it.
+             * */
+            void compact(){
+                if(head == tail){
+                    head = 0;
+                    tail = 0;
+                }else if(buffer.size() - tail < maxFrame + 2){
+                    std::memmove(&buffer[0], &buffer[head], tail - head);
+                    tail -= head;
+                    head = 0;
+                }
+            }
+
+            msgStatus closed(){
+                if(!buffered())
+                    return msgStatus::nomsg;
+                errno = ECONNRESET;
+                return msgStatus::broken;
+            }
+
+            msgStatus malformed(){
+                errno = EBADMSG;
+                return msgStatus::broken;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "frameReader.cpp"
+#include "eventLoop.cpp"
+#include "doctest.h"
+
+static std::string queryFrame(const char* name){
+    Lodestar::subtreeQuery query;
+    query.name = (char*)name;
+    query.nameLen = strlen(name) + 1;
+
+    char buffer[1024];
+    Lodestar::message msg;
+    msg.data = &query;
+    uint16_t size = msg.serializeMessage(&buffer[2]);
+    buffer[0] = size;
+    buffer[1] = size >> 8;
+    return std::string(buffer, size + 2);
+}
+
+static std::string queriedName(Lodestar::message& msg){
+    std::string name = static_cast<Lodestar::subtreeQuery*>(msg.data)->name;
+    delete[] static_cast<Lodestar::subtreeQuery*>(msg.data)->name;
+    delete msg.data;
+    return name;
+}
+
+static Lodestar::task<void> readNames(Lodestar::frameReader* reader, int sockfd, std::vector<std::string>* names){
+    Lodestar::message msg;
+    while(co_await reader->recv(sockfd, msg) == Lodestar::msgStatus::ok)
+        names->push_back(queriedName(msg));
+}
+
+TEST_CASE("frameReader - many frames per receive"){
+    int fds[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+    Lodestar::frameReader reader;
+    Lodestar::message msg;
+
+    SUBCASE("a burst takes a single receive"){
+        std::string burst;
+        for(int i = 0; i < 50; i++)
+            burst.append(queryFrame(("dir" + std::to_string(i)).c_str()));
+        REQUIRE(send(fds[0], burst.data(), burst.size(), 0) == burst.size());
+
+        REQUIRE(reader.fill(fds[1]) == burst.size());
+        for(int i = 0; i < 50; i++){
+            REQUIRE(reader.next(msg) == Lodestar::msgStatus::ok);
+            CHECK(queriedName(msg) == "dir" + std::to_string(i));
+        }
+        CHECK(reader.next(msg) == Lodestar::msgStatus::receiving);
+        CHECK(reader.buffered() == 0);
+    }
+
+    SUBCASE("a partial frame is carried over"){
+        std::string frames = queryFrame("first") + queryFrame("second");
+        size_t cut = frames.size() - 3;
+        send(fds[0], frames.data(), cut, 0);
+
+        REQUIRE(reader.fill(fds[1]) == cut);
+        REQUIRE(reader.next(msg) == Lodestar::msgStatus::ok);
+        CHECK(queriedName(msg) == "first");
+        CHECK(reader.next(msg) == Lodestar::msgStatus::receiving);
+        CHECK(reader.buffered() > 0);
+
+        send(fds[0], &frames[cut], 3, 0);
+        REQUIRE(reader.recv_for(fds[1], msg, std::chrono::milliseconds(100)) == Lodestar::msgStatus::ok);
+        CHECK(queriedName(msg) == "second");
+    }
+
+    SUBCASE("timing out and closing"){
+        CHECK(reader.recv_for(fds[1], msg, std::chrono::milliseconds(10)) == Lodestar::msgStatus::receiving);
+
+        send(fds[0], "\x05", 1, 0);
+        close(fds[0]);
+        CHECK(reader.recv_for(fds[1], msg, std::chrono::milliseconds(100)) == Lodestar::msgStatus::broken);
+        CHECK(errno == ECONNRESET);
+
+        reader.clear();
+        CHECK(reader.recv_for(fds[1], msg, std::chrono::milliseconds(100)) == Lodestar::msgStatus::nomsg);
+        fds[0] = -1;
+    }
+
+    SUBCASE("malformed frames are refused"){
+        send(fds[0], "\xff\xff\x01", 3, 0);
+        reader.fill(fds[1]);
+        CHECK(reader.next(msg) == Lodestar::msgStatus::broken);
+        CHECK(errno == EBADMSG);
+
+        //frames of unknown types are refused the same way
+        reader.clear();
+        send(fds[0], "\x01\x00\x7f", 3, 0);
+        reader.fill(fds[1]);
+        CHECK(reader.next(msg) == Lodestar::msgStatus::broken);
+        CHECK(msg.data == NULL);
+    }
+
+    SUBCASE("from a task"){
+        Lodestar::eventLoop loop;
+        std::vector<std::string> names;
+        loop.spawn(readNames(&reader, fds[1], &names));
+
+        std::string frames = queryFrame("a") + queryFrame("b") + queryFrame("c");
+        send(fds[0], frames.data(), frames.size(), 0);
+        close(fds[0]);
+        fds[0] = -1;
+
+        loop.run();
+        CHECK(names == std::vector<std::string>{"a", "b", "c"});
+    }
+
+    if(fds[0] >= 0)
+        close(fds[0]);
+    close(fds[1]);
+}
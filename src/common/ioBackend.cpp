@@ -0,0 +1,88 @@
+#ifndef LODEIOB_H
+#define LODEIOB_H
+
+namespace Lodestar{
+    /**
+     * An event delivered by an ioBackend.
+     * */
+    struct ioEvent {
+        enum kind {received, writable, closed};
+
+        kind type;          ///< what happened to the socket.
+        int fd;             ///< the socket the event is about.
+        void* context;      ///< the context the socket was watched with.
+        const char* data;   ///< bytes received; only valid until the event is given to done().
+        int len;            ///< amount of bytes received.
+        int buffer;         ///< backend specific id of the buffer holding data.
+    };
+
+    /**
+     * An interface for the socket layer of an event loop.
+     *
+     * Backends deliver bytes instead of readiness: a received event already holds
+     * what was read from the socket, so it doesn't matter to the event loop if
+     * the backend polled for readiness and called recv() or had the kernel
+     * complete the receive on its own.
+     *
+     * Only wait() and done() need to be called from the event loop thread;
+     * the other functions can be called from any thread.
+     * */
+    class ioBackend{
+        public:
+            virtual ~ioBackend(){}
+
+            /**
+             * Starts delivering the bytes received on [fd] to wait().
+             *
+             * @param fd a connected, non-blocking socket.
+             * @param context pointer handed back on every event of [fd].
+             * @returns false if the socket could not be watched.
+             * */
+            virtual bool watch(int fd, void* context) = 0;
+
+            /**
+             * Stops delivering events of [fd]; must be called before closing it.
+             * */
+            virtual void unwatch(int fd) = 0;
+
+            /**
+             * Sets if writable events of [fd] should be delivered.
+             *
+             * Writable events are edge-like: one is delivered once the socket can be
+             * written to, and [fd] needs to be set again to get another one.
+             * */
+            virtual void setWriting(int fd, void* context, bool writing) = 0;
+
+            /**
+             * Waits for events.
+             *
+             * @param[out] events where events are to be written.
+             * @param max size of [events].
+             * @param timeout max time to wait, in milliseconds.
+             * @returns amount of events written.
+             * */
+            virtual int wait(ioEvent* events, int max, int timeout) = 0;
+
+            /**
+             * Makes a wait() in progress on another thread return early, or the next one if none is.
+             *
+             * Meant for handing work to the event loop thread: whatever was handed
+             * over before wake() is seen by the loop once wait() returns.
+             * */
+            virtual void wake() = 0;
+
+            /**
+             * Gives the buffer of an event back to the backend.
+             *
+             * Every event returned by wait() must be given back before the next wait().
+             * */
+            virtual void done(ioEvent& event) = 0;
+
+            /**
+             * @returns the name of the backend, for logging.
+             * */
+            virtual const char* name() = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include <cstring>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "backends.cpp"
+#include "doctest.h"
+
+/**
+ * Waits on [backend] until an event of [type] arrives, returning buffers as it goes.
+ *
+ * @returns the bytes received, if waiting for received events.
+ * */
+static std::string waitFor(Lodestar::ioBackend* backend, Lodestar::ioEvent::kind type, bool& arrived){
+    Lodestar::ioEvent events[8];
+    std::string received;
+    arrived = false;
+
+    for(int tries = 0; tries < 20 && !arrived; tries++){
+        int n = backend->wait(events, 8, 50);
+        for(int i = 0; i < n; i++){
+            if(events[i].type == Lodestar::ioEvent::received)
+                received.append(events[i].data, events[i].len);
+            if(events[i].type == type)
+                arrived = true;
+            backend->done(events[i]);
+        }
+    }
+
+    return received;
+}
+
+static void exerciseBackend(Lodestar::ioBackend* backend){
+    int fds[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+    int context = 0;
+    bool arrived;
+
+    REQUIRE(backend->watch(fds[0], &context));
+
+    SUBCASE("received bytes are delivered"){
+        REQUIRE(send(fds[1], "lodestar", 8, 0) == 8);
+        REQUIRE(waitFor(backend, Lodestar::ioEvent::received, arrived) == "lodestar");
+        REQUIRE(arrived);
+
+        //the receive stays armed for the next bytes
+        REQUIRE(send(fds[1], "again", 5, 0) == 5);
+        REQUIRE(waitFor(backend, Lodestar::ioEvent::received, arrived) == "again");
+    }
+
+    SUBCASE("writable events are delivered once per request"){
+        backend->setWriting(fds[0], &context, true);
+        waitFor(backend, Lodestar::ioEvent::writable, arrived);
+        REQUIRE(arrived);
+
+        waitFor(backend, Lodestar::ioEvent::writable, arrived);
+        REQUIRE(!arrived);
+    }
+
+    SUBCASE("closed peers are reported"){
+        close(fds[1]);
+        fds[1] = -1;
+        waitFor(backend, Lodestar::ioEvent::closed, arrived);
+        REQUIRE(arrived);
+    }
+
+    SUBCASE("unwatched sockets are not reported"){
+        backend->unwatch(fds[0]);
+        REQUIRE(send(fds[1], "ignored", 7, 0) == 7);
+        REQUIRE(waitFor(backend, Lodestar::ioEvent::received, arrived) == "");
+        REQUIRE(!arrived);
+    }
+
+    SUBCASE("waking a wait from another thread"){
+        Lodestar::ioEvent events[8];
+        std::thread waker([backend](){
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            backend->wake();
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        int n = backend->wait(events, 8, 5000);
+        auto waited = std::chrono::steady_clock::now() - start;
+        waker.join();
+
+        //waking delivers no event of its own
+        REQUIRE(n == 0);
+        REQUIRE(waited < std::chrono::seconds(2));
+    }
+
+    backend->unwatch(fds[0]);
+    close(fds[0]);
+    if(fds[1] >= 0)
+        close(fds[1]);
+}
+
+TEST_CASE("ioBackend - epoll"){
+    Lodestar::epollBackend backend;
+    REQUIRE(backend.ok());
+    exerciseBackend(&backend);
+}
+
+TEST_CASE("ioBackend - io_uring"){
+    Lodestar::uringBackend backend;
+    //older kernels can't run it; Master falls back to epoll on those
+    if(!backend.ok())
+        return;
+    exerciseBackend(&backend);
+}
+
+TEST_CASE("ioBackend - fallback"){
+    Lodestar::ioBackend* backend = Lodestar::createBackend(true);
+    REQUIRE(backend != NULL);
+    delete backend;
+
+    backend = Lodestar::createBackend(false);
+    REQUIRE(std::string(backend->name()) == "epoll");
+    delete backend;
+}
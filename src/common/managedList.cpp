@@ -3,11 +3,14 @@
 #include <list>
 #include <mutex>
 #include <utility>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <thread>
-#include <future>
+#include <condition_variable>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include "workerPool.cpp"
+#include "epochList.cpp"
 
 using semaphore = boost::interprocess::interprocess_semaphore;
 using namespace std::chrono_literals;
@@ -42,49 +45,78 @@ namespace Lodestar{
              *
              * @param nMaxThreads the maximum amount of threads that this ManagedList
              * can have at once.
+             * @param workerPool the pool threads are borrowed from.
              * */
-            ManagedList(long nMaxThreads): maxThreads(nMaxThreads){
+            ManagedList(long nMaxThreads, WorkerPool& workerPool = WorkerPool::shared()):
+                maxThreads(nMaxThreads),
+                pool(&workerPool)
+            {
                 isAsync = true;
             }
 
             ~ManagedList(){
+                stop();
+            }
+
+            bool isAsync = false;
+            int maxThreads = 0;
+            int nThreads = 0;         ///< workers borrowed and not yet told to stop
+
+            EpochList<listType> list;
+            std::mutex listLock;      ///< mutex to control list addition
+
+            /**
+             * Function called to start overseer thread.
+             *
+             * @param sleepTime the time that the thread should sleep
+             * between oversee() calls.
+             * */
+            void init(std::chrono::milliseconds sleepTime){
+                isOk = true;
+                overseerSleep = sleepTime;
+                overseerThread = std::thread([this, sleepTime](){
+                    while(isOk){
+                        oversee();
+                        std::this_thread::sleep_for(sleepTime);
+                    }
+                });
+            }
+
+            /**
+             * Stops the overseer thread and every thread managing the list.
+             *
+             * Called by the destructor, but since threads call the virtual functions
+             * of derived classes, those should call it on their own destructors.
+             * */
+            void stop(){
                 if(isAsync){
                     //stop overseer thread
                     isOk = false;
                     if(overseerThread.joinable())
                        overseerThread.join();
 
-                    //tell all threads to stop
+                    //tell every borrowed thread to stop, whether it started iterating yet or not
+                    threadLock.lock();
                     while(nThreads > 0){
                         stopSignal.post();
                         nThreads--;
                     }
+                    threadLock.unlock();
 
-                    //join them all
-                    for(auto it = threadList.begin(); it != threadList.end(); it++){
-                        it->wait();
-                    }
+                    //wait until they are all back in the pool
+                    std::unique_lock<std::mutex> guard(borrowLock);
+                    borrowDone.wait(guard, [this](){return borrowed == 0;});
                 }
             }
 
-            bool isAsync;
-            int maxThreads = 0;
-            int nThreads = 0;
-
-            std::list<listType> list;
-            std::mutex listLock;      ///< mutex to control list addition
-
             /**
-             * Function called to start overseer thread.
+             * Sets the latency adaptiveThreads() scales the amount of threads against.
              *
-             * @param sleepTime the time that the thread should sleep
-             * between oversee() calls.
+             * @param target the desired time, in microseconds, of a manage() pass
+             * and of the wait of an entry between passes.
              * */
-            void init(std::chrono::milliseconds sleepTime){
-                overseerThread = std::thread([this, sleepTime](){
-                    oversee();
-                    std::this_thread::sleep_for(sleepTime);
-                });
+            void setLatencyTarget(std::chrono::microseconds target){
+                latencyTarget = target.count();
             }
 
             /**
@@ -100,18 +132,83 @@ namespace Lodestar{
 
         protected:
             std::thread overseerThread;
+            std::chrono::milliseconds overseerSleep = 0ms; ///< time the overseer thread sleeps between passes
+
+            std::atomic<long> passTime = 0;       ///< moving average of manage() durations, in microseconds
+            std::atomic<long> waitTime = 0;       ///< moving average of entry wait times, in microseconds
+            std::atomic<long> latencyTarget = 50000; ///< latency adaptiveThreads() aims for, in microseconds
+            int idlePasses = 0;                   ///< consecutive adaptiveThreads() calls with an empty list
+            static const int idleCutoff = 5;      ///< idle calls before adaptiveThreads() stops the last thread
+
+            /**
+             * Adds a sample to a moving average.
+             *
+             * @param average the average to be updated.
+             * @param sample the sampled duration.
+             * */
+            void sample(std::atomic<long>& average, std::chrono::steady_clock::duration sample){
+                long us = std::chrono::duration_cast<std::chrono::microseconds>(sample).count();
+                long old = average.load();
+                average.store(old + (us - old) / 8);
+            }
+
+            /**
+             * Samples how long an entry waited to be managed again.
+             *
+             * Meant to be called by manage() whenever it picks up an entry.
+             *
+             * @param wait time since the entry was last managed (or inserted).
+             * */
+            void sampleWait(std::chrono::steady_clock::duration wait){
+                sample(waitTime, wait);
+            }
+
+            /**
+             * A threadHeuristic() based on measured latency.
+             *
+             * Compares the greater of the average manage() pass duration and the average
+             * entry wait against latencyTarget, adding a thread when it's over 125% of
+             * the target and removing one when it's under 50% of it. Between those marks
+             * the amount of threads is kept, so oscillating load doesn't make threads
+             * start and stop every pass.
+             * Keeps at least one thread while the list isn't empty, and only stops the
+             * last one once the list has been empty for [idleCutoff] calls.
+             *
+             * @returns the amount of threads that should be running, at most maxThreads.
+             * */
+            int adaptiveThreads(){
+                if(list.empty()){
+                    if(++idlePasses < idleCutoff)
+                        return nThreads;
+                    return 0;
+                }
+                idlePasses = 0;
+
+                long latency = std::max(passTime.load(), waitTime.load());
+                long target = latencyTarget.load();
+                int threads = nThreads;
+
+                if(threads == 0)
+                    threads = 1;
+                else if(latency * 4 > target * 5)
+                    threads++;
+                else if(latency * 2 < target && threads > 1)
+                    threads--;
+
+                return std::min(threads, maxThreads);
+            }
 
         private:
             friend class test_managed;
 
-            bool isOk;
+            std::atomic<bool> isOk = false;
 
-            std::list<std::future<void>> threadList;
-            std::mutex threadLock;     ///< mutex to control thread starting and stopping
+            WorkerPool* pool = &WorkerPool::shared(); ///< pool threads are borrowed from
+            int borrowed = 0;                  ///< amount of pool workers currently running iterate()
+            std::mutex borrowLock;
+            std::condition_variable borrowDone; ///< signals that a borrowed worker returned to the pool
+            std::mutex threadLock;     ///< mutex to control nThreads
 
-            semaphore awaitSignal = 0;
-            semaphore waitingSignal = 0;
-            semaphore continueSignal = 0;
             semaphore stopSignal = 0;      ///< signal to stop a list manager from executing
 
             /**
@@ -122,7 +219,7 @@ namespace Lodestar{
              * or operating asynchronously it isn't necessary to manually call it.
              * */
             virtual void deletionFunction(){
-                    list.remove_if([](listType item){return !item.active;});
+                    list.remove_if([](const listType& item){return !item.active;});
             }
 
             /**
@@ -155,96 +252,76 @@ namespace Lodestar{
              * */
             virtual void manage() = 0;
 
-            // NOTE: This is probably an unsafe function, check this later
             /**
              * Calls manage() until it is sent a signal to stop.
              *
-             * Before entering the loop that calls manage(), increments nThreads
-             * so that the amount of threads operating on this list is known.
-             * 
-             * To safeguard against changing nThreads while cleanList() executes,
-             * it uses threadLock() before incrementing or decrementing nThreads.
-             * This probably isn't safe, so i'll look at it later.
+             * Threads are counted in nThreads by oversee() when they're borrowed,
+             * not here, so a thread that hasn't started yet is still sent its signal.
+             *
+             * Each manage() call is a pass over the list; the thread attaches itself
+             * as a reader of the list and marks the beginning and end of each pass,
+             * so that entries removed by cleanList() are only freed once it can't be
+             * standing on them anymore.
              * */
             void iterate(){
-                threadLock.lock();
-                nThreads++;
-                threadLock.unlock();
+                auto reader = list.attach();
 
                 while(!stopSignal.try_wait()){
-                    if(awaitSignal.try_wait()){ //check if there is a signal to wait for deletion
-                        waitingSignal.post();   //notify deletion thread that this thread is waiting
-                        continueSignal.wait();  //wait until deletion thread signals to continue
-                    }
-
+                    auto began = std::chrono::steady_clock::now();
+                    list.pin(reader);
                     manage();
+                    list.unpin(reader);
+                    sample(passTime, std::chrono::steady_clock::now() - began);
                 }
 
-                if(threadLock.try_lock()){
-                    nThreads--;
-                    threadLock.unlock();
-                }else{
-                    //need to behave as a waiting thread
-                    //(so that cleanList() functions correctly)
-                    awaitSignal.wait();
-                    waitingSignal.post();
-                    continueSignal.wait();
-
-                    threadLock.lock();
-                    nThreads--;
-                    threadLock.unlock();
-                }
+                list.detach(reader);
             }
             
             /**
-             * Signals threads to stop operating on this list and calls deletionFunction()
-             * if deletionHeuristic() returns true.
-             * 
-             * Will send [nThreads] signals via awaitSignal so that threads operating
-             * on this list are notified to wait, then wait for them to notify they are
-             * waiting; once it's done, calls deletionFunction() to delete entries, then
-             * and sends [nThreads] signals via continueSignal to notify that deletion is done.
+             * Calls deletionFunction() if deletionHeuristic() returns true, then frees
+             * previously removed entries that no thread can still be reading.
              *
-             * To prevent concurrent write access to list or thread creation durint list cleanup,
-             * locks listLock and threadLock, then unlocks them once done.
+             * Threads operating on this list are never paused: removed entries are
+             * only unlinked and retired by the list, and freed on a later call once
+             * every thread finished the pass it was in when they were removed.
              * */
             void cleanList(){
-                if(deletionHeuristic()){
-                    listLock.lock();
-                    threadLock.lock();
-
-                    for(int n = 0; n < nThreads; n++)
-                        awaitSignal.post();
-                    
-                    for(int n = 0; n < nThreads; n++)
-                        waitingSignal.wait();
-
+                if(deletionHeuristic())
                     deletionFunction();
-                    
-                    for(int n = 0; n < nThreads; n++)
-                        continueSignal.post();
 
-                    threadLock.unlock();
-                    listLock.unlock();
-                }
+                list.reclaim();
             }
 
             /**
              * Oversees the managedList by calling cleanList(), then scaling up or
              * down amount of running threads iterating through this list via
              * threadHeuristics()
+             *
+             * Threads are borrowed from [pool] and go back to it once they
+             * receive a stop signal, so scaling up only costs waking a parked worker.
              * */
             void oversee(){
                 int nNewThreads = 0;
 
                 cleanList();
-                nNewThreads = threadHeuristic() - nThreads;
+                std::lock_guard<std::mutex> threadGuard(threadLock);
+                nNewThreads = std::min(threadHeuristic(), maxThreads) - nThreads;
                 
-                if(nNewThreads > 0 && nThreads <= maxThreads){
-                    //start [nNewThreads] new threads
+                if(nNewThreads > 0){
+                    //borrow [nNewThreads] workers from the pool
                     while(nNewThreads > 0){
-                        auto nThread = std::async(&ManagedList::iterate, this);
-                        threadList.push_front(std::move(nThread));
+                        nThreads++;
+                        borrowLock.lock();
+                        borrowed++;
+                        borrowLock.unlock();
+
+                        pool->run([this](){
+                            iterate();
+
+                            std::lock_guard<std::mutex> guard(borrowLock);
+                            borrowed--;
+                            borrowDone.notify_all();
+                        });
                         nNewThreads--;
                     }
                 }else if(nNewThreads < 0){
@@ -252,14 +329,10 @@ namespace Lodestar{
                     //amount of running threads
                     while(nNewThreads < 0){
                         stopSignal.post();
+                        nThreads--;
                         nNewThreads++;
                     }
                 }
-
-                //clean threads that are inactive
-                threadList.remove_if([](std::future<void>& t){
-                    return t.wait_for(1ms) == std::future_status::ready;
-                });
             }
     };
 }
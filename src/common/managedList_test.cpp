@@ -32,11 +32,10 @@ namespace Lodestar{
             using ManagedList::iterate;
             using ManagedList::cleanList;
             using ManagedList::oversee;
-            using ManagedList::threadLock;
             using ManagedList::stopSignal;
-            using ManagedList::continueSignal;
-            using ManagedList::awaitSignal;
-            using ManagedList::waitingSignal;
+            using ManagedList::adaptiveThreads;
+            using ManagedList::passTime;
+            using ManagedList::waitTime;
     };
 }
 
@@ -47,44 +46,33 @@ TEST_CASE("ManagedList"){
         auto iteratingThread = std::async(&test_managed::iterate, &mockObj);
         std::this_thread::sleep_for(500ms);
         
-        REQUIRE(mockObj.nThreads == 1);
+        REQUIRE(iteratingThread.wait_for(0ms) == std::future_status::timeout);
         
         SUBCASE("normal stopping"){
             mockObj.stopSignal.post();
             
             REQUIRE(iteratingThread.wait_for(std::chrono::milliseconds(1500)) == std::future_status::ready);
-            REQUIRE(mockObj.nThreads == 0);
         }
         
-        SUBCASE("threadLock taken"){
-            auto waitTime = boost::posix_time::second_clock::universal_time();
-            waitTime += boost::posix_time::millisec(200);
-            
-            //tell thread to stop with lock taken
-            mockObj.threadLock.lock();
-            mockObj.stopSignal.post();
-            
-            //check if proper signals were sent
-            mockObj.awaitSignal.post();
-            mockObj.continueSignal.post();
+        SUBCASE("cleanList() while iterating"){
+            //entries are removed without waiting for the iterating thread
+            dummyEntry dummy;
+            mockObj.list.push_back(dummy);
+            mockObj.cleanList();
 
-            //sleep a bit to give thread time to do all its stuff
-            std::this_thread::sleep_for(200ms);
-            REQUIRE(mockObj.waitingSignal.timed_wait(waitTime));
+            REQUIRE(mockObj.list.size() == 0);
 
-            //unlock and sleep again
-            mockObj.threadLock.unlock();
+            //and freed once it went through another pass
             std::this_thread::sleep_for(150ms);
-            REQUIRE(mockObj.nThreads == 0);
+            REQUIRE(mockObj.list.reclaim() == 0);
+
+            mockObj.stopSignal.post();
+            REQUIRE(iteratingThread.wait_for(std::chrono::milliseconds(1500)) == std::future_status::ready);
         }
     }
     
-    SUBCASE("cleanList() - entry deletion and sincronization"){
-        //setting up mock object
-        mockObj.nThreads = 1;
-        mockObj.waitingSignal.post();
-        
-        //set up dummy entry
+    SUBCASE("cleanList() - entry deletion"){
+        //set up dummy entries
         dummyEntry dummy;
         mockObj.list.push_back(dummy);
         mockObj.list.push_back(dummy);
@@ -93,15 +81,49 @@ TEST_CASE("ManagedList"){
         //cleanList call
         mockObj.cleanList();
         
-        //check that entries were deleted and
-        //only 1 of each signal was sent
+        //check that entries were deleted and, with
+        //no thread iterating, freed right away
         REQUIRE(mockObj.list.size() == 0);
-        REQUIRE(mockObj.awaitSignal.try_wait());
-        REQUIRE(!mockObj.awaitSignal.try_wait());
-        REQUIRE(mockObj.continueSignal.try_wait());
-        REQUIRE(!mockObj.continueSignal.try_wait());
+        REQUIRE(mockObj.list.reclaim() == 0);
     }
     
+    SUBCASE("adaptiveThreads() - latency driven scaling"){
+        mockObj.maxThreads = 3;
+        mockObj.setLatencyTarget(std::chrono::microseconds(1000));
+
+        //idle list keeps its thread for a while before stopping it
+        mockObj.nThreads = 1;
+        for(int i = 1; i < 5; i++)
+            REQUIRE(mockObj.adaptiveThreads() == 1);
+        REQUIRE(mockObj.adaptiveThreads() == 0);
+
+        //any entry gets at least one thread
+        dummyEntry dummy;
+        mockObj.list.push_back(dummy);
+        mockObj.nThreads = 0;
+        REQUIRE(mockObj.adaptiveThreads() == 1);
+
+        //over the target scales up, bounded by maxThreads
+        mockObj.nThreads = 1;
+        mockObj.waitTime = 2000;
+        REQUIRE(mockObj.adaptiveThreads() == 2);
+        mockObj.nThreads = 3;
+        REQUIRE(mockObj.adaptiveThreads() == 3);
+
+        //inside the hysteresis band nothing changes
+        mockObj.waitTime = 0;
+        mockObj.passTime = 800;
+        REQUIRE(mockObj.adaptiveThreads() == 3);
+
+        //under it scales down, but never to zero
+        mockObj.passTime = 100;
+        REQUIRE(mockObj.adaptiveThreads() == 2);
+        mockObj.nThreads = 1;
+        REQUIRE(mockObj.adaptiveThreads() == 1);
+
+        mockObj.nThreads = 0;
+    }
+
     SUBCASE("oversee() - proper scaling"){
         //so the destructor cleans the list
         mockObj.isAsync = true;
@@ -129,4 +151,18 @@ TEST_CASE("ManagedList"){
         REQUIRE(mockObj.nThreads == 0);
         REQUIRE(!mockObj.stopSignal.try_wait());
     }
+
+    SUBCASE("stop() - threads borrowed but not started yet"){
+        mockObj.isAsync = true;
+        mockObj.maxThreads = 3;
+
+        //counted as soon as they're borrowed, so stopping right away still reaches them
+        mockObj.heuristic = 3;
+        mockObj.oversee();
+        REQUIRE(mockObj.nThreads == 3);
+
+        mockObj.stop();
+        REQUIRE(mockObj.nThreads == 0);
+        REQUIRE(!mockObj.stopSignal.try_wait());
+    }
 };
@@ -0,0 +1,70 @@
+#ifndef LODEMPOOL_H
+#define LODEMPOOL_H
+#include <vector>
+#include <mutex>
+#include "communication.cpp"
+
+namespace Lodestar{
+    /**
+     * A free list of reusable message objects.
+     *
+     * Meant for holders of many connections which only sometimes are receiving,
+     * so that each connection only holds a message (and its buffer) while
+     * it actually has bytes to receive.
+     * */
+    class messagePool{
+        public:
+            messagePool(){}
+
+            messagePool(const messagePool& pool) = delete;
+
+            ~messagePool(){
+                for(auto it = freeList.begin(); it != freeList.end(); it++)
+                    delete *it;
+            }
+
+            /**
+             * Takes a message from the pool, allocating a new one if it's empty.
+             *
+             * @returns a message ready to receive into.
+             * */
+            message* acquire(){
+                std::lock_guard<std::mutex> guard(lock);
+                if(freeList.empty())
+                    return new message;
+
+                message* msg = freeList.back();
+                freeList.pop_back();
+                return msg;
+            }
+
+            /**
+             * Gives a message back to the pool.
+             *
+             * Deletes the object pointed by its data pointer and resets its state.
+             *
+             * @param msg the message to be returned; must have been taken by acquire().
+             * */
+            void release(message* msg){
+                delete msg->data;
+                msg->data = NULL;
+                msg->reset();
+
+                std::lock_guard<std::mutex> guard(lock);
+                freeList.push_back(msg);
+            }
+
+            /**
+             * @returns amount of messages ready to be reused.
+             * */
+            size_t available(){
+                std::lock_guard<std::mutex> guard(lock);
+                return freeList.size();
+            }
+
+        private:
+            std::mutex lock;
+            std::vector<message*> freeList; ///< messages not taken by anyone
+    };
+}
+#endif
@@ -0,0 +1,23 @@
+#include "messagePool.cpp"
+#include "doctest.h"
+
+TEST_CASE("messagePool - reusable messages"){
+    Lodestar::messagePool pool;
+
+    REQUIRE(pool.available() == 0);
+
+    Lodestar::message* first = pool.acquire();
+    first->data = new Lodestar::shutdown;
+    pool.release(first);
+
+    REQUIRE(pool.available() == 1);
+
+    //released messages are reused and come back clean
+    Lodestar::message* second = pool.acquire();
+    REQUIRE(second == first);
+    REQUIRE(second->data == NULL);
+    REQUIRE(second->state == Lodestar::msgStatus::ok);
+    REQUIRE(pool.available() == 0);
+
+    pool.release(second);
+}
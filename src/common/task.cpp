@@ -0,0 +1,143 @@
+#ifndef LODETASK_H
+#define LODETASK_H
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace Lodestar{
+    template <class T>
+    class task;
+
+    namespace detail{
+        /**
+         * Resumes whoever awaited a task once it finishes.
+         * */
+        struct finalAwaiter {
+            bool await_ready() noexcept { return false; }
+
+            template <class Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+                std::coroutine_handle<> continuation = finished.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        struct promiseBase {
+            std::coroutine_handle<> continuation; ///< coroutine awaiting this one, if any
+            std::exception_ptr error;             ///< exception that escaped the coroutine, if any
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            finalAwaiter final_suspend() noexcept { return {}; }
+            void unhandled_exception(){ error = std::current_exception(); }
+
+            void rethrow(){
+                if(error)
+                    std::rethrow_exception(error);
+            }
+        };
+
+        template <class T>
+        struct promise: promiseBase {
+            T value;
+
+            task<T> get_return_object();
+            void return_value(T returned){ value = std::move(returned); }
+            T result(){ rethrow(); return std::move(value); }
+        };
+
+        template <>
+        struct promise<void>: promiseBase {
+            task<void> get_return_object();
+            void return_void(){}
+            void result(){ rethrow(); }
+        };
+    }
+
+    /**
+     * A lazily started coroutine.
+     *
+     * A task only starts running once it's awaited (or handed to an eventLoop),
+     * and resumes its awaiter directly once it finishes, so chains of awaited
+     * tasks run on whichever thread drives the innermost one.
+     * Exceptions thrown inside a task are rethrown to its awaiter.
+     * */
+    template <class T = void>
+    class task{
+        public:
+            using promise_type = detail::promise<T>;
+
+            task(): handle(nullptr){}
+            explicit task(std::coroutine_handle<promise_type> h): handle(h){}
+
+            task(task&& moved): handle(std::exchange(moved.handle, nullptr)){}
+
+            task& operator=(task&& moved){
+                if(this != &moved){
+                    if(handle)
+                        handle.destroy();
+                    handle = std::exchange(moved.handle, nullptr);
+                }
+                return *this;
+            }
+
+            task(const task& copied) = delete;
+
+            ~task(){
+                if(handle)
+                    handle.destroy();
+            }
+
+            /**
+             * @returns true once the coroutine ran to completion.
+             * */
+            bool done(){
+                return !handle || handle.done();
+            }
+
+            /**
+             * Starts or continues the coroutine on the calling thread.
+             * */
+            void resume(){
+                handle.resume();
+            }
+
+            /**
+             * @returns the value the finished coroutine returned; rethrows what escaped it.
+             * */
+            T result(){
+                return handle.promise().result();
+            }
+
+            auto operator co_await() noexcept {
+                struct awaiter {
+                    std::coroutine_handle<promise_type> awaited;
+
+                    bool await_ready(){ return !awaited || awaited.done(); }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting){
+                        awaited.promise().continuation = awaiting;
+                        return awaited;
+                    }
+
+                    T await_resume(){ return awaited.promise().result(); }
+                };
+                return awaiter {handle};
+            }
+
+        private:
+            std::coroutine_handle<promise_type> handle;
+    };
+
+    template <class T>
+    task<T> detail::promise<T>::get_return_object(){
+        return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+    }
+
+    inline task<void> detail::promise<void>::get_return_object(){
+        return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+    }
+}
+
+#endif
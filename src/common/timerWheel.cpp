@@ -0,0 +1,101 @@
+#ifndef LODETWHEEL_H
+#define LODETWHEEL_H
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+namespace Lodestar{
+    /**
+     * A hashed timer wheel of ids, for timeouts that are mostly pushed back before they're due.
+     *
+     * Time is split into ticks and each id goes into the slot of the tick it's
+     * due at, so scheduling is a push into a vector and advancing costs one slot
+     * per tick elapsed, however many timers there are. Timers are never moved
+     * or cancelled: whoever owns them keeps the actual deadline and, when an id
+     * fires, checks it and schedules the id again if it was pushed back. Ids due
+     * past the span of the wheel fire once per turn until their deadline is near.
+     * */
+    class timerWheel{
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            /**
+             * @param tick the resolution of the wheel; ids fire up to a tick after their deadline.
+             * @param nSlots amount of slots; the wheel spans [tick] * [nSlots].
+             * */
+            timerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(100), size_t nSlots = 256):
+                tick(std::max<std::chrono::milliseconds>(tick, std::chrono::milliseconds(1))),
+                slots(std::max<size_t>(nSlots, 2)),
+                start(clock::now()){}
+
+            /**
+             * Schedules [id] to fire once [deadline] is past.
+             *
+             * May be called from the handler given to advance().
+             * */
+            void schedule(uint64_t id, clock::time_point deadline){
+                //rounded up, so an id never fires before its deadline
+                uint64_t due = tickOf(deadline + tick - std::chrono::nanoseconds(1));
+                if(due <= current)
+                    due = current + 1;
+                if(due - current >= slots.size())
+                    due = current + slots.size() - 1;
+
+                slots[due % slots.size()].push_back(id);
+                count++;
+            }
+
+            /**
+             * Fires every id due by [now], in the order of their ticks.
+             *
+             * @param now the current time.
+             * @param fire called with each id due; it's removed from the wheel before.
+             * */
+            template <class Handler>
+            void advance(clock::time_point now, Handler fire){
+                uint64_t target = tickOf(now);
+                if(target <= current)
+                    return;
+
+                //after a long pause every slot is due, so a single turn is enough
+                if(target - current > slots.size())
+                    current = target - slots.size();
+
+                while(current < target){
+                    current++;
+                    std::vector<uint64_t> due;
+                    due.swap(slots[current % slots.size()]);
+                    count -= due.size();
+                    for(auto it = due.begin(); it != due.end(); it++)
+                        fire(*it);
+                }
+            }
+
+            /**
+             * @returns amount of ids scheduled.
+             * */
+            size_t size(){
+                return count;
+            }
+
+            std::chrono::milliseconds resolution(){
+                return tick;
+            }
+
+        private:
+            std::chrono::milliseconds tick;
+            std::vector<std::vector<uint64_t>> slots;
+            clock::time_point start;
+            uint64_t current = 0;  ///< last tick advanced to
+            size_t count = 0;
+
+            uint64_t tickOf(clock::time_point time){
+                if(time <= start)
+                    return 0;
+                return (time - start) / tick;
+            }
+    };
+}
+
+#endif
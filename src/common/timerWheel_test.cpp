@@ -0,0 +1,63 @@
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "timerWheel.cpp"
+#include "doctest.h"
+
+TEST_CASE("timerWheel - lazily rescheduled timeouts"){
+    using namespace std::chrono_literals;
+    typedef Lodestar::timerWheel::clock clock;
+
+    Lodestar::timerWheel wheel(10ms, 8);
+    clock::time_point now = clock::now();
+    std::vector<uint64_t> fired;
+    auto collect = [&fired](uint64_t id){ fired.push_back(id); };
+
+    wheel.schedule(1, now + 25ms);
+    wheel.schedule(2, now + 45ms);
+    REQUIRE(wheel.size() == 2);
+
+    SUBCASE("ids fire once due, in order"){
+        wheel.advance(now + 10ms, collect);
+        REQUIRE(fired.empty());
+
+        wheel.advance(now + 40ms, collect);
+        REQUIRE(fired == std::vector<uint64_t>{1});
+        wheel.advance(now + 60ms, collect);
+        REQUIRE(fired == std::vector<uint64_t>{1, 2});
+        REQUIRE(wheel.size() == 0);
+    }
+
+    SUBCASE("deadlines already past fire on the next tick"){
+        wheel.schedule(3, now - 1s);
+        wheel.advance(now + 15ms, collect);
+        REQUIRE(fired == std::vector<uint64_t>{3});
+    }
+
+    SUBCASE("deadlines past the span fire early, to be checked and rescheduled"){
+        clock::time_point far = now + 1s;
+        wheel.schedule(4, far);
+
+        clock::time_point at = now;
+        bool expired = false;
+        while(!expired){
+            at += 10ms;
+            wheel.advance(at, [&](uint64_t id){
+                if(id != 4)
+                    return;
+                if(at < far)
+                    wheel.schedule(id, far);
+                else
+                    expired = true;
+            });
+            REQUIRE(at < far + 30ms);
+        }
+        REQUIRE(at >= far);
+    }
+
+    SUBCASE("a long pause fires everything in one turn"){
+        wheel.advance(now + 10s, collect);
+        std::sort(fired.begin(), fired.end());
+        REQUIRE(fired == std::vector<uint64_t>{1, 2});
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef LODETBUCKET_H
+#define LODETBUCKET_H
+#include <chrono>
+#include <algorithm>
+
+namespace Lodestar{
+    /**
+     * A token bucket, letting through [rate] units per second on average and bursts of up to [burst].
+     *
+     * Tokens are refilled lazily from the time elapsed whenever some are taken,
+     * so an idle bucket costs nothing. Not thread safe.
+     * */
+    class tokenBucket{
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            /**
+             * @param rate tokens added per second; 0 or less for a bucket that never runs out.
+             * @param burst most tokens held at once; the bucket starts full.
+             * */
+            tokenBucket(double rate = 0, double burst = 0):
+                rate(rate),
+                burst(std::max(burst, 1.0)),
+                tokens(std::max(burst, 1.0)),
+                last(clock::now()){}
+
+            /**
+             * Takes [n] tokens, if there are as many.
+             *
+             * @returns false if there aren't, in which case none are taken.
+             * */
+            bool take(double n = 1, clock::time_point now = clock::now()){
+                if(!limited())
+                    return true;
+
+                refill(now);
+                if(tokens < n)
+                    return false;
+                tokens -= n;
+                return true;
+            }
+
+            /**
+             * @returns if the bucket is back to full, i.e. it's as if it was never taken from.
+             * */
+            bool full(clock::time_point now = clock::now()){
+                refill(now);
+                return tokens >= burst;
+            }
+
+            bool limited(){
+                return rate > 0;
+            }
+
+        private:
+            double rate;
+            double burst;
+            double tokens;
+            clock::time_point last; ///< when tokens were last refilled
+
+            void refill(clock::time_point now){
+                if(now <= last)
+                    return;
+                tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+                last = now;
+            }
+    };
+}
+
+#endif
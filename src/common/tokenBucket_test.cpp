@@ -0,0 +1,35 @@
+#include <chrono>
+#include "tokenBucket.cpp"
+#include "doctest.h"
+
+TEST_CASE("tokenBucket - rate limiting"){
+    using namespace std::chrono_literals;
+    Lodestar::tokenBucket bucket(10, 3);
+    auto now = Lodestar::tokenBucket::clock::now();
+
+    SUBCASE("bursts up to the capacity"){
+        REQUIRE(bucket.take(1, now));
+        REQUIRE(bucket.take(1, now));
+        REQUIRE(bucket.take(1, now));
+        REQUIRE(!bucket.take(1, now));
+        REQUIRE(!bucket.full(now));
+    }
+
+    SUBCASE("refills at the rate"){
+        REQUIRE(bucket.take(3, now));
+        REQUIRE(!bucket.take(1, now + 50ms));
+        REQUIRE(bucket.take(1, now + 100ms));
+        REQUIRE(!bucket.take(1, now + 100ms));
+
+        //never past the capacity however long it sat idle
+        REQUIRE(bucket.full(now + 10s));
+        REQUIRE(!bucket.take(4, now + 10s));
+        REQUIRE(bucket.take(3, now + 10s));
+    }
+
+    SUBCASE("unlimited buckets never run out"){
+        Lodestar::tokenBucket unlimited;
+        for(int i = 0; i < 1000; i++)
+            REQUIRE(unlimited.take(1, now));
+    }
+}
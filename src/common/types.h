@@ -5,13 +5,56 @@
 namespace Lodestar{
     enum nodeType{dir, topic};
 
-    enum msgtype: uint8_t{authNode, topicReg, topicUpd, shutdwn};
+    /**
+     * Types of the messages built into Lodestar.
+     *
+     * Applications can define their own past firstUserType (see messageRegistry);
+     * a type byte holding any value below 128 is a valid msgtype.
+     * */
+    enum msgtype: uint8_t{authNode, topicReg, topicUpd, shutdwn, topicQry, endpointLst, subtreeQry, subtreeLst,
+                          authAns, heartbt, firstUserType = 64};
 
-    enum msgStatus {ok, receiving, nomsg};
+    static const uint8_t protocolVersion = 1; ///< version of the protocol spoken by this build; 0 is a node predating negotiation
+
+    /**
+     * Optional parts of the protocol, negotiated by the auth handshake.
+     *
+     * A node offers what it supports in its auth frame and the master answers
+     * with the part of it that it supports too; nodes that offer nothing get
+     * none, so they're only ever sent what they could always handle.
+     * */
+    enum feature: uint32_t{
+        batchedRegistration = 1 << 0, ///< registrations and queries sent right behind the auth frame
+        pipelining = 1 << 1,          ///< correlated requests, answered in any order
+        pushedUpdates = 1 << 2,       ///< topic updates pushed as registrars come and go
+        compression = 1 << 3,         ///< reserved; not supported yet
+        largeFrames = 1 << 4,         ///< reserved; not supported yet
+        sharedMemory = 1 << 5,        ///< reserved; not supported yet
+        leases = 1 << 6,              ///< registrations held by a lease the node renews with heartbeats
+    };
+
+    /**
+     * Reason a shutdown frame gives for the connection being closed.
+     * */
+    enum shutdownCode: uint8_t{
+        unspecified = 0,
+        rateLimited = 1, ///< the node sent frames, or its peer opened connections, faster than allowed
+        overloaded = 2,  ///< too many connections were waiting to be authenticated
+    };
+
+    /**
+     * Outcome of receiving a message.
+     *
+     * Receiving never throws on what a peer does; a reset connection or a
+     * malformed frame is reported as broken, with errno telling why.
+     * */
+    enum msgStatus {ok, receiving, nomsg, broken};
 
     class transmittable{
         public:
             msgtype dataType;
+
+            virtual ~transmittable(){}
             
             /**
              * Serialize the object.
@@ -29,6 +72,23 @@ namespace Lodestar{
              *
              * */
             void virtual deserialize(char* buffer) = 0;
+
+            /**
+             * Deserialize the object from a frame of known size.
+             *
+             * Built-in types check every length a peer declares against [len] and
+             * only read optional fields if [len] says they're there. Types that don't
+             * override this are trusted to stay within their frame.
+             *
+             * @param[in] buffer Buffer that contains the object data.
+             * @param len amount of bytes of the object in [buffer]; -1 if unknown.
+             * @returns false if the frame is malformed, in which case nothing is allocated.
+             * */
+            bool virtual deserialize(char* buffer, int len){
+                (void)len;
+                deserialize(buffer);
+                return true;
+            }
     };
 }
 
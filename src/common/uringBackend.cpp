@@ -0,0 +1,364 @@
+#ifndef LODEURINGB_H
+#define LODEURINGB_H
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <csignal>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "ioBackend.cpp"
+
+namespace Lodestar{
+    /**
+     * ioBackend built on io_uring, talking to the kernel interface directly.
+     *
+     * Each watched socket has a multishot receive armed on it, which picks
+     * buffers from a ring of provided buffers, so bytes arrive as completions
+     * without a syscall per receive. Writable events are one-shot polls.
+     *
+     * Needs a kernel with multishot receive and provided buffer rings (6.0+);
+     * if the ring can't be set up, ok() returns false so the caller can fall
+     * back to epollBackend.
+     * */
+    class uringBackend: public ioBackend{
+        public:
+            /**
+             * @param entries size of the submission queue.
+             * @param nBuffers amount of provided buffers; must be a power of 2.
+             * @param bufferSize size of each provided buffer.
+             * */
+            uringBackend(unsigned entries = 256, unsigned nBuffers = 256, unsigned bufferSize = 4096):
+                nBuffers(nBuffers),
+                bufferSize(bufferSize)
+            {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+
+                ringfd = syscall(__NR_io_uring_setup, entries, &params);
+                if(ringfd < 0)
+                    return;
+
+                if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)){
+                    close(ringfd);
+                    ringfd = -1;
+                    return;
+                }
+
+                //submission and completion rings share one mapping
+                ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                    params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+                ring = (char*)mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+                sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                sqes = (io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+                if(ring == MAP_FAILED || sqes == MAP_FAILED){
+                    teardown();
+                    return;
+                }
+
+                sqHead = (unsigned*)(ring + params.sq_off.head);
+                sqTail = (unsigned*)(ring + params.sq_off.tail);
+                sqMask = *(unsigned*)(ring + params.sq_off.ring_mask);
+                sqArray = (unsigned*)(ring + params.sq_off.array);
+                sqEntries = params.sq_entries;
+                cqHead = (unsigned*)(ring + params.cq_off.head);
+                cqTail = (unsigned*)(ring + params.cq_off.tail);
+                cqMask = *(unsigned*)(ring + params.cq_off.ring_mask);
+                cqes = (io_uring_cqe*)(ring + params.cq_off.cqes);
+                localTail = *sqTail;
+
+                if(!setupBuffers())
+                    teardown();
+            }
+
+            ~uringBackend(){
+                teardown();
+            }
+
+            bool ok(){
+                return ringfd >= 0;
+            }
+
+            bool watch(int fd, void* context){
+                std::lock_guard<std::mutex> guard(lock);
+                if((size_t)fd >= watched.size())
+                    watched.resize(fd + 1);
+                watched[fd].context = context;
+                watched[fd].generation++;
+
+                armRecv(fd);
+                return submit() >= 0;
+            }
+
+            void unwatch(int fd){
+                std::lock_guard<std::mutex> guard(lock);
+                if((size_t)fd >= watched.size())
+                    return;
+                watched[fd].context = NULL;
+                watched[fd].generation++;
+
+                //must reach the kernel before the caller closes fd
+                io_uring_sqe* sqe = getSqe();
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = fd;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                sqe->user_data = encode(fd, opCancel, 0);
+                submit();
+            }
+
+            void setWriting(int fd, void*, bool writing){
+                //polls are one-shot, so there's nothing to disarm
+                if(!writing)
+                    return;
+
+                std::lock_guard<std::mutex> guard(lock);
+                if((size_t)fd >= watched.size() || !watched[fd].context)
+                    return;
+
+                io_uring_sqe* sqe = getSqe();
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = fd;
+                sqe->poll32_events = POLLOUT;
+                sqe->user_data = encode(fd, opPoll, watched[fd].generation);
+                submit();
+            }
+
+            int wait(ioEvent* events, int max, int timeout){
+                lock.lock();
+                unsigned toSubmit = publish();
+                lock.unlock();
+
+                timespec ts;
+                ts.tv_sec = timeout / 1000;
+                ts.tv_nsec = (timeout % 1000) * 1000000L;
+
+                io_uring_getevents_arg arg;
+                std::memset(&arg, 0, sizeof(arg));
+                arg.sigmask_sz = _NSIG / 8;
+                arg.ts = (uint64_t)&ts;
+
+                if(__atomic_load_n(cqTail, __ATOMIC_ACQUIRE) == *cqHead || toSubmit){
+                    syscall(__NR_io_uring_enter, ringfd, toSubmit, 1,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+                }
+
+                return reap(events, max);
+            }
+
+            void wake(){
+                std::lock_guard<std::mutex> guard(lock);
+                //the no-op completes right away, which ends the wait for completions
+                io_uring_sqe* sqe = getSqe();
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = encode(0, opWake, 0);
+                submit();
+            }
+
+            void done(ioEvent& event){
+                if(event.buffer < 0)
+                    return;
+                std::lock_guard<std::mutex> guard(lock);
+                provide(event.buffer);
+            }
+
+            const char* name(){
+                return "io_uring";
+            }
+
+        private:
+            enum operation {opRecv = 1, opPoll, opCancel, opWake};
+            static const uint16_t bufferGroup = 0;
+
+            struct watchEntry {
+                void* context = NULL;
+                uint32_t generation = 0; ///< bumped on every watch/unwatch so stale completions are dropped
+            };
+
+            int ringfd = -1;
+            char* ring = (char*)MAP_FAILED;
+            size_t ringSize = 0;
+            io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+            size_t sqesSize = 0;
+
+            unsigned *sqHead, *sqTail, *sqArray, *cqHead, *cqTail;
+            unsigned sqMask, cqMask, sqEntries;
+            io_uring_cqe* cqes;
+            unsigned localTail;       ///< submission tail not yet published to the kernel
+            unsigned unsubmitted = 0; ///< published entries not yet passed to io_uring_enter()
+
+            unsigned nBuffers;
+            unsigned bufferSize;
+            io_uring_buf_ring* bufRing = (io_uring_buf_ring*)MAP_FAILED;
+            size_t bufRingSize = 0;
+            std::vector<char> buffers;
+            uint16_t bufTail = 0;
+
+            std::mutex lock;                  ///< guards the submission queue, the buffer ring and watched
+            std::vector<watchEntry> watched;  ///< indexed by fd
+
+            static uint64_t encode(int fd, operation op, uint32_t generation){
+                return (uint64_t)(uint32_t)fd | ((uint64_t)op << 32) | ((uint64_t)(generation & 0xffffff) << 40);
+            }
+
+            /**
+             * Registers the ring of provided buffers multishot receives pick from.
+             * */
+            bool setupBuffers(){
+                bufRingSize = nBuffers * sizeof(io_uring_buf);
+                bufRing = (io_uring_buf_ring*)mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(bufRing == MAP_FAILED)
+                    return false;
+
+                io_uring_buf_reg reg;
+                std::memset(&reg, 0, sizeof(reg));
+                reg.ring_addr = (uint64_t)bufRing;
+                reg.ring_entries = nBuffers;
+                reg.bgid = bufferGroup;
+                if(syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+                    return false;
+
+                buffers.resize(nBuffers * bufferSize);
+                for(unsigned i = 0; i < nBuffers; i++)
+                    provide(i);
+
+                return true;
+            }
+
+            /**
+             * Hands buffer [bid] to the kernel so a receive can fill it; must be called with lock taken.
+             * */
+            void provide(int bid){
+                //bufs is not indexed directly: some headers declare it with a
+                //leading empty struct, which C++ gives a size and misaligns
+                io_uring_buf* buf = (io_uring_buf*)bufRing + (bufTail & (nBuffers - 1));
+                buf->addr = (uint64_t)&buffers[bid * bufferSize];
+                buf->len = bufferSize;
+                buf->bid = bid;
+                bufTail++;
+                __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+            }
+
+            void teardown(){
+                if(bufRing != MAP_FAILED)
+                    munmap(bufRing, bufRingSize);
+                if(sqes != MAP_FAILED)
+                    munmap(sqes, sqesSize);
+                if(ring != MAP_FAILED)
+                    munmap(ring, ringSize);
+                if(ringfd >= 0)
+                    close(ringfd);
+
+                bufRing = (io_uring_buf_ring*)MAP_FAILED;
+                sqes = (io_uring_sqe*)MAP_FAILED;
+                ring = (char*)MAP_FAILED;
+                ringfd = -1;
+            }
+
+            /**
+             * Takes a free submission entry; must be called with lock taken.
+             * */
+            io_uring_sqe* getSqe(){
+                //if the queue is full, let the kernel consume it first
+                if(localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+                    submit();
+
+                unsigned index = localTail & sqMask;
+                io_uring_sqe* sqe = &sqes[index];
+                std::memset(sqe, 0, sizeof(io_uring_sqe));
+                sqArray[index] = index;
+                localTail++;
+                unsubmitted++;
+                return sqe;
+            }
+
+            /**
+             * Arms a multishot receive on [fd]; must be called with lock taken.
+             * */
+            void armRecv(int fd){
+                io_uring_sqe* sqe = getSqe();
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = bufferGroup;
+                sqe->user_data = encode(fd, opRecv, watched[fd].generation);
+            }
+
+            /**
+             * Makes the queued entries visible to the kernel; must be called with lock taken.
+             *
+             * @returns amount of entries to be passed to io_uring_enter().
+             * */
+            unsigned publish(){
+                __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+                unsigned published = unsubmitted;
+                unsubmitted = 0;
+                return published;
+            }
+
+            /**
+             * Submits queued entries without waiting; must be called with lock taken.
+             * */
+            int submit(){
+                unsigned toSubmit = publish();
+                if(!toSubmit)
+                    return 0;
+                return syscall(__NR_io_uring_enter, ringfd, toSubmit, 0, 0, NULL, 0);
+            }
+
+            /**
+             * Turns completions into events.
+             * */
+            int reap(ioEvent* events, int max){
+                int count = 0;
+                unsigned head = *cqHead;
+                unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+                std::lock_guard<std::mutex> guard(lock);
+                while(head != tail && count < max){
+                    io_uring_cqe* cqe = &cqes[head & cqMask];
+                    head++;
+
+                    int fd = (uint32_t)cqe->user_data;
+                    operation op = (operation)((cqe->user_data >> 32) & 0xff);
+                    uint32_t generation = cqe->user_data >> 40;
+                    int bid = cqe->flags & IORING_CQE_F_BUFFER ? cqe->flags >> IORING_CQE_BUFFER_SHIFT : -1;
+
+                    bool stale = (size_t)fd >= watched.size() || !watched[fd].context
+                        || (watched[fd].generation & 0xffffff) != generation;
+                    if(op == opCancel || op == opWake || stale){
+                        if(bid >= 0)
+                            provide(bid);
+                        continue;
+                    }
+
+                    void* context = watched[fd].context;
+                    if(op == opPoll){
+                        events[count++] = ioEvent {ioEvent::writable, fd, context, NULL, 0, -1};
+                        continue;
+                    }
+
+                    if(cqe->res > 0){
+                        events[count++] = ioEvent {ioEvent::received, fd, context, &buffers[bid * bufferSize], cqe->res, bid};
+                        if(!(cqe->flags & IORING_CQE_F_MORE))
+                            armRecv(fd);
+                    }else if(cqe->res == -ENOBUFS){
+                        //every buffer is taken; they'll be back once the events are done
+                        armRecv(fd);
+                    }else if(cqe->res != -ECANCELED){
+                        events[count++] = ioEvent {ioEvent::closed, fd, context, NULL, 0, -1};
+                    }
+                }
+
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+                return count;
+            }
+    };
+}
+
+#endif
@@ -4,7 +4,11 @@
 #include <cstring>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
 
 /**
  * @file utils.hpp
@@ -17,25 +21,35 @@
  * @param socketPath where the socket is to be bound.
  * @param[out] sockaddr the resulting sockaddr.
  * 
- * @returns socket bound to [socketPath].
+ * @returns socket bound to [socketPath], -1 on error, with errno set.
  * */
 int createBoundSocket(std::string socketPath, sockaddr_un* sockaddr){
     socklen_t addrlen = sizeof(struct sockaddr_un);
+    if(socketPath.size() >= sizeof(sockaddr->sun_path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
     int sockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
     if(sockfd < 0)
-        throw "Error creating socket";
+        return -1;
     
     sockaddr->sun_family = AF_LOCAL;
     std::strcpy(sockaddr->sun_path, socketPath.c_str());
 
-    if(bind(sockfd, (struct sockaddr *) sockaddr, addrlen)){
-        if(errno == EADDRINUSE){
-            unlink(sockaddr->sun_path);
-            if(bind(sockfd, (struct sockaddr *) sockaddr, addrlen)){
-                throw errno;
-            }
-        }else throw errno;
-    };
+    //a socket left behind by a previous run is replaced
+    int rv = bind(sockfd, (struct sockaddr *) sockaddr, addrlen);
+    if(rv && errno == EADDRINUSE){
+        unlink(sockaddr->sun_path);
+        rv = bind(sockfd, (struct sockaddr *) sockaddr, addrlen);
+    }
+
+    if(rv){
+        int err = errno;
+        close(sockfd);
+        errno = err;
+        return -1;
+    }
 
     return sockfd;
 }
@@ -55,4 +69,124 @@ int acceptOne(int listeningSocket, sockaddr_un* sockaddr){
     return accept(listeningSocket, (struct sockaddr*)sockaddr, &addrlen);
 }
 
+/**
+ * Sets the options every TCP connection between nodes and master should have.
+ *
+ * Disables Nagle's algorithm, since frames are small and latency sensitive,
+ * and enables keepalive so that dead peers are eventually noticed.
+ *
+ * @param sockfd a connected TCP socket.
+ * */
+void configureTcp(int sockfd){
+    int enable = 1;
+    int idle = 30;     // seconds before the first keepalive probe
+    int interval = 10; // seconds between probes
+    int count = 3;     // probes before the connection is dropped
+
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+    setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(int));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(int));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(int));
+}
+
+/**
+ * Creates a TCP socket, binds it to [host]:[port] and sets it to listen.
+ *
+ * The socket is bound with SO_REUSEPORT, so several sockets can be bound
+ * to the same port and have the kernel distribute connections between them.
+ *
+ * @param host IPv4 address to bind to.
+ * @param port port to bind to; 0 for any free port.
+ * @param[out] sockaddr the resulting sockaddr, with the bound port.
+ *
+ * @returns listening socket bound to [host]:[port], -1 on error, with errno set.
+ * */
+int createTcpListener(std::string host, uint16_t port, sockaddr_in* sockaddr){
+    socklen_t addrlen = sizeof(struct sockaddr_in);
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(sockfd < 0)
+        return -1;
+
+    int enable = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int));
+
+    std::memset(sockaddr, 0, addrlen);
+    sockaddr->sin_family = AF_INET;
+    sockaddr->sin_port = htons(port);
+    if(inet_pton(AF_INET, host.c_str(), &sockaddr->sin_addr) != 1){
+        close(sockfd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(bind(sockfd, (struct sockaddr *) sockaddr, addrlen)){
+        int err = errno;
+        close(sockfd);
+        errno = err;
+        return -1;
+    }
+
+    getsockname(sockfd, (struct sockaddr *) sockaddr, &addrlen);
+    listen(sockfd, 128);
+    return sockfd;
+}
+
+/**
+ * Connects to [host]:[port] over TCP and returns the file descriptor.
+ *
+ * @param host IPv4 address to connect to.
+ * @param port port to connect to.
+ *
+ * @returns the connected socket, -1 on error.
+ * */
+int connectTcp(std::string host, uint16_t port){
+    sockaddr_in sockaddr;
+    std::memset(&sockaddr, 0, sizeof(sockaddr_in));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_port = htons(port);
+    if(inet_pton(AF_INET, host.c_str(), &sockaddr.sin_addr) != 1)
+        return -1;
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(sockfd < 0)
+        return -1;
+
+    if(connect(sockfd, (struct sockaddr *) &sockaddr, sizeof(sockaddr_in))){
+        close(sockfd);
+        return -1;
+    }
+
+    configureTcp(sockfd);
+    return sockfd;
+}
+
+/**
+ * Connects to the local socket at [socketPath] and returns the file descriptor.
+ *
+ * @param socketPath path of the listening socket.
+ *
+ * @returns the connected socket, -1 on error.
+ * */
+int connectLocal(std::string socketPath){
+    sockaddr_un sockaddr;
+    std::memset(&sockaddr, 0, sizeof(sockaddr_un));
+    if(socketPath.size() >= sizeof(sockaddr.sun_path))
+        return -1;
+    sockaddr.sun_family = AF_LOCAL;
+    std::strcpy(sockaddr.sun_path, socketPath.c_str());
+
+    int sockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    if(sockfd < 0)
+        return -1;
+
+    if(connect(sockfd, (struct sockaddr *) &sockaddr, sizeof(sockaddr_un))){
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
 #endif
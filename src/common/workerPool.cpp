@@ -0,0 +1,120 @@
+#ifndef LODEWPOOL_H
+#define LODEWPOOL_H
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace Lodestar{
+    /**
+     * A pool of persistent worker threads.
+     *
+     * Workers are spawned up front and park on a condition variable while
+     * there is nothing to run, so handing them a task costs a wake-up instead
+     * of the creation of a thread. If every worker is busy when a task is
+     * handed, a new worker is spawned and stays in the pool afterwards.
+     * */
+    class WorkerPool{
+        public:
+            /**
+             * @param nWorkers amount of workers to be spawned up front.
+             * */
+            WorkerPool(int nWorkers){
+                std::lock_guard<std::mutex> guard(lock);
+                for(int i = 0; i < nWorkers; i++)
+                    spawn();
+            }
+
+            WorkerPool(const WorkerPool& pool) = delete;
+
+            ~WorkerPool(){
+                lock.lock();
+                stopping = true;
+                lock.unlock();
+                wakeup.notify_all();
+
+                for(auto it = workers.begin(); it != workers.end(); it++)
+                    it->join();
+            }
+
+            /**
+             * Pool shared by everything that doesn't bring its own.
+             * */
+            static WorkerPool& shared(){
+                static WorkerPool pool(std::thread::hardware_concurrency());
+                return pool;
+            }
+
+            /**
+             * Hands a task to a parked worker.
+             *
+             * @param task the function to be run; the worker goes back to the pool once it returns.
+             * */
+            void run(std::function<void()> task){
+                std::unique_lock<std::mutex> guard(lock);
+                tasks.push_back(std::move(task));
+                if(idle < tasks.size())
+                    spawn();
+                guard.unlock();
+
+                wakeup.notify_one();
+            }
+
+            /**
+             * @returns amount of workers in the pool, busy or not.
+             * */
+            size_t size(){
+                std::lock_guard<std::mutex> guard(lock);
+                return workers.size();
+            }
+
+            /**
+             * @returns amount of workers parked waiting for a task.
+             * */
+            size_t parked(){
+                std::lock_guard<std::mutex> guard(lock);
+                return idle;
+            }
+
+        private:
+            std::mutex lock;
+            std::condition_variable wakeup;           ///< signals parked workers that there are tasks
+            std::deque<std::function<void()>> tasks;  ///< tasks not yet taken by a worker
+            std::vector<std::thread> workers;
+            size_t idle = 0;                          ///< amount of parked workers
+            bool stopping = false;
+
+            /**
+             * Starts a new worker; must be called with lock taken.
+             * */
+            void spawn(){
+                idle++;
+                workers.push_back(std::thread(&WorkerPool::work, this));
+            }
+
+            /**
+             * Loop of each worker; parks until there is a task, runs it, and parks again.
+             * */
+            void work(){
+                std::unique_lock<std::mutex> guard(lock);
+                while(true){
+                    wakeup.wait(guard, [this](){return stopping || !tasks.empty();});
+                    if(tasks.empty())
+                        return;
+
+                    std::function<void()> task = std::move(tasks.front());
+                    tasks.pop_front();
+                    idle--;
+
+                    guard.unlock();
+                    task();
+                    guard.lock();
+
+                    idle++;
+                }
+            }
+    };
+}
+#endif
@@ -0,0 +1,39 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "workerPool.cpp"
+#include "doctest.h"
+
+using namespace std::chrono_literals;
+
+TEST_CASE("WorkerPool - persistent workers"){
+    Lodestar::WorkerPool pool(2);
+    std::atomic<int> ran = 0;
+
+    std::this_thread::sleep_for(50ms);
+    REQUIRE(pool.size() == 2);
+    REQUIRE(pool.parked() == 2);
+
+    SUBCASE("tasks reuse parked workers"){
+        for(int i = 0; i < 10; i++){
+            pool.run([&ran](){ ran++; });
+            std::this_thread::sleep_for(5ms);
+        }
+
+        std::this_thread::sleep_for(50ms);
+        REQUIRE(ran == 10);
+        REQUIRE(pool.size() == 2);
+        REQUIRE(pool.parked() == 2);
+    }
+
+    SUBCASE("pool grows when every worker is busy"){
+        for(int i = 0; i < 3; i++)
+            pool.run([&ran](){ std::this_thread::sleep_for(100ms); ran++; });
+
+        REQUIRE(pool.size() == 3);
+
+        std::this_thread::sleep_for(300ms);
+        REQUIRE(ran == 3);
+        REQUIRE(pool.parked() == 3);
+    }
+}
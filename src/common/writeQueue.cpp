@@ -0,0 +1,171 @@
+#ifndef LODEWQUEUE_H
+#define LODEWQUEUE_H
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include "communication.cpp"
+
+namespace Lodestar{
+    enum queueStatus {flushed, pending, failed};
+
+    /**
+     * An outbound queue of serialized frames for a single connection.
+     *
+     * Frames are serialized when pushed and written with non-blocking sends
+     * when flushed, so that a peer which doesn't read its socket only ever
+     * grows its own queue instead of blocking the thread that writes to it.
+     * Every frame queued by the time of a flush goes out in a single gathered
+     * send (up to maxBatch frames), so frames pushed together cost one syscall.
+     * Frames are kept by reference, so a frame sent to many connections is
+     * serialized once and shared by their queues (see pushShared()), each
+     * keeping track of how much of it was sent on its own.
+     * Once the queued bytes would go over [highWaterMark], pushing fails so that
+     * the owner of the queue can apply back-pressure or drop the slow consumer.
+     * */
+    class writeQueue{
+        public:
+            size_t highWaterMark; ///< max amount of bytes that can be queued at once
+            static const int maxBatch = 64; ///< max amount of frames gathered into one send
+
+            /**
+             * @param mark the high-water mark of the queue, in bytes.
+             * */
+            writeQueue(size_t mark = 64 * 1024): highWaterMark(mark){}
+
+            writeQueue(const writeQueue& queue){
+                highWaterMark = queue.highWaterMark;
+                frames = queue.frames;
+                offset = queue.offset;
+                queued = queue.queued;
+            }
+
+            /**
+             * Serializes a message into a frame and appends it to the queue.
+             *
+             * @param msg the message to be queued; its data pointer must be set.
+             * @returns false if the frame would take the queue over the high-water mark,
+             * in which case it is not queued.
+             * */
+            bool push(message& msg){
+                char buffer[1024];
+                uint16_t size = msg.serializeMessage(&buffer[2]);
+                buffer[0] = size;
+                buffer[1] = size >> 8;
+
+                return pushShared(std::make_shared<const std::string>(buffer, size + 2));
+            }
+
+            /**
+             * Appends a frame serialized beforehand, without copying it.
+             *
+             * @param frame the frame, size header included; must not change once shared.
+             * @returns false if the frame would take the queue over the high-water mark,
+             * in which case it is not queued.
+             * */
+            bool pushShared(std::shared_ptr<const std::string> frame){
+                std::lock_guard<std::mutex> guard(lock);
+                if(queued + frame->size() > highWaterMark)
+                    return false;
+
+                queued += frame->size();
+                frames.push_back(std::move(frame));
+                return true;
+            }
+
+            /**
+             * Writes as much of the queue as the socket accepts without blocking.
+             *
+             * @param sockfd the socket the queue is to be written to.
+             * @returns flushed if the queue is now empty, pending if the socket
+             * is full, failed if the socket errored out.
+             * */
+            queueStatus flush(int sockfd){
+                std::lock_guard<std::mutex> guard(lock);
+                while(!frames.empty()){
+                    iovec iov[maxBatch];
+                    int n = 0;
+                    for(auto it = frames.begin(); it != frames.end() && n < maxBatch; it++, n++){
+                        size_t skipped = n == 0 ? offset : 0;
+                        iov[n].iov_base = (void*)((*it)->data() + skipped);
+                        iov[n].iov_len = (*it)->size() - skipped;
+                    }
+
+                    msghdr batch {};
+                    batch.msg_iov = iov;
+                    batch.msg_iovlen = n;
+                    int sent = sendmsg(sockfd, &batch, MSG_DONTWAIT | MSG_NOSIGNAL);
+                    if(sent == -1){
+                        if(errno == EINTR)
+                            continue;
+                        if(errno == EAGAIN || errno == EWOULDBLOCK)
+                            return queueStatus::pending;
+                        return queueStatus::failed;
+                    }
+
+                    size_t written = sent;
+                    queued -= written;
+                    while(written > 0){
+                        size_t left = frames.front()->size() - offset;
+                        if(written < left){
+                            offset += written;
+                            break;
+                        }
+                        written -= left;
+                        frames.pop_front();
+                        offset = 0;
+                    }
+                }
+                return queueStatus::flushed;
+            }
+
+            /**
+             * Appends already serialized bytes to the queue, regardless of the high-water mark.
+             *
+             * Meant to carry over what another queue had yet to send (see takeBytes()).
+             * */
+            void pushBytes(const std::string& bytes){
+                if(bytes.empty())
+                    return;
+
+                std::lock_guard<std::mutex> guard(lock);
+                frames.push_back(std::make_shared<const std::string>(bytes));
+                queued += bytes.size();
+            }
+
+            /**
+             * Empties the queue.
+             *
+             * @returns the bytes that were yet to be sent, in order.
+             * */
+            std::string takeBytes(){
+                std::lock_guard<std::mutex> guard(lock);
+                std::string bytes;
+                for(auto it = frames.begin(); it != frames.end(); it++)
+                    bytes.append(**it, it == frames.begin() ? offset : 0);
+
+                frames.clear();
+                offset = 0;
+                queued = 0;
+                return bytes;
+            }
+
+            /**
+             * @returns amount of bytes still queued.
+             * */
+            size_t size(){
+                std::lock_guard<std::mutex> guard(lock);
+                return queued;
+            }
+
+        private:
+            std::mutex lock;
+            std::deque<std::shared_ptr<const std::string>> frames; ///< serialized frames, oldest first
+            size_t offset = 0;              ///< bytes of the front frame already sent
+            size_t queued = 0;              ///< total amount of bytes not yet sent
+    };
+}
+#endif
@@ -0,0 +1,150 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include "writeQueue.cpp"
+#include "doctest.h"
+
+TEST_CASE("writeQueue - non-blocking outbound queue"){
+    int fds[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+    Lodestar::shutdown dummyStruct;
+    dummyStruct.code = 7;
+    Lodestar::message msg;
+    msg.data = &dummyStruct;
+
+    //each shutdown frame is 2 bytes of size, 1 of type and 1 of code
+    Lodestar::writeQueue queue(8);
+
+    SUBCASE("high-water mark"){
+        REQUIRE(queue.push(msg));
+        REQUIRE(queue.push(msg));
+        REQUIRE(!queue.push(msg));
+        REQUIRE(queue.size() == 8);
+    }
+
+    SUBCASE("flushing"){
+        queue.push(msg);
+        REQUIRE(queue.flush(fds[0]) == Lodestar::queueStatus::flushed);
+        REQUIRE(queue.size() == 0);
+
+        Lodestar::message received;
+        received.recvMessage(fds[1]);
+        received.deserializeMessage();
+        REQUIRE(static_cast<Lodestar::shutdown*>(received.data)->code == 7);
+    }
+
+    SUBCASE("full socket"){
+        //fill the socket without anyone reading it
+        Lodestar::writeQueue bigQueue(1 << 24);
+        while(bigQueue.flush(fds[0]) != Lodestar::queueStatus::pending)
+            bigQueue.push(msg);
+
+        REQUIRE(bigQueue.size() > 0);
+    }
+
+    SUBCASE("closed socket"){
+        queue.push(msg);
+        close(fds[1]);
+        REQUIRE(queue.flush(fds[0]) == Lodestar::queueStatus::failed);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("writeQueue - gathered sends"){
+    int fds[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+    //a small buffer makes the gathered send stop midway through frames
+    int bufferSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(int));
+
+    Lodestar::shutdown dummyStruct;
+    Lodestar::message msg;
+    msg.data = &dummyStruct;
+
+    const int nFrames = 3 * Lodestar::writeQueue::maxBatch;
+    Lodestar::writeQueue queue(1 << 20);
+    for(int i = 0; i < nFrames; i++){
+        dummyStruct.code = i;
+        REQUIRE(queue.push(msg));
+    }
+
+    int received = 0;
+    while(received < nFrames){
+        REQUIRE(queue.flush(fds[0]) != Lodestar::queueStatus::failed);
+
+        Lodestar::message frame;
+        frame.recvMessage(fds[1]);
+        frame.deserializeMessage();
+        REQUIRE(static_cast<Lodestar::shutdown*>(frame.data)->code == (uint8_t)received);
+        delete frame.data;
+        received++;
+    }
+
+    REQUIRE(queue.flush(fds[0]) == Lodestar::queueStatus::flushed);
+    REQUIRE(queue.size() == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("writeQueue - shared frames"){
+    int first[2], second[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, first) == 0);
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, second) == 0);
+
+    //a frame as big as they get, so a full socket takes only part of it
+    std::string body(1000, 'x');
+    body[0] = 1;
+    body[1] = 2;
+    auto frame = std::make_shared<const std::string>(body);
+
+    Lodestar::writeQueue firstQueue(1 << 20), secondQueue(1 << 20);
+    REQUIRE(firstQueue.pushShared(frame));
+    REQUIRE(secondQueue.pushShared(frame));
+    REQUIRE(frame.use_count() == 3);
+
+    //only one of the queues gets to send everything right away
+    int bufferSize = 4096;
+    setsockopt(second[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(int));
+    for(int i = 0; i < 64; i++)
+        REQUIRE(secondQueue.pushShared(frame));
+
+    REQUIRE(firstQueue.flush(first[0]) == Lodestar::queueStatus::flushed);
+    REQUIRE(secondQueue.flush(second[0]) == Lodestar::queueStatus::pending);
+
+    std::string received(body.size(), 0);
+    REQUIRE(recv(first[1], &received[0], received.size(), MSG_WAITALL) == body.size());
+    REQUIRE(received == body);
+
+    //the other one keeps its own place in the frames it shares
+    size_t total = 65 * body.size();
+    std::string drained;
+    char chunk[4096];
+    while(drained.size() < total){
+        REQUIRE(secondQueue.flush(second[0]) != Lodestar::queueStatus::failed);
+        int rv = recv(second[1], chunk, sizeof(chunk), MSG_DONTWAIT);
+        if(rv > 0)
+            drained.append(chunk, rv);
+    }
+    REQUIRE(secondQueue.size() == 0);
+    for(int i = 0; i < 65; i++)
+        REQUIRE(drained.compare(i * body.size(), body.size(), body) == 0);
+
+    //the frame is freed along with the last queue holding it
+    REQUIRE(frame.use_count() == 1);
+
+    SUBCASE("high-water mark"){
+        Lodestar::writeQueue small(body.size() + 1);
+        REQUIRE(small.pushShared(frame));
+        REQUIRE(!small.pushShared(frame));
+        REQUIRE(frame.use_count() == 2);
+    }
+
+    close(first[0]);
+    close(first[1]);
+    close(second[0]);
+    close(second[1]);
+}
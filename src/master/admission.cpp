@@ -0,0 +1,150 @@
+#ifndef LODEADMISSION_H
+#define LODEADMISSION_H
+#include <string>
+#include <list>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "../common/communication.cpp"
+#include "../common/tokenBucket.cpp"
+
+namespace Lodestar{
+    /**
+     * How much a Master lets each node and peer do before shedding it; 0 means no limit.
+     * */
+    struct admissionLimits {
+        double framesPerSecond = 0;       ///< frames each connection may send per second, on average.
+        double frameBurst = 0;            ///< frames each connection may send at once.
+        double connectionsPerSecond = 0;  ///< connections each peer may open per second, on average.
+        double connectionBurst = 0;       ///< connections each peer may open at once.
+        int maxPending = 0;               ///< sockets that may be waiting to be authenticated at once.
+    };
+
+    /**
+     * The limits of a Master and the connection buckets of its peers.
+     *
+     * A peer is whoever opens connections: an IP address over TCP, a user id
+     * over a local socket. At most maxPeers buckets are kept; past that the
+     * bucket of the peer seen least recently makes room for the new one, so
+     * memory stays bounded however many peers connect, and admitting a peer
+     * never costs more than a lookup.
+     * */
+    class admissionControl{
+        public:
+            static constexpr size_t maxPeers = 4096; ///< peers tracked at most; the least recently seen is dropped past it
+
+            void setLimits(const admissionLimits& newLimits){
+                std::lock_guard<std::mutex> guard(lock);
+                current = newLimits;
+                peers.clear();
+                byAge.clear();
+            }
+
+            admissionLimits limits(){
+                std::lock_guard<std::mutex> guard(lock);
+                return current;
+            }
+
+            /**
+             * Takes a connection from the bucket of the peer that opened [sockfd].
+             *
+             * @param sockfd the accepted socket.
+             * @param address the address accept() gave for it.
+             * @returns false if the peer is opening connections faster than allowed.
+             * */
+            bool admitPeer(int sockfd, const sockaddr_storage& address){
+                std::lock_guard<std::mutex> guard(lock);
+                if(current.connectionsPerSecond <= 0)
+                    return true;
+
+                std::string peer = peerIdentity(sockfd, address);
+                auto found = peers.find(peer);
+                if(found != peers.end()){
+                    byAge.splice(byAge.end(), byAge, found->second.age);
+                    return found->second.bucket.take();
+                }
+
+                if(peers.size() >= maxPeers){
+                    peers.erase(byAge.front());
+                    byAge.pop_front();
+                }
+                byAge.push_back(peer);
+                found = peers.emplace(peer, peerBucket {tokenBucket(current.connectionsPerSecond, current.connectionBurst), std::prev(byAge.end())}).first;
+                return found->second.bucket.take();
+            }
+
+            /**
+             * @returns a bucket for the frames of a new connection.
+             * */
+            tokenBucket frameBucket(){
+                std::lock_guard<std::mutex> guard(lock);
+                return tokenBucket(current.framesPerSecond, current.frameBurst);
+            }
+
+            /**
+             * @returns amount of peers whose buckets are kept.
+             * */
+            size_t trackedPeers(){
+                std::lock_guard<std::mutex> guard(lock);
+                return peers.size();
+            }
+
+        private:
+            struct peerBucket {
+                tokenBucket bucket;                   ///< connections the peer may still open.
+                std::list<std::string>::iterator age; ///< the peer's place in byAge.
+            };
+
+            std::mutex lock;
+            admissionLimits current;
+            std::unordered_map<std::string, peerBucket> peers; ///< connection buckets, by peer
+            std::list<std::string> byAge;                      ///< peers, least recently seen first
+
+            /**
+             * @returns the IP address of the peer of [sockfd] over TCP, its user id over a local socket.
+             * */
+            static std::string peerIdentity(int sockfd, const sockaddr_storage& address){
+                char buffer[INET6_ADDRSTRLEN] = {0};
+                if(address.ss_family == AF_INET){
+                    inet_ntop(AF_INET, &((const sockaddr_in*)&address)->sin_addr, buffer, sizeof(buffer));
+                    return buffer;
+                }
+                if(address.ss_family == AF_INET6){
+                    inet_ntop(AF_INET6, &((const sockaddr_in6*)&address)->sin6_addr, buffer, sizeof(buffer));
+                    return buffer;
+                }
+
+                ucred credentials;
+                socklen_t len = sizeof(credentials);
+                if(getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &credentials, &len))
+                    return "local";
+                return "uid:" + std::to_string(credentials.uid);
+            }
+    };
+
+    /**
+     * Tells the peer of a socket why it's being closed, if it can be told without blocking, and closes it.
+     *
+     * @param sockfd the socket to be closed.
+     * @param code the reason; see shutdownCode.
+     * */
+    void shedSocket(int sockfd, uint8_t code){
+        shutdown reason;
+        reason.code = code;
+        message msg;
+        msg.data = &reason;
+
+        char frame[8];
+        uint16_t size = msg.serializeMessage(&frame[2]);
+        frame[0] = size;
+        frame[1] = size >> 8;
+        send(sockfd, frame, size + 2, MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(sockfd);
+    }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include <string>
+#include <cstring>
+#include <arpa/inet.h>
+#include "admission.cpp"
+#include "../common/doctest.h"
+
+TEST_CASE("admissionControl - connection buckets of peers"){
+    Lodestar::admissionControl admission;
+    Lodestar::admissionLimits limits;
+    limits.connectionsPerSecond = 0.001;
+    limits.connectionBurst = 2;
+    admission.setLimits(limits);
+
+    auto peer = [](uint32_t n){
+        sockaddr_storage address;
+        std::memset(&address, 0, sizeof(address));
+        sockaddr_in* in = (sockaddr_in*)&address;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(0x0a000000 + n);
+        return address;
+    };
+
+    SUBCASE("a peer past its burst is refused"){
+        REQUIRE(admission.admitPeer(-1, peer(1)));
+        REQUIRE(admission.admitPeer(-1, peer(1)));
+        CHECK(!admission.admitPeer(-1, peer(1)));
+        CHECK(admission.admitPeer(-1, peer(2)));
+    }
+
+    SUBCASE("peers are capped, dropping the one seen least recently"){
+        REQUIRE(admission.admitPeer(-1, peer(0)));
+        REQUIRE(admission.admitPeer(-1, peer(1)));
+        for(uint32_t i = 2; i < Lodestar::admissionControl::maxPeers; i++)
+            admission.admitPeer(-1, peer(i));
+        //seen again, so it's no longer the oldest
+        REQUIRE(admission.admitPeer(-1, peer(0)));
+        REQUIRE(admission.trackedPeers() == Lodestar::admissionControl::maxPeers);
+
+        admission.admitPeer(-1, peer(Lodestar::admissionControl::maxPeers));
+        CHECK(admission.trackedPeers() == Lodestar::admissionControl::maxPeers);
+        //peer 0 kept its empty bucket, while peer 1 was dropped and starts over
+        CHECK(!admission.admitPeer(-1, peer(0)));
+        CHECK(admission.admitPeer(-1, peer(1)));
+    }
+}
@@ -1,31 +1,38 @@
 #ifndef LODEAQUEUE_H
 #define LODEAQUEUE_H
 #include <list>
+#include <vector>
 #include <chrono>
 #include <string>
 #include <thread>
 #include <future>
 #include <atomic>
-#include <cmath>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include "../common/managedList.cpp"
+#include "../common/messagePool.cpp"
+#include "../common/ioBackend.cpp"
 #include "../common/utils.hpp"
 #include "../common/doctest.h"
 #include "types.hpp"
+#include "connectionTable.cpp"
 
 namespace Lodestar{
     class AuthQueue: ManagedList<autheableNode>{
         public:
+            ///< features of the protocol the master supports, agreed on with nodes that offer them
+            static constexpr uint32_t supportedFeatures = feature::batchedRegistration | feature::pipelining | feature::pushedUpdates;
+
             /**
              * Constructs an AuthQueue to be used synchronously.
              *
-             * @param connList the list connected nodes go to.
+             * @param connList the table connected nodes go to.
              * @param pass the password to be authenticated against.
              * @param _cutoff
              * */
-            AuthQueue(std::list<connectedNode>& connList, std::string pass, int _cutoff):
+            AuthQueue(connectionTable& connList, std::string pass, int _cutoff):
                 authenticatedList(&connList),
                 cutoff(_cutoff),
                 password(pass){}
@@ -33,14 +40,14 @@ namespace Lodestar{
             /**
              * Constructs an AuthQueue and starts overseer thread.
              *
-             * @param connList the list connected nodes go to.
+             * @param connList the table connected nodes go to.
              * @param pass the password to be authenticated against.
              * @param _cutoff
              * @param nMaxThreads the max number of threads the AuthQueue can have.
              * @param sleepTime how much should the overseer thread sleep after each loop.
              * */
             AuthQueue(
-                std::list<connectedNode>& connList,
+                connectionTable& connList,
                 std::string pass,
                 int _cutoff,
                 long nMaxThreads,
@@ -54,20 +61,39 @@ namespace Lodestar{
                 init(sleepTime);
             }
 
+            /**
+             * Move constructor.
+             *
+             * Threads can't be moved along with the queue, so if [moved] is asynchronous
+             * its threads are stopped and new ones are started for this object.
+             * */
             AuthQueue(AuthQueue&& moved){
-                authenticatedList = moved.authenticatedList;
-                password = std::move(moved.password);
-                cutoff = moved.cutoff;
+                *this = std::move(moved);
             }
 
             AuthQueue& operator=(AuthQueue&& moved){
+                stop();
+                moved.stop();
+
                 authenticatedList = moved.authenticatedList;
                 password = std::move(moved.password);
                 cutoff = moved.cutoff;
+                backends = moved.backends;
+                leaseTime = moved.leaseTime.load();
+                maxPending = moved.maxPending.load();
+                maxThreads = moved.maxThreads;
+                isAsync = moved.isAsync;
+
+                if(isAsync)
+                    init(moved.overseerSleep);
 
                 return *this;
             }
 
+            ~AuthQueue(){
+                stop();
+            }
+
             using ManagedList::spin;
 
             void setPass(std::string pass){
@@ -76,19 +102,65 @@ namespace Lodestar{
                 passLock.unlock();
             }
 
+            /**
+             * Sets the backends authenticated nodes are watched by.
+             *
+             * Each node goes to the backend at [its fd % amount of backends].
+             *
+             * @param shardBackends the backends, one per shard; empty to not watch nodes.
+             * */
+            void setBackends(std::vector<ioBackend*> shardBackends){
+                backends = shardBackends;
+            }
+
+            /**
+             * Sets how long leases last; leases are only agreed on once this is set.
+             * */
+            void setLeaseTime(std::chrono::milliseconds time){
+                leaseTime = time;
+            }
+
             int threadHeuristic(){
-                return ceil(list.size() / 20);
+                return adaptiveThreads();
             }
 
             /**
-             * Simply inserts an authenticable node into the base class' list.
+             * Sets how many sockets may be waiting to be authenticated at once.
+             *
+             * @param max the cap; 0 for none.
+             * */
+            void setMaxPending(int max){
+                maxPending = max;
+            }
+
+            /**
+             * @returns amount of sockets waiting to be authenticated.
+             * */
+            int pendingNodes(){
+                return pending;
+            }
+
+            /**
+             * Inserts an authenticable node into the base class' list, unless the list is full.
              *
              * @param newNode the node to be inserted.
+             * @returns false if as many sockets as allowed are already waiting, in which
+             * case the node isn't inserted and its socket is left to the caller.
              * */
-            void insertNode(autheableNode newNode){
+            bool insertNode(const autheableNode& newNode){
+                int max = maxPending;
+                //listeners of every shard insert at once, so the check and the count go together
+                int current = pending.load();
+                do{
+                    if(max > 0 && current >= max)
+                        return false;
+                }while(!pending.compare_exchange_weak(current, current + 1));
+
                 listLock.lock();
                 list.push_back(newNode);
+                list.back().lastServiced = std::chrono::steady_clock::now();
                 listLock.unlock();
+                return true;
             }
 
             /**
@@ -109,6 +181,28 @@ namespace Lodestar{
                 return returnVal;
             }
             
+            /**
+             * Tells a node which features were agreed on.
+             *
+             * The answer is written to a socket nothing was sent on yet, so it
+             * goes out at once; if it somehow doesn't, the rest goes out with
+             * the node's next flush.
+             *
+             * @param node the node, as added to the table but not yet watched.
+             * */
+            void answerNegotiation(connectedNode& node){
+                authAnswer answer;
+                answer.version = protocolVersion;
+                answer.features = node.features;
+                if(node.features & feature::leases)
+                    answer.leaseTime = leaseTime.load().count();
+
+                message msg;
+                msg.data = &answer;
+                node.outQueue.push(msg);
+                node.outQueue.flush(node.socketFd);
+            }
+
             /**
              * Heuristic based on the amount of inactive entries of list.
              *
@@ -116,7 +210,7 @@ namespace Lodestar{
              * */
             bool deletionHeuristic(){
                 int count = 0;
-                std::list<autheableNode>::iterator it;
+                EpochList<autheableNode>::iterator it;
                 for(it = list.begin(); count < cutoff && it != list.end(); it++){
                     if(!it->active)
                         count++;
@@ -125,6 +219,42 @@ namespace Lodestar{
                 return count >= cutoff;
             }
 
+            /**
+             * Marks an entry as inactive and gives its message back to the pool.
+             *
+             * @param node the entry to be retired; must be locked by the caller.
+             * */
+            void retire(autheableNode& node){
+                node.active = false;
+                pending--;
+                if(node.authmsg){
+                    pool.release(node.authmsg);
+                    node.authmsg = NULL;
+                }
+            }
+
+            /**
+             * Takes a message from the pool for an entry once its socket has bytes to receive.
+             *
+             * @param node the entry whose socket is to be checked.
+             * @returns 1 if the entry has a message to receive into, 0 if no bytes arrived yet,
+             * -1 if the socket was closed or errored out.
+             * */
+            int attachMessage(autheableNode& node){
+                if(node.authmsg)
+                    return 1;
+
+                char peeked;
+                int rv = recv(node.sockfd, &peeked, 1, MSG_PEEK | MSG_DONTWAIT);
+                if(rv == 0)
+                    return -1;
+                if(rv == -1)
+                    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+                node.authmsg = pool.acquire();
+                return 1;
+            }
+
             /**
              * Manage function that authenticates nodes.
              *
@@ -132,14 +262,14 @@ namespace Lodestar{
              * item's message object with a timeout of [iteratorTimeout] milliseconds
              * and mark the entries that exceed their object's respective timeout
              * as inactive so that they can be cleaned up later.
+             * Entries only get a message from the pool once their socket has bytes
+             * to be received, and give it back as soon as they become inactive.
              *
-             * Every start of the main loop, it checks if the queue deletion thread has
-             * sent a signal through authAwaitSignal; if so, notifies the deletion thread
-             * that it is currently waiting for the deletion to be complete and then waits
-             * for the signal that it is complete.
+             * Inactive entries may be removed from the queue while this runs; they are
+             * skipped, and only freed once this pass is over.
              * */
             void manage(){
-                std::list<autheableNode>::iterator it;
+                EpochList<autheableNode>::iterator it;
                 
                 //loop auth queue and try to authenticate each one respecting timeout
                 for(it = list.begin(); it != list.end(); ++it){
@@ -147,37 +277,64 @@ namespace Lodestar{
                         continue;
                     auto timeout = std::chrono::milliseconds(iteratorTimeout);
 
-                    msgStatus status;
-                    try{
-                        status = it->authmsg.recvMessage_for(it->sockfd, timeout);
-                    }catch(int err){
-                        //mark inactive it socket errors out
-                        it->active = false;
-                        it->lock.unlock();
-                        continue;
-                    }
+                    auto now = std::chrono::steady_clock::now();
+                    sampleWait(now - it->lastServiced);
+                    it->lastServiced = now;
+
+                    msgStatus status = msgStatus::nomsg;
+                    int attached = attachMessage(*it);
+                    if(attached == -1)
+                        status = msgStatus::broken;
+                    else if(attached == 1)
+                        status = it->authmsg->recvMessage_for(it->sockfd, timeout);
                     
                     switch(status){
+                        //mark inactive if socket errors out
+                        case msgStatus::broken:
+                            close(it->sockfd);
+                            retire(*it);
+                            break;
                         //if still receiving or not receiving at all
                         case msgStatus::receiving:
                         case msgStatus::nomsg:{
                             if(it->timeout > std::chrono::steady_clock::now())
                                 break;
                             else{
-                                it->active = false; //mark for deletion if timeout has passed
+                                close(it->sockfd);
+                                retire(*it); //mark for deletion if timeout has passed
                                 break;
                             }
                         }
                             //if just received
                         case msgStatus::ok:{
-                            it->authmsg.deserializeMessage();
-                            bool granted = authenticate(static_cast<auth*>(it->authmsg.data));
+                            //anything but an auth frame is refused like a wrong password
+                            bool granted = it->authmsg->deserializeMessage() && it->authmsg->data->dataType == msgtype::authNode
+                                && authenticate(static_cast<auth*>(it->authmsg->data));
                             if(granted){
+                                auth* authData = static_cast<auth*>(it->authmsg->data);
                                 connectedNode newNode;
                                 newNode.socketFd = it->sockfd;
-                                authenticatedList->push_back(newNode);
+                                uint32_t supported = supportedFeatures | (leaseTime.load().count() ? (uint32_t)feature::leases : 0u);
+                                newNode.features = authData->version ? authData->features & supported : 0;
+                                if(!backends.empty())
+                                    newNode.shard = it->sockfd % backends.size();
+                                connectedNode* added = authenticatedList->insert(newNode);
+
+                                if(!added)
+                                    close(it->sockfd);
+                                else{
+                                    if(!backends.empty())
+                                        fcntl(it->sockfd, F_SETFL, fcntl(it->sockfd, F_GETFL) | O_NONBLOCK);
+                                    //answered before the node is watched, so the answer goes ahead of any other
+                                    if(authData->version)
+                                        answerNegotiation(*added);
+                                    if(!backends.empty())
+                                        backends[newNode.shard]->watch(it->sockfd, added);
+                                }
+                            }else{
+                                close(it->sockfd);
                             }
-                            it->active = false;
+                            retire(*it);
                             break;
                         }
                     }
@@ -188,13 +345,18 @@ namespace Lodestar{
 
         private:
             int cutoff = 2;
+            std::vector<ioBackend*> backends; ///< backends authenticated nodes are watched by.
+            std::atomic<std::chrono::milliseconds> leaseTime = std::chrono::milliseconds(0); ///< how long leases last; 0 if they're not agreed on.
             std::atomic<int> iteratorTimeout = 100;
+            std::atomic<int> pending = 0;     ///< entries inserted and not yet retired.
+            std::atomic<int> maxPending = 0;  ///< cap on pending; 0 for none.
             std::string password; ///< the password this object authenticates each node against.
             std::mutex passLock;
-            std::list<connectedNode>* authenticatedList = NULL; ///< a pointer to the authenticated node list.
+            connectionTable* authenticatedList = NULL; ///< a pointer to the authenticated node table.
+            messagePool pool;     ///< messages lent to entries which are receiving.
 
             TEST_CASE_CLASS("AuthQueue - internal business logic"){
-                std::list<connectedNode> connList;
+                connectionTable connList;
                 AuthQueue authQueue = AuthQueue(connList, " ", 5);
                 
                 Lodestar::autheableNode dummyEntry;
@@ -211,6 +373,26 @@ namespace Lodestar{
                     REQUIRE(!authQueue.list.front().active);
                 }
                 
+                SUBCASE("concurrent inserts stop at the cap"){
+                    authQueue.setMaxPending(20);
+                    std::atomic<int> inserted = 0;
+                    std::vector<std::thread> listeners;
+                    for(int i = 0; i < 4; i++){
+                        listeners.push_back(std::thread([&](){
+                            for(int j = 0; j < 50; j++){
+                                if(authQueue.insertNode(dummyEntry))
+                                    inserted++;
+                            }
+                        }));
+                    }
+                    for(auto it = listeners.begin(); it != listeners.end(); it++)
+                        it->join();
+
+                    REQUIRE(inserted == 20);
+                    REQUIRE(authQueue.pending == 20);
+                    close(dummyEntry.sockfd);
+                }
+
                 SUBCASE("default operation - entry treatment"){
                     sockaddr_un sockaddr;
                     int listeningSocket = createBoundSocket("/tmp/authTest.soc", &sockaddr);
@@ -250,6 +432,7 @@ namespace Lodestar{
                         
                         authQueue.manage();
                         REQUIRE(authQueue.list.front().active);
+                        REQUIRE(authQueue.list.front().authmsg == NULL);
                     }
                     
                     SUBCASE("unfinished message"){
@@ -282,6 +465,8 @@ namespace Lodestar{
                         authQueue.manage();
                         REQUIRE(!authQueue.list.front().active);
                         REQUIRE(connList.size() == 1);
+                        REQUIRE(authQueue.list.front().authmsg == NULL);
+                        REQUIRE(authQueue.pool.available() == 1);
                     }
                 }
             };
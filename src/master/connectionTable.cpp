@@ -0,0 +1,159 @@
+#ifndef LODECTABLE_H
+#define LODECTABLE_H
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include "types.hpp"
+
+namespace Lodestar{
+    /**
+     * The connected nodes of a Master, indexed by socket descriptor.
+     *
+     * Slots are allocated in chunks which are never freed or moved, so find()
+     * takes no lock and a node's address stays valid until it's removed; only
+     * insert(), remove() and forEach() take the table's lock.
+     *
+     * A slot is only free for a new node once the previous one is removed, so
+     * a node's socket must be closed after it's removed from the table, never
+     * before, or the descriptor could be reused while its slot is still taken.
+     * */
+    class connectionTable{
+        public:
+            static const int chunkSize = 1024;
+            static const int maxChunks = 1024;   ///< descriptors past chunkSize * maxChunks are refused
+
+            connectionTable(){
+                for(int i = 0; i < maxChunks; i++)
+                    chunks[i].store(NULL, std::memory_order_relaxed);
+            }
+
+            connectionTable(const connectionTable& table) = delete;
+
+            ~connectionTable(){
+                clear();
+                for(int i = 0; i < maxChunks; i++)
+                    delete[] chunks[i].load(std::memory_order_relaxed);
+            }
+
+            /**
+             * Adds a node at the slot of its socket.
+             *
+             * The copy stored is given the next generation, so it can be told
+             * apart from the nodes that held its socket before.
+             *
+             * @param node the node to be added; it is copied into the table.
+             * @returns the node as stored in the table, NULL if its slot is taken or out of range.
+             * */
+            connectedNode* insert(const connectedNode& node){
+                if(node.socketFd < 0 || node.socketFd >= chunkSize * maxChunks)
+                    return NULL;
+
+                std::lock_guard<std::mutex> guard(lock);
+                std::atomic<connectedNode*>& slot = slotOf(node.socketFd, true);
+                if(slot.load(std::memory_order_relaxed))
+                    return NULL;
+
+                connectedNode* stored = new connectedNode(node);
+                stored->generation = ++generations;
+                slot.store(stored, std::memory_order_release);
+                count++;
+                if(node.socketFd >= highest)
+                    highest = node.socketFd + 1;
+                return stored;
+            }
+
+            /**
+             * @returns the node whose socket is [fd], NULL if there's none.
+             * */
+            connectedNode* find(int fd){
+                if(fd < 0 || fd >= chunkSize * maxChunks)
+                    return NULL;
+
+                std::atomic<connectedNode*>* chunk = chunks[fd / chunkSize].load(std::memory_order_acquire);
+                if(!chunk)
+                    return NULL;
+                return chunk[fd % chunkSize].load(std::memory_order_acquire);
+            }
+
+            /**
+             * Removes and frees [node], if it still is the one at its slot.
+             *
+             * Nodes must be removed by the thread that services them, since
+             * whoever else found them can't tell once they're freed.
+             *
+             * @returns false if [node] isn't in the table.
+             * */
+            bool remove(connectedNode* node){
+                std::lock_guard<std::mutex> guard(lock);
+                if(find(node->socketFd) != node)
+                    return false;
+
+                slotOf(node->socketFd, false).store(NULL, std::memory_order_release);
+                count--;
+                delete node;
+                return true;
+            }
+
+            /**
+             * Calls [visit] on every node, in order of their sockets, with the table locked.
+             *
+             * [visit] must not insert into or remove from the table.
+             * */
+            template <class Visitor>
+            void forEach(Visitor visit){
+                std::lock_guard<std::mutex> guard(lock);
+                for(int fd = 0; fd < highest; fd++){
+                    connectedNode* node = find(fd);
+                    if(node)
+                        visit(*node);
+                }
+            }
+
+            /**
+             * Removes and frees every node.
+             * */
+            void clear(){
+                std::lock_guard<std::mutex> guard(lock);
+                for(int fd = 0; fd < highest; fd++){
+                    connectedNode* node = find(fd);
+                    if(node){
+                        slotOf(fd, false).store(NULL, std::memory_order_release);
+                        delete node;
+                    }
+                }
+                count = 0;
+                highest = 0;
+            }
+
+            /**
+             * @returns amount of nodes in the table.
+             * */
+            size_t size(){
+                std::lock_guard<std::mutex> guard(lock);
+                return count;
+            }
+
+        private:
+            std::mutex lock;
+            std::atomic<std::atomic<connectedNode*>*> chunks[maxChunks]; ///< allocated on the first insert into them
+            size_t count = 0;
+            int highest = 0;      ///< one past the highest descriptor ever inserted since the last clear()
+            uint64_t generations = 0; ///< generation of the last node inserted; never reset, so generations are never reused
+
+            /**
+             * @returns the slot of [fd]; must be called with the lock taken.
+             * */
+            std::atomic<connectedNode*>& slotOf(int fd, bool allocate){
+                std::atomic<connectedNode*>* chunk = chunks[fd / chunkSize].load(std::memory_order_relaxed);
+                if(!chunk && allocate){
+                    chunk = new std::atomic<connectedNode*>[chunkSize];
+                    for(int i = 0; i < chunkSize; i++)
+                        chunk[i].store(NULL, std::memory_order_relaxed);
+                    chunks[fd / chunkSize].store(chunk, std::memory_order_release);
+                }
+                return chunk[fd % chunkSize];
+            }
+    };
+}
+
+#endif
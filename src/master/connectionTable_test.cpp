@@ -0,0 +1,70 @@
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "connectionTable.cpp"
+#include "../common/doctest.h"
+
+TEST_CASE("connectionTable - lookup by descriptor"){
+    Lodestar::connectionTable table;
+
+    Lodestar::connectedNode node;
+    node.socketFd = 5;
+    node.shard = 1;
+    Lodestar::connectedNode* stored = table.insert(node);
+    REQUIRE(stored != NULL);
+    CHECK(table.find(5) == stored);
+    CHECK(table.find(5)->shard == 1);
+    CHECK(table.find(4) == NULL);
+    CHECK(table.find(-1) == NULL);
+    CHECK(table.find(Lodestar::connectionTable::chunkSize * 3) == NULL);
+
+    SUBCASE("a taken slot is refused"){
+        CHECK(table.insert(node) == NULL);
+        CHECK(table.size() == 1);
+    }
+
+    SUBCASE("removal"){
+        Lodestar::connectedNode far;
+        far.socketFd = Lodestar::connectionTable::chunkSize + 7;
+        REQUIRE(table.insert(far) != NULL);
+
+        std::vector<int> visited;
+        table.forEach([&visited](Lodestar::connectedNode& visitedNode){ visited.push_back(visitedNode.socketFd); });
+        CHECK(visited == std::vector<int>{5, Lodestar::connectionTable::chunkSize + 7});
+
+        uint64_t generation = stored->generation;
+        REQUIRE(table.remove(stored));
+        CHECK(table.find(5) == NULL);
+        CHECK(table.size() == 1);
+
+        //the slot is free for the descriptor's next connection, which is told apart from the last
+        Lodestar::connectedNode* next = table.insert(node);
+        REQUIRE(next != NULL);
+        CHECK(next->generation != generation);
+    }
+}
+
+TEST_CASE("connectionTable - concurrent inserts and removals"){
+    Lodestar::connectionTable table;
+    const int nThreads = 4;
+    const int perThread = 2000;
+
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < nThreads; i++){
+        threads.push_back(std::thread([&table, &failures, i](){
+            for(int j = 0; j < perThread; j++){
+                Lodestar::connectedNode node;
+                node.socketFd = i * perThread + j;
+                Lodestar::connectedNode* stored = table.insert(node);
+                if(!stored || table.find(node.socketFd) != stored || (j % 2 && !table.remove(stored)))
+                    failures++;
+            }
+        }));
+    }
+    for(auto it = threads.begin(); it != threads.end(); it++)
+        it->join();
+
+    CHECK(failures == 0);
+    CHECK(table.size() == nThreads * perThread / 2);
+}
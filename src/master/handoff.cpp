@@ -0,0 +1,235 @@
+#ifndef LODEHANDOFF_H
+#define LODEHANDOFF_H
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include "types.hpp"
+
+/**
+ * @file handoff.cpp
+ * What a Master hands over to its successor on a restart.
+ *
+ * The state goes over a local socket as a single payload: a header, the
+ * packed topic tree, the socket each registrar registered from and, for
+ * every connected node, whatever it had half received and not yet sent.
+ * The listening sockets and the sockets of the nodes follow as SCM_RIGHTS
+ * messages, in the order the header and node records describe them.
+ * */
+
+namespace Lodestar{
+    struct handoffHeader {
+        char magic[4];             ///< "LDHO"
+        uint32_t version;
+        uint32_t hasLocalListener; ///< if the first socket sent is the local listener
+        uint32_t nTcpListeners;
+        uint32_t nNodes;
+        uint32_t snapshotBytes;
+        uint32_t nRegistrarSockets;
+        uint16_t tcpPort;
+        char socketPath[sizeof(sockaddr_un::sun_path)];
+    };
+
+    struct handoffNode {
+        int32_t socketFd;          ///< descriptor of the node in the previous process
+        uint32_t inboxBytes;       ///< bytes of a frame being received
+        uint32_t outboxBytes;      ///< bytes queued but not yet sent
+        uint32_t features;         ///< features agreed on with the node
+    };
+
+    static const uint32_t handoffFormat = 2;   ///< version of the handoff payload
+    static const int maxFdsPerMessage = 250;   ///< kept under the kernel's SCM_MAX_FD
+
+    /**
+     * Lists the socket of every registrar, in the order packSnapshot() lists registrars.
+     * */
+    std::vector<int32_t> packRegistrarSockets(topicTreeNode& root){
+        std::vector<int32_t> sockets;
+        std::vector<topicTreeNode*> stack;
+        stack.push_back(&root);
+        while(!stack.empty()){
+            topicTreeNode* node = stack.back();
+            stack.pop_back();
+
+            for(auto it = node->publishers.begin(); it != node->publishers.end(); it++)
+                sockets.push_back(it->nodeSocketFd);
+            for(auto it = node->subscribers.begin(); it != node->subscribers.end(); it++)
+                sockets.push_back(it->nodeSocketFd);
+
+            for(auto it = node->subNodes.rbegin(); it != node->subNodes.rend(); it++)
+                stack.push_back(&(*it));
+        }
+        return sockets;
+    }
+
+    /**
+     * Gives registrars back their sockets, as renumbered by the process that received them.
+     *
+     * @param root tree unpacked from the snapshot the sockets were listed along with.
+     * @param sockets as listed by packRegistrarSockets().
+     * @param renumbered descriptor in this process of each descriptor in the previous one;
+     * registrars whose socket isn't in it get -1.
+     * */
+    void restoreRegistrarSockets(topicTreeNode& root, const std::vector<int32_t>& sockets, const std::map<int, int>& renumbered){
+        size_t next = 0;
+        auto restore = [&](registrar& reg){
+            if(next >= sockets.size())
+                return;
+            auto found = renumbered.find(sockets[next++]);
+            reg.nodeSocketFd = found == renumbered.end() ? -1 : found->second;
+        };
+
+        std::vector<topicTreeNode*> stack;
+        stack.push_back(&root);
+        while(!stack.empty()){
+            topicTreeNode* node = stack.back();
+            stack.pop_back();
+
+            for(auto it = node->publishers.begin(); it != node->publishers.end(); it++)
+                restore(*it);
+            for(auto it = node->subscribers.begin(); it != node->subscribers.end(); it++)
+                restore(*it);
+
+            for(auto it = node->subNodes.rbegin(); it != node->subNodes.rend(); it++)
+                stack.push_back(&(*it));
+        }
+    }
+
+    /**
+     * Sends [payload] preceded by its size.
+     * */
+    bool sendPayload(int sockfd, const std::string& payload){
+        std::string framed;
+        uint32_t size = payload.size();
+        framed.append((char*)&size, sizeof(uint32_t));
+        framed.append(payload);
+
+        size_t sent = 0;
+        while(sent < framed.size()){
+            int rv = send(sockfd, &framed[sent], framed.size() - sent, MSG_NOSIGNAL);
+            if(rv < 0){
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            sent += rv;
+        }
+        return true;
+    }
+
+    /**
+     * Receives a payload sent by sendPayload().
+     *
+     * Reads exactly the payload, so descriptors sent after it are left to recvFds().
+     * */
+    bool recvPayload(int sockfd, std::string& payload){
+        uint32_t size;
+        char* target = (char*)&size;
+        size_t wanted = sizeof(uint32_t);
+
+        for(int part = 0; part < 2; part++){
+            size_t received = 0;
+            while(received < wanted){
+                int rv = recv(sockfd, &target[received], wanted - received, 0);
+                if(rv < 0 && errno == EINTR)
+                    continue;
+                if(rv <= 0)
+                    return false;
+                received += rv;
+            }
+
+            if(part == 0){
+                payload.resize(size);
+                target = &payload[0];
+                wanted = size;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Sends descriptors over a local socket, in batches of at most maxFdsPerMessage.
+     * */
+    bool sendFds(int sockfd, const std::vector<int>& fds){
+        for(size_t sent = 0; sent < fds.size(); sent += maxFdsPerMessage){
+            size_t n = std::min<size_t>(maxFdsPerMessage, fds.size() - sent);
+
+            //every batch rides on a byte of its own, so batches are never merged on receipt
+            char byte = 0;
+            iovec iov {&byte, 1};
+            std::vector<char> control(CMSG_SPACE(n * sizeof(int)));
+
+            msghdr msg {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data();
+            msg.msg_controllen = control.size();
+
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &fds[sent], n * sizeof(int));
+
+            int rv;
+            while((rv = sendmsg(sockfd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+            if(rv != 1)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Receives [n] descriptors sent by sendFds().
+     *
+     * @param[out] fds where the descriptors are appended, as numbered in this process.
+     * @returns false if fewer arrived; the ones that did are still appended.
+     * */
+    bool recvFds(int sockfd, size_t n, std::vector<int>& fds){
+        size_t expected = fds.size() + n;
+        while(fds.size() < expected){
+            size_t batch = std::min<size_t>(maxFdsPerMessage, expected - fds.size());
+
+            char byte;
+            iovec iov {&byte, 1};
+            std::vector<char> control(CMSG_SPACE(batch * sizeof(int)));
+
+            msghdr msg {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data();
+            msg.msg_controllen = control.size();
+
+            int rv;
+            while((rv = recvmsg(sockfd, &msg, 0)) < 0 && errno == EINTR);
+            if(rv != 1)
+                return false;
+
+            size_t received = 0;
+            for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+                if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                    continue;
+
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for(size_t i = 0; i < count; i++){
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    fds.push_back(fd);
+                }
+                received += count;
+            }
+
+            if(received != batch || msg.msg_flags & MSG_CTRUNC)
+                return false;
+        }
+        return true;
+    }
+}
+
+#endif
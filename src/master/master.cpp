@@ -7,8 +7,15 @@
 #include <string>
 #include <cstring>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <functional>
 #include <thread>
 #include <iostream>
+#include <fcntl.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -16,7 +23,14 @@
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include "../common/communication.cpp"
 #include "../common/types.h"
+#include "../common/utils.hpp"
+#include "../common/backends.cpp"
 #include "authQueue.cpp"
+#include "connectionTable.cpp"
+#include "snapshot.cpp"
+#include "writeAheadLog.cpp"
+#include "handoff.cpp"
+#include "admission.cpp"
 #include "types.hpp"
 
 using semaphore = boost::interprocess::interprocess_semaphore;
@@ -30,21 +44,49 @@ namespace Lodestar{
         friend class Master_test;
 
         public:
+            typedef std::function<void(connectedNode&, message&)> messageHandler; ///< handles a frame received from a node
+
             ~Master(){
-                if(listeningThread && listeningThread->joinable()){
-                    isOk = false;
-                    listeningThread->join();
+                isOk = false;
+                if(snapshotThread && snapshotThread->joinable()){
+                    snapshotThread->join();
+                    saveSnapshot();
+                }
+                for(auto it = shards.begin(); it != shards.end(); it++){
+                    if(it->listeningThread && it->listeningThread->joinable()){
+                        it->listeningThread->join();
+                    }
+                    if(it->tcpListeningThread && it->tcpListeningThread->joinable()){
+                        it->tcpListeningThread->join();
+                    }
+                    if(it->tcpfd >= 0){
+                        close(it->tcpfd);
+                    }
+                    if(it->reactorThread && it->reactorThread->joinable()){
+                        it->reactorThread->join();
+                    }
+                    delete it->backend;
+                    delete it->mailbox;
+                }
+                delete changeLog;
+                if(sockfd >= 0){
+                    close(sockfd);
+                    //the successor listens on the same path
+                    if(!handedOff)
+                        unlink(sockaddr.sun_path);
                 }
-                close(sockfd);
-                unlink(sockaddr.sun_path);
             }
 
             /**
              * Constructor which also sets up the listener.
              *
              * @param sockPath the desired path to be used with the socket
+             * @param nShards amount of listener and reactor thread pairs.
+             * @param preferUring if shards should use io_uring when the kernel supports it.
              * */
-            Master(std::string sockPath){
+            Master(std::string sockPath, int nShards = 1, bool preferUring = false){
+                setupHandlers();
+                setupShards(nShards, preferUring);
                 setupListener(sockPath);
                 gracePeriod = std::chrono::seconds(20);
             }
@@ -53,22 +95,110 @@ namespace Lodestar{
              * Constructor which starts the listener with default values conditionally.
              *
              * @param startNode boolean that informs constructor if listener should be started.
+             * @param nShards amount of listener and reactor thread pairs; defaults to one per core.
+             * @param preferUring if shards should use io_uring when the kernel supports it.
              * */
-            Master(bool startListener = false){
+            Master(bool startListener = false, int nShards = std::thread::hardware_concurrency(), bool preferUring = false){
                 // TODO: function should also read config files for default
                 // socket path and call Master(std::string sockpath)
                 // with said path, with configurable timeout and number of threads
                 gracePeriod = std::chrono::seconds(20);
+                setupHandlers();
+                setupShards(nShards, preferUring);
                 if(startListener){
                     std::string socketPath = std::string(getenv("HOME"));
                     socketPath.append("/.local/share/lodestar/mastersocket");
                     setupListener(socketPath);
 
                     // NOTE: remember to call this based on config
-                    authQueue = std::move(AuthQueue(nodeArray, " ", 10, 3, 200ms));
+                    startAuthentication(" ");
                 }
             };
 
+            /**
+             * Holds the registrations of nodes that agree on leases for as long as they keep renewing them.
+             *
+             * Every frame a node sends renews its lease, and nodes with nothing else to
+             * send renew it with a heartbeat frame. A lease that runs out has its
+             * registrations removed, and the other side of their topics told, whether
+             * the node hung or its connection is gone; the node is disconnected if it's
+             * still connected. Nodes that don't agree on leases keep their registrations
+             * as before, and so do nodes that connected before this is called.
+             * Registrations restored with no node, from a snapshot, the log or a
+             * handoff, are held by a lease of their own, which lets their nodes
+             * register again before it runs out.
+             *
+             * @param time how long a lease lasts without being renewed; leases run out
+             * up to the resolution of the shards' timer wheels later than that.
+             * */
+            void enableLeases(std::chrono::milliseconds time){
+                leaseTime = time;
+                authQueue.setLeaseTime(time);
+                leaseRestored();
+            }
+
+            /**
+             * Limits what each node and peer may do, so that one can't starve the rest.
+             *
+             * Limits are checked before anything costly is done: a connection from a
+             * peer opening them too fast, or one past the cap on sockets waiting to be
+             * authenticated, is closed right after it's accepted, and a node that sends
+             * frames too fast is disconnected before its frame is even decoded. Either
+             * way it's sent a shutdown frame telling why, see shutdownCode.
+             * Nodes already connected keep the frame limit they connected with.
+             *
+             * @param limits the limits; zeroed ones don't apply.
+             * */
+            void setAdmission(const admissionLimits& limits){
+                admission.setLimits(limits);
+                authQueue.setMaxPending(limits.maxPending);
+            }
+
+            /**
+             * Sets what handles the frames of [type] sent by authenticated nodes.
+             *
+             * The handler runs on the reactor thread of the node's shard, and
+             * can answer with reply(); the message is freed once it returns.
+             * Meant to be called before nodes start sending frames of [type];
+             * frames of types without a handler are ignored. The type must also
+             * be in messageRegistry for its frames to be decoded at all.
+             *
+             * @param type a type byte of at least firstUserType; built-in types can't be handled elsewhere.
+             * @param handler what handles the frames.
+             * @returns false if [type] is reserved.
+             * */
+            bool handle(uint8_t type, messageHandler handler){
+                if(type < msgtype::firstUserType || type >= messageRegistry::maxTypes)
+                    return false;
+                handlers[type] = handler;
+                return true;
+            }
+
+            /**
+             * Queues a message to a node from a handler set with handle().
+             *
+             * @param node the node the handler was called for.
+             * @param msg the message to be sent; its data pointer must be set.
+             * @returns false if the node was disconnected for being too slow to receive it.
+             * */
+            bool reply(connectedNode& node, message& msg){
+                return sendToNode(node, msg);
+            }
+
+            /**
+             * Starts authenticating connected sockets against [pass].
+             *
+             * @param pass the password nodes have to authenticate with.
+             * @param nMaxThreads the max number of threads authenticating sockets.
+             * @param sleepTime how much the authentication overseer sleeps between passes.
+             * */
+            void startAuthentication(std::string pass, long nMaxThreads = 3, std::chrono::milliseconds sleepTime = 200ms){
+                authQueue = std::move(AuthQueue(nodeArray, pass, 10, nMaxThreads, sleepTime));
+                authQueue.setBackends(shardBackends());
+                authQueue.setLeaseTime(leaseTime);
+                authQueue.setMaxPending(admission.limits().maxPending);
+            }
+
             /**
              * Starts the listener thread using sockPath as the path.
              *
@@ -86,22 +216,632 @@ namespace Lodestar{
                     throw "Error binding socket";
                 };
 
+                //every listener polls the same socket, so the ones
+                //that lose the race to accept must not block
+                fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
                 listen(sockfd, 10);
-                listeningThread = new std::thread(&Master::listenForNodes, this, sockfd);
+
+                startListeners();
+                startReactors();
             };
 
+            /**
+             * Starts listening for nodes over TCP on [host]:[port].
+             *
+             * Every shard binds its own socket to the same port with SO_REUSEPORT,
+             * so the kernel spreads incoming connections between shard listeners.
+             * Connections go through the same authentication pipeline as local ones.
+             *
+             * @param host IPv4 address to listen on, e.g. "127.0.0.1" or "0.0.0.0".
+             * @param port port to listen on; 0 for any free port (see getTcpPort()).
+             * */
+            void setupTcpListener(std::string host, uint16_t port){
+                for(size_t i = 0; i < shards.size(); i++){
+                    sockaddr_in tcpSockaddr;
+                    shards[i].tcpfd = createTcpListener(host, port, &tcpSockaddr);
+                    if(shards[i].tcpfd < 0)
+                        throw "Error creating TCP listener";
+                    fcntl(shards[i].tcpfd, F_SETFL, fcntl(shards[i].tcpfd, F_GETFL) | O_NONBLOCK);
+
+                    //if any port was requested, the rest must bind to the one the first got
+                    port = ntohs(tcpSockaddr.sin_port);
+                    tcpPort = port;
+                }
+                startListeners();
+                startReactors();
+            }
+
+            /**
+             * @returns the port Master listens on over TCP, 0 if it doesn't.
+             * */
+            uint16_t getTcpPort(){
+                return tcpPort;
+            }
+
+            /**
+             * Restores the topic tree from [path] and keeps a snapshot of it there.
+             *
+             * A snapshot is taken every [interval] if the tree changed since the
+             * last one, and once more on destruction, so a restarted master answers
+             * queries right away instead of waiting for every node to register again.
+             *
+             * @param path where the snapshot is kept.
+             * @param interval time between snapshots.
+             * @returns true if a previous snapshot was restored.
+             * */
+            bool enableSnapshots(std::string path, std::chrono::milliseconds interval = std::chrono::seconds(10)){
+                snapshotPath = path;
+                snapshotInterval = interval;
+
+                //a tree handed over by a previous master is newer than its last snapshot
+                bool restored = false;
+                if(!tookOver){
+                    treeLock.lock();
+                    restored = loadSnapshot(path, *rootNode);
+                    if(restored)
+                        snapshotVersion = treeVersion.load();
+                    treeLock.unlock();
+                }
+                if(restored)
+                    leaseRestored();
+
+                startSnapshotThread();
+                return restored;
+            }
+
+            /**
+             * Replays the changes logged at [path] on top of the tree and logs every change from now on.
+             *
+             * Meant to be called after enableSnapshots(), so the tree recovered is the
+             * snapshot plus whatever changed after it was taken. Logged changes are
+             * committed in batches by a thread of their own, so reactors never wait
+             * on the disk; the updates telling other nodes of a change are held
+             * until it's committed, see announce().
+             *
+             * @param path where the log is kept; the log rotated out by the last snapshot is kept next to it.
+             * @returns amount of changes replayed.
+             * */
+            int enableLog(std::string path){
+                if(changeLog)
+                    return 0;
+                logPath = path;
+
+                int replayed = 0;
+                auto apply = [this](logRecord& record){
+                    std::string registrarType = record.topicType == 0 ? "pub" : "sub";
+                    if(record.op == logRecord::registered)
+                        registerToTopic(record.path, registrarType, -1, record.address);
+                    else
+                        unregisterFromTopic(record.path, registrarType, record.address);
+                };
+
+                treeLock.lock();
+                //a snapshot that failed to be written leaves its rotated log behind
+                replayed += std::max(writeAheadLog::replay(path + ".old", apply), 0);
+                replayed += std::max(writeAheadLog::replay(path, apply), 0);
+                treeLock.unlock();
+                if(replayed)
+                    leaseRestored();
+
+                changeLog = new writeAheadLog(path);
+                if(!changeLog->ok())
+                    throw "Error opening write-ahead log";
+                //reactors release the updates held for what was committed
+                changeLog->onCommit([this](){
+                    for(auto it = shards.begin(); it != shards.end(); it++)
+                        it->backend->wake();
+                });
+                return replayed;
+            }
+
+            /**
+             * Writes a snapshot of the topic tree, if it changed since the last one.
+             *
+             * The tree is only held while it's packed in memory, not while written.
+             * The log is rotated along with packing, and the part the snapshot
+             * covers is dropped once the snapshot is written.
+             *
+             * @returns false if writing the snapshot failed.
+             * */
+            bool saveSnapshot(){
+                if(snapshotPath.empty())
+                    return false;
+
+                uint64_t version = treeVersion.load();
+                if(version == snapshotVersion)
+                    return true;
+
+                treeLock.lock_shared();
+                std::string snapshot = packSnapshot(*rootNode);
+                if(changeLog)
+                    changeLog->rotate(logPath + ".old");
+                treeLock.unlock_shared();
+
+                if(!writeSnapshot(snapshot, snapshotPath))
+                    return false;
+                if(changeLog)
+                    unlink((logPath + ".old").c_str());
+                snapshotVersion = version;
+                return true;
+            }
+
+            /**
+             * Hands this master over to a successor process, without disconnecting any node.
+             *
+             * Waits for the successor to call takeOver() on [path], then stops servicing
+             * nodes and sends it the listening sockets, the sockets of authenticated
+             * nodes (along with what they had half received and not yet sent) and the
+             * topic tree. Connections that arrive meanwhile wait in the listening
+             * socket's backlog for the successor, and nodes never notice the switch.
+             * Nodes still authenticating are not handed over; they have to reconnect.
+             *
+             * Snapshots and the log are brought up to date before the handover and
+             * left to the successor afterwards.
+             *
+             * @param path local socket the successor connects to.
+             * @param timeout how long to wait for the successor, and for it to take over.
+             * @returns true once the successor took over, after which this master
+             * only has to be destroyed; false if it didn't, and this master carries on.
+             * */
+            bool handOff(std::string path, std::chrono::milliseconds timeout = std::chrono::seconds(10)){
+                int listener = socket(AF_LOCAL, SOCK_STREAM, 0);
+                if(listener < 0)
+                    return false;
+
+                sockaddr_un handoffAddr {};
+                handoffAddr.sun_family = AF_LOCAL;
+                std::strncpy(handoffAddr.sun_path, path.c_str(), sizeof(handoffAddr.sun_path) - 1);
+                unlink(path.c_str());
+
+                if(bind(listener, (struct sockaddr *) &handoffAddr, sizeof(sockaddr_un)) || listen(listener, 1)){
+                    close(listener);
+                    return false;
+                }
+
+                struct pollfd pfd {listener, POLLIN, 0};
+                int successor = -1;
+                if(poll(&pfd, 1, timeout.count()) > 0)
+                    successor = accept(listener, NULL, NULL);
+                close(listener);
+                unlink(path.c_str());
+                if(successor < 0)
+                    return false;
+
+                pause();
+                saveSnapshot();
+                if(changeLog)
+                    changeLog->sync();
+
+                std::vector<int> fds;
+                std::string payload = packHandoff(fds);
+
+                //the successor acknowledges once it services everything it was sent
+                char ack = 0;
+                pfd = pollfd {successor, POLLIN, 0};
+                bool handed = sendPayload(successor, payload) && sendFds(successor, fds)
+                    && poll(&pfd, 1, timeout.count()) > 0 && recv(successor, &ack, 1, 0) == 1;
+                close(successor);
+
+                if(!handed){
+                    resume();
+                    return false;
+                }
+
+                handedOff = true;
+                nodeArray.forEach([](connectedNode& node){
+                    close(node.socketFd);
+                });
+                nodeArray.clear();
+
+                delete changeLog;
+                changeLog = NULL;
+                snapshotPath.clear();
+                return true;
+            }
+
+            /**
+             * Takes over from a previous master that is calling handOff() on [path].
+             *
+             * Must be called before this master listens on its own; it listens on the
+             * sockets it's handed instead, and services the nodes of the previous master
+             * from where they were left. Call enableSnapshots() and enableLog()
+             * afterwards, as the handed over tree is newer than any snapshot.
+             *
+             * @param path local socket the previous master waits on.
+             * @param timeout how long to try reaching the previous master, and to wait for its state.
+             * @returns false if nothing was taken over.
+             * */
+            bool takeOver(std::string path, std::chrono::milliseconds timeout = std::chrono::seconds(10)){
+                auto deadline = std::chrono::steady_clock::now() + timeout;
+                int predecessor;
+                while((predecessor = connectLocal(path)) < 0){
+                    if(std::chrono::steady_clock::now() >= deadline)
+                        return false;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+
+                timeval tv;
+                tv.tv_sec = timeout.count() / 1000;
+                tv.tv_usec = (timeout.count() % 1000) * 1000;
+                setsockopt(predecessor, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(timeval));
+
+                std::string payload;
+                std::vector<int> fds;
+                handoffHeader header;
+                bool received = recvPayload(predecessor, payload) && payload.size() >= sizeof(header);
+                if(received){
+                    std::memcpy(&header, &payload[0], sizeof(header));
+                    received = std::memcmp(header.magic, "LDHO", 4) == 0 && header.version == handoffFormat
+                        && recvFds(predecessor, header.hasLocalListener + header.nTcpListeners + header.nNodes, fds);
+                }
+
+                if(!received || !unpackHandoff(payload, fds)){
+                    for(auto it = fds.begin(); it != fds.end(); it++)
+                        close(*it);
+                    close(predecessor);
+                    return false;
+                }
+
+                char ack = 1;
+                send(predecessor, &ack, 1, MSG_NOSIGNAL);
+                close(predecessor);
+                return true;
+            }
+
         private:
             // TODO: tidy up following horribleness
-            bool isOk = true;     ///< variable that tracks if class is ok (not shutting down)
-            int sockfd;           ///< master listening socket file descriptor.
+            std::atomic<bool> isOk = true; ///< variable that tracks if class is ok (not shutting down)
+            int sockfd = -1;      ///< master listening socket file descriptor.
             sockaddr_un sockaddr;
 
-            std::thread *listeningThread = NULL; ///< pointer to listener thread
+            std::vector<masterShard> shards;     ///< listener and reactor thread pairs; nodes belong to shard [fd % shards.size()]
+            uint16_t tcpPort = 0;                ///< port listened on over TCP, 0 if not listening over TCP
             std::chrono::seconds gracePeriod;    ///< time after which nodes are disconnected if unauthenticated
             
+            static const int maxEndpointData = 1013; ///< max size of endpoint data that fits in a correlated frame.
+            static const int maxListingData = 1012;  ///< max size of subtree listing data that fits in a correlated frame.
+            static const int maxEvents = 64;         ///< max amount of events handled per wait() of a backend.
+            static const size_t flushThreshold = 16 * 1024; ///< queued bytes past which a node is flushed before the end of the iteration.
+            static const size_t maxPendingListings = 8;     ///< subtree listings a node may have streaming at once before it's disconnected.
+
             topicTreeNode* rootNode = new topicTreeNode; ///< tree of directories and topics.
-            std::list<connectedNode> nodeArray;        ///< array of nodes connected to this master.
+            std::shared_mutex treeLock;                ///< taken exclusively to change the tree, shared to read it.
+            std::atomic<uint64_t> treeVersion = 1;     ///< bumped on every change of the tree.
+            std::string snapshotPath;                  ///< where snapshots are kept; empty if not kept.
+            uint64_t snapshotVersion = 0;              ///< treeVersion of the last snapshot taken.
+            std::thread* snapshotThread = NULL;        ///< thread taking periodic snapshots.
+            std::chrono::milliseconds snapshotInterval; ///< time between periodic snapshots.
+            bool handedOff = false;                    ///< if a successor took over from this master.
+            bool tookOver = false;                     ///< if this master took over from a previous one.
+            std::string logPath;                       ///< where changes of the tree are logged.
+            writeAheadLog* changeLog = NULL;           ///< log of changes since the last snapshot; NULL if not kept.
+            connectionTable nodeArray;                 ///< nodes connected to this master, by socket.
+            std::array<messageHandler, messageRegistry::maxTypes> handlers; ///< handler of each message type, by type byte.
+            std::atomic<std::chrono::milliseconds> leaseTime = std::chrono::milliseconds(0); ///< how long leases last; 0 if nodes hold none.
+            std::atomic<uint64_t> nextLease = 1;       ///< id of the next lease; ids are unique across shards.
+            std::mutex graceLock;                      ///< guards graceLeases.
+            std::vector<std::pair<uint64_t, nodeLease>> graceLeases; ///< leases of restored registrations, until the first shard's reactor takes them.
+            admissionControl admission;                ///< limits of nodes and peers, and the connection buckets of peers.
             AuthQueue authQueue = AuthQueue(nodeArray, " ", 5);
+
+            /**
+             * Fills the handler table with the handlers of built-in messages.
+             * */
+            void setupHandlers(){
+                handlers[msgtype::topicReg] = [this](connectedNode& node, message& msg){ handleRegistration(node, msg); };
+                handlers[msgtype::topicQry] = [this](connectedNode& node, message& msg){ handleTopicQuery(node, msg); };
+                handlers[msgtype::subtreeQry] = [this](connectedNode& node, message& msg){ handleSubtreeQuery(node, msg); };
+            }
+
+            /**
+             * Creates the backend of each shard and hands them to authQueue.
+             *
+             * @param nShards amount of shards; at least one is always created.
+             * @param preferUring if io_uring should be tried before epoll.
+             * */
+            void setupShards(int nShards, bool preferUring){
+                shards.resize(std::max(nShards, 1));
+                for(auto it = shards.begin(); it != shards.end(); it++){
+                    it->backend = createBackend(preferUring);
+                    if(!it->backend)
+                        throw "Error creating shard backend";
+                    it->mailbox = new shardMailbox;
+                }
+
+                authQueue.setBackends(shardBackends());
+            }
+
+            /**
+             * Starts the reactor thread of each shard, if not started yet.
+             * */
+            void startReactors(){
+                for(size_t i = 0; i < shards.size(); i++){
+                    if(!shards[i].reactorThread)
+                        shards[i].reactorThread = new std::thread(&Master::serviceNodes, this, i);
+                }
+            }
+
+            /**
+             * Starts a listener thread for each listening socket that has none yet.
+             * */
+            void startListeners(){
+                for(size_t i = 0; i < shards.size(); i++){
+                    if(sockfd >= 0 && !shards[i].listeningThread)
+                        shards[i].listeningThread = new std::thread(&Master::listenForNodes, this, sockfd);
+                    if(shards[i].tcpfd >= 0 && !shards[i].tcpListeningThread)
+                        shards[i].tcpListeningThread = new std::thread(&Master::listenForNodes, this, shards[i].tcpfd);
+                }
+            }
+
+            /**
+             * Starts the thread taking periodic snapshots, if snapshots are enabled and it isn't running.
+             * */
+            void startSnapshotThread(){
+                if(snapshotThread || snapshotPath.empty())
+                    return;
+
+                std::chrono::milliseconds interval = snapshotInterval;
+                snapshotThread = new std::thread([this, interval](){
+                    auto next = std::chrono::steady_clock::now() + interval;
+                    while(isOk){
+                        std::this_thread::sleep_for(std::min<std::chrono::milliseconds>(interval, std::chrono::milliseconds(100)));
+                        if(std::chrono::steady_clock::now() < next)
+                            continue;
+                        saveSnapshot();
+                        next = std::chrono::steady_clock::now() + interval;
+                    }
+                });
+            }
+
+            /**
+             * Stops every thread of the master but authentication and stops watching nodes.
+             *
+             * Events already reported by the backends are handled first, so no
+             * received bytes are left behind in them.
+             * */
+            void pause(){
+                isOk = false;
+
+                auto stop = [](std::thread*& thread){
+                    if(thread && thread->joinable())
+                        thread->join();
+                    delete thread;
+                    thread = NULL;
+                };
+
+                stop(snapshotThread);
+                for(size_t i = 0; i < shards.size(); i++){
+                    stop(shards[i].listeningThread);
+                    stop(shards[i].tcpListeningThread);
+                    stop(shards[i].reactorThread);
+                }
+
+                //handling a shard's events can post frames to the others, so
+                //every shard is drained until a whole pass finds nothing new
+                bool busy = true;
+                while(busy){
+                    busy = false;
+                    for(size_t i = 0; i < shards.size(); i++){
+                        while(serviceEvents(i, 0) > 0)
+                            busy = true;
+                    }
+                }
+
+                nodeArray.forEach([this](connectedNode& node){
+                    if(node.active)
+                        shards[node.shard].backend->unwatch(node.socketFd);
+                });
+            }
+
+            /**
+             * Undoes pause().
+             * */
+            void resume(){
+                isOk = true;
+
+                nodeArray.forEach([this](connectedNode& node){
+                    if(!node.active)
+                        return;
+                    shards[node.shard].backend->watch(node.socketFd, &node);
+                    node.writing = false;
+                    if(!flushNode(node))
+                        disconnectNode(node);
+                });
+
+                startListeners();
+                startReactors();
+                startSnapshotThread();
+            }
+
+            /**
+             * Packs the state handed over by handOff(); the master must be paused.
+             *
+             * @param[out] fds the sockets to be sent along, in the order the payload describes them.
+             * @returns the payload.
+             * */
+            std::string packHandoff(std::vector<int>& fds){
+                handoffHeader header {};
+                std::memcpy(header.magic, "LDHO", 4);
+                header.version = handoffFormat;
+                header.tcpPort = tcpPort;
+                if(sockfd >= 0){
+                    header.hasLocalListener = 1;
+                    std::memcpy(header.socketPath, sockaddr.sun_path, sizeof(header.socketPath));
+                    fds.push_back(sockfd);
+                }
+                for(auto it = shards.begin(); it != shards.end(); it++){
+                    if(it->tcpfd >= 0){
+                        header.nTcpListeners++;
+                        fds.push_back(it->tcpfd);
+                    }
+                }
+
+                treeLock.lock_shared();
+                std::string snapshot = packSnapshot(*rootNode);
+                std::vector<int32_t> sockets = packRegistrarSockets(*rootNode);
+                treeLock.unlock_shared();
+                header.snapshotBytes = snapshot.size();
+                header.nRegistrarSockets = sockets.size();
+
+                std::string nodes;
+                nodeArray.forEach([&](connectedNode& node){
+                    if(!node.active)
+                        return;
+
+                    std::string inbox = node.inbox.partialFrame();
+                    std::string outbox = node.outQueue.takeBytes();
+                    handoffNode record {node.socketFd, (uint32_t)inbox.size(), (uint32_t)outbox.size(), node.features};
+                    nodes.append((char*)&record, sizeof(record));
+                    nodes.append(inbox);
+                    nodes.append(outbox);
+
+                    header.nNodes++;
+                    fds.push_back(node.socketFd);
+                });
+
+                std::string payload;
+                payload.append((char*)&header, sizeof(header));
+                payload.append(snapshot);
+                payload.append((char*)sockets.data(), sockets.size() * sizeof(int32_t));
+                payload.append(nodes);
+                return payload;
+            }
+
+            /**
+             * Takes on the state packed by packHandoff() and starts servicing it.
+             *
+             * @param payload the payload received.
+             * @param fds the sockets received along with it.
+             * @returns false if the payload is malformed, in which case nothing is taken on.
+             * */
+            bool unpackHandoff(const std::string& payload, std::vector<int>& fds){
+                handoffHeader header;
+                std::memcpy(&header, &payload[0], sizeof(header));
+
+                size_t offset = sizeof(header);
+                size_t socketsAt = offset + header.snapshotBytes;
+                size_t nodesAt = socketsAt + (size_t)header.nRegistrarSockets * sizeof(int32_t);
+                if(nodesAt > payload.size() || fds.size() != header.hasLocalListener + header.nTcpListeners + header.nNodes)
+                    return false;
+
+                topicTreeNode tree;
+                if(!unpackSnapshot(&payload[offset], header.snapshotBytes, tree))
+                    return false;
+
+                std::vector<int32_t> sockets(header.nRegistrarSockets);
+                std::memcpy(sockets.data(), &payload[socketsAt], sockets.size() * sizeof(int32_t));
+
+                struct handedNode {
+                    handoffNode record;
+                    std::string inbox;
+                    std::string outbox;
+                };
+                std::vector<handedNode> handed;
+                offset = nodesAt;
+                for(uint32_t i = 0; i < header.nNodes; i++){
+                    handedNode node;
+                    if(offset + sizeof(handoffNode) > payload.size())
+                        return false;
+                    std::memcpy(&node.record, &payload[offset], sizeof(handoffNode));
+                    offset += sizeof(handoffNode);
+
+                    if(offset + (size_t)node.record.inboxBytes + node.record.outboxBytes > payload.size())
+                        return false;
+                    node.inbox = payload.substr(offset, node.record.inboxBytes);
+                    offset += node.record.inboxBytes;
+                    node.outbox = payload.substr(offset, node.record.outboxBytes);
+                    offset += node.record.outboxBytes;
+                    handed.push_back(std::move(node));
+                }
+
+                size_t nextFd = 0;
+                if(header.hasLocalListener){
+                    sockfd = fds[nextFd++];
+                    sockaddr.sun_family = AF_LOCAL;
+                    std::memcpy(sockaddr.sun_path, header.socketPath, sizeof(sockaddr.sun_path));
+                    sockaddr.sun_path[sizeof(sockaddr.sun_path) - 1] = 0;
+                }
+
+                //shards past the previous master's amount don't listen over TCP, and extra listeners are closed
+                for(uint32_t i = 0; i < header.nTcpListeners; i++){
+                    int fd = fds[nextFd++];
+                    if(i < shards.size())
+                        shards[i].tcpfd = fd;
+                    else
+                        close(fd);
+                }
+                if(header.nTcpListeners)
+                    tcpPort = header.tcpPort;
+
+                std::map<int, int> renumbered;
+                for(size_t i = 0; i < handed.size(); i++)
+                    renumbered[handed[i].record.socketFd] = fds[nextFd + i];
+                restoreRegistrarSockets(tree, sockets, renumbered);
+
+                treeLock.lock();
+                *rootNode = std::move(tree);
+                treeVersion++;
+                treeLock.unlock();
+
+                for(size_t i = 0; i < handed.size(); i++){
+                    connectedNode node;
+                    node.socketFd = fds[nextFd + i];
+                    node.shard = node.socketFd % shards.size();
+                    node.features = handed[i].record.features;
+
+                    connectedNode* added = nodeArray.insert(node);
+                    if(!added){
+                        close(node.socketFd);
+                        continue;
+                    }
+                    added->outQueue.pushBytes(handed[i].outbox);
+                    renewLease(*added);
+                    shards[added->shard].backend->watch(added->socketFd, added);
+                    receiveFromNode(*added, handed[i].inbox.data(), handed[i].inbox.size());
+                    if(added->active && !flushNode(*added))
+                        disconnectNode(*added);
+                }
+
+                //the registrations of handed nodes belong to their new generations, and are held by their new leases
+                treeLock.lock();
+                std::vector<std::pair<topicTreeNode*, std::string>> stack;
+                stack.push_back(std::make_pair(rootNode, std::string()));
+                while(!stack.empty()){
+                    topicTreeNode* dir = stack.back().first;
+                    std::string path = stack.back().second;
+                    stack.pop_back();
+                    for(uint8_t topicType = 0; topicType < 2; topicType++){
+                        std::vector<registrar>& registrars = topicType == 0 ? dir->publishers : dir->subscribers;
+                        for(auto it = registrars.begin(); it != registrars.end(); it++){
+                            connectedNode* holder = nodeArray.find(it->nodeSocketFd);
+                            if(!holder)
+                                continue;
+                            it->generation = holder->generation;
+                            it->lease = holder->lease;
+                            trackLease(*holder, path, topicType, it->address, true);
+                        }
+                    }
+                    for(auto it = dir->subNodes.begin(); it != dir->subNodes.end(); it++)
+                        stack.push_back(std::make_pair(&(*it), path.empty() ? it->name : path + "/" + it->name));
+                }
+                treeLock.unlock();
+                leaseRestored();
+
+                tookOver = true;
+                startListeners();
+                startReactors();
+                return true;
+            }
+
+            /**
+             * @returns the backend of each shard, in order.
+             * */
+            std::vector<ioBackend*> shardBackends(){
+                std::vector<ioBackend*> backends;
+                for(auto it = shards.begin(); it != shards.end(); it++)
+                    backends.push_back(it->backend);
+                return backends;
+            }
             
             /**
              * Tokenizes a path string with "/" as delimiter.
@@ -109,16 +849,18 @@ namespace Lodestar{
              * @param[in] Path the path string to be tokenized.
              * @returns The vector in which each element is a "directory" of the path.
              * */
-            std::vector<std::string> tokenizeTopicStr(std::string path){
+            std::vector<std::string> tokenizeTopicStr(const std::string& path){
                 std::vector<std::string> separatedPath;
-                char *token;
-                char separator[] = "/";
 
-                token = strtok(&path[0], separator);
-
-                while(token != NULL){
-                    separatedPath.push_back(std::string(token));
-                    token = strtok(NULL, separator);
+                //no strtok, since reactors tokenize paths at the same time
+                size_t start = 0;
+                while(start < path.size()){
+                    size_t end = path.find('/', start);
+                    if(end == std::string::npos)
+                        end = path.size();
+                    if(end > start)
+                        separatedPath.push_back(path.substr(start, end - start));
+                    start = end + 1;
                 }
 
                 return separatedPath;
@@ -137,7 +879,7 @@ namespace Lodestar{
                 topicTreeNode *foundDir = NULL;
                 std::vector<topicTreeNode>::iterator subNodeIterator;
 
-                for(int i = 0; i < dirPath.size(); i++){
+                for(size_t i = 0; i < dirPath.size(); i++){
                     //to avoid unnecessary processing in the case
                     //the next nodes are all empty
                     if(currentDir->subNodes.empty()){
@@ -162,6 +904,31 @@ namespace Lodestar{
                 return currentDir;
             }
 
+            /**
+             * Traverses the topic tree and returns directory at the end of a path.
+             *
+             * Unlike getDir(), does not create missing directories, so it is safe to use
+             * when answering queries.
+             *
+             * @param[in] dirPath A vector that represents a path.
+             * @returns A pointer to the directory, NULL if it does not exist.
+             * */
+            topicTreeNode* findDir(std::vector<std::string> dirPath){
+                topicTreeNode *currentDir = rootNode;
+                std::vector<topicTreeNode>::iterator it;
+
+                for(size_t i = 0; i < dirPath.size() && currentDir != NULL; i++){
+                    topicTreeNode *foundDir = NULL;
+                    for(it = currentDir->subNodes.begin(); it != currentDir->subNodes.end(); it++){
+                        if(it->type == nodeType::dir && it->name == dirPath[i])
+                            foundDir = &(*it);
+                    }
+                    currentDir = foundDir;
+                }
+
+                return currentDir;
+            }
+
             /**
              * Gets a topic from a directory.
              *
@@ -184,6 +951,27 @@ namespace Lodestar{
                 return topic;
             }
 
+            /**
+             * Finds a topic by its path, without creating anything along it.
+             *
+             * @param path The path of the topic.
+             * @returns A pointer to the topic, NULL if it does not exist.
+             * */
+            topicTreeNode* findTopic(std::string path){
+                std::vector<std::string> tokenizedPath = tokenizeTopicStr(path);
+                if(tokenizedPath.empty())
+                    return NULL;
+
+                std::string topicName = tokenizedPath.back();
+                tokenizedPath.pop_back();
+
+                topicTreeNode* dir = findDir(tokenizedPath);
+                if(!dir)
+                    return NULL;
+
+                return getTopic(dir, topicName);
+            }
+
             // TODO: also insert topic into node on nodeArray
             /**
              * Registers a node to a topic.
@@ -192,9 +980,15 @@ namespace Lodestar{
              * @param registrarType The relation of the node to the topic ("pub": publication or "sub": subscription).
              * @param nodeSocket The socket file descriptor of the node.
              * @param address The address of the node.
+             * @param lease The lease the registration is held by; 0 for none.
+             * @param generation The generation of the node; see connectedNode::generation.
+             * @returns true if the node wasn't registered to the topic yet.
              * */
-            void registerToTopic(std::string path, std::string registrarType, int nodeSocket, std::string address){
+            bool registerToTopic(std::string path, std::string registrarType, int nodeSocket, std::string address, uint64_t lease = 0, uint64_t generation = 0){
                 std::vector<std::string> tokenizedPath = tokenizeTopicStr(path);
+                if(tokenizedPath.empty())
+                    return false;
+
                 std::string topicName = tokenizedPath.back();
                 tokenizedPath.pop_back();
 
@@ -205,43 +999,960 @@ namespace Lodestar{
                     dir->subNodes.push_back(topicTreeNode {nodeType::topic, topicName});
                     topic = &(dir->subNodes.back());
                 }
+                treeVersion++;
+
+                std::vector<registrar>& registrars = registrarType == "pub" ? topic->publishers : topic->subscribers;
+                endpointCache& cache = registrarType == "pub" ? topic->publisherCache : topic->subscriberCache;
+
+                //a node registering again (e.g. after the master restored a snapshot) only gets its socket updated
+                for(auto it = registrars.begin(); it != registrars.end(); it++){
+                    if(it->address == address){
+                        //replayed changes don't know the socket, so they keep the one known
+                        if(nodeSocket >= 0){
+                            it->nodeSocketFd = nodeSocket;
+                            it->lease = lease;
+                            it->generation = generation;
+                        }
+                        return false;
+                    }
+                }
 
-                registrarType == "pub" ?
-                    topic->publishers.push_back(registrar {address, nodeSocket}):
-                    topic->subscribers.push_back(registrar {address, nodeSocket});
+                registrars.push_back(registrar {address, nodeSocket, lease, generation});
+                cache.valid = false;
+
+                if(changeLog)
+                    changeLog->append(logRecord {logRecord::registered, (uint8_t)(registrarType == "pub" ? 0 : 1), path, address});
+                return true;
             }
 
             /**
-             * Connection listener function.
+             * Removes a node from a topic.
              *
-             * Will listen for connections on sockfd and when connected, the new file descriptor will
-             * be sent to the authentication queue.
-             * 
-             * @param sockfd the listening socket.
+             * @param path The path of the topic.
+             * @param registrarType The relation of the node to the topic ("pub": publication or "sub": subscription).
+             * @param address The address the node registered with.
+             * @returns false if the node wasn't registered to the topic.
              * */
-            void listenForNodes(int sockfd){
-                // polling could be used on the future to multiplex AF_UNIX and AF_INET sockets on this function
-                sockaddr_un inSockaddr;
-                int newSockfd = 0; ///< set newSockfd to a positive number for error checking
-                int rv;
-                socklen_t addrlen = sizeof(struct sockaddr_un);
+            bool unregisterFromTopic(std::string path, std::string registrarType, std::string address){
+                if(tokenizeTopicStr(path).empty())
+                    return false;
 
-                struct pollfd pfd;
-                pfd.fd = sockfd;
-                pfd.events = POLLIN;
+                topicTreeNode* topic = findTopic(path);
+                if(!topic)
+                    return false;
 
-                //simply accept all inbound connections and push them to authentication queue
-                //(while socket exists)
-                while(isOk && (newSockfd != EBADF || newSockfd != ENOTSOCK)){
-                    rv = poll(&pfd, 1, (0.5 * 1000));
+                std::vector<registrar>& registrars = registrarType == "pub" ? topic->publishers : topic->subscribers;
+                endpointCache& cache = registrarType == "pub" ? topic->publisherCache : topic->subscriberCache;
+
+                auto found = std::find_if(registrars.begin(), registrars.end(), [&address](registrar& reg){
+                    return reg.address == address;
+                });
+                if(found == registrars.end())
+                    return false;
+
+                registrars.erase(found);
+                cache.valid = false;
+                treeVersion++;
+
+                if(changeLog)
+                    changeLog->append(logRecord {logRecord::unregistered, (uint8_t)(registrarType == "pub" ? 0 : 1), path, address});
+                return true;
+            }
+
+            /**
+             * Packs a vector of registrars into an endpoint cache.
+             *
+             * Entries that would not fit into a single frame are left out.
+             *
+             * @param registrars the registrars to be packed.
+             * @param[out] cache the cache that will hold the packed endpoints.
+             * */
+            void buildEndpointCache(std::vector<registrar>& registrars, endpointCache& cache){
+                cache.data.clear();
+                cache.count = 0;
+
+                std::vector<registrar>::iterator it;
+                for(it = registrars.begin(); it != registrars.end(); it++){
+                    uint16_t len = it->address.size();
+                    if(cache.data.size() + len + 2 > maxEndpointData)
+                        break;
+
+                    cache.data.push_back(len);
+                    cache.data.push_back(len >> 8);
+                    cache.data.append(it->address);
+                    cache.count++;
+                }
+
+                cache.valid = true;
+            }
+
+            /**
+             * Gets the endpoints registered to a topic.
+             *
+             * The endpoints are only re-encoded if the topic's registrars changed
+             * since the last query; otherwise the cached list is returned as is.
+             *
+             * @param path The path of the topic.
+             * @param topicType 0 for the topic's publishers, 1 for its subscribers.
+             * @returns A pointer to the topic's endpoint cache, NULL if the topic does not exist.
+             * */
+            endpointCache* queryTopic(std::string path, uint8_t topicType){
+                topicTreeNode* topic = findTopic(path);
+                if(!topic)
+                    return NULL;
+
+                endpointCache& cache = topicType == 0 ? topic->publisherCache : topic->subscriberCache;
+                if(!cache.valid)
+                    buildEndpointCache(topicType == 0 ? topic->publishers : topic->subscribers, cache);
+
+                return &cache;
+            }
+
+            /**
+             * Gets the endpoint cache of a topic as it is, built or not.
+             *
+             * @returns A pointer to the topic's endpoint cache, NULL if the topic does not exist.
+             * */
+            endpointCache* cachedEndpoints(std::string path, uint8_t topicType){
+                topicTreeNode* topic = findTopic(path);
+                if(!topic)
+                    return NULL;
+                return topicType == 0 ? &topic->publisherCache : &topic->subscriberCache;
+            }
+
+            /**
+             * Packs the next entries of a subtree listing, depth first; the tree must be held.
+             *
+             * @param cursor where the listing is at; moved past the entries packed.
+             * @param[out] data the entries packed, at most maxListingData bytes of them.
+             * @param[out] count amount of entries packed.
+             * @returns true if the subtree has been walked through.
+             * */
+            bool packListing(listingCursor& cursor, std::string& data, uint16_t& count){
+                topicTreeNode* dir = NULL; //directory at the top of the stack, once looked up
+                while(!cursor.stack.empty()){
+                    std::pair<std::string, size_t>& top = cursor.stack.back();
+                    if(!dir)
+                        dir = findDir(tokenizeTopicStr(top.first));
+                    if(!dir || top.second >= dir->subNodes.size()){
+                        cursor.stack.pop_back();
+                        dir = NULL;
+                        continue;
+                    }
+
+                    topicTreeNode* entry = &dir->subNodes[top.second];
+                    std::string path = top.first + entry->name;
+                    uint16_t len = path.size();
+                    //paths that can't fit any frame are left out, along with what's under them
+                    if(len + 3 > maxListingData){
+                        top.second++;
+                        continue;
+                    }
+                    if(data.size() + len + 3 > maxListingData)
+                        return false;
+
+                    top.second++;
+                    data.push_back(entry->type);
+                    data.push_back(len);
+                    data.push_back(len >> 8);
+                    data.append(path);
+                    count++;
+
+                    if(entry->type == nodeType::dir){
+                        path.push_back('/');
+                        cursor.stack.push_back(std::make_pair(path, 0));
+                        dir = entry;
+                    }
+                }
+
+                return true;
+            }
+
+            /**
+             * Queues the next frame of the oldest listing being streamed to a node.
+             *
+             * Called once per writable event of the node's socket, so that a long
+             * listing goes out a frame at a time, between the events of other
+             * nodes, and the tree is only held while each frame is packed.
+             * Nothing is packed while the frame wouldn't fit the node's queue.
+             *
+             * @param node the node whose listing is to be continued.
+             * @returns false if the frame couldn't be queued.
+             * */
+            bool continueListing(connectedNode& node){
+                if(node.listings.empty())
+                    return true;
+                size_t queued = node.outQueue.size();
+                if(queued && queued + maxListingData + 12 > node.outQueue.highWaterMark)
+                    return true;
+
+                listingCursor& cursor = node.listings.front();
+                std::string data;
+                uint16_t count = 0;
+                bool last;
+                {
+                    std::shared_lock<std::shared_mutex> guard(treeLock);
+                    last = packListing(cursor, data, count);
+                }
+
+                subtreeListing listing;
+                listing.last = last;
+                listing.count = count;
+                listing.dataLen = data.size();
+                listing.data = &data[0];
+
+                message frame;
+                frame.data = &listing;
+                frame.id = cursor.id;
+                if(!node.outQueue.push(frame))
+                    return false;
+
+                if(last)
+                    node.listings.pop_front();
+                return true;
+            }
+
+            /**
+             * Starts streaming every directory and topic under a directory to a node.
+             *
+             * The full paths of the subtree's entries go out in frames of at most
+             * maxListingData bytes, the first one right away and the rest on the
+             * writable events of the node's socket; see continueListing(). Memory
+             * used is bounded by the depth of the tree instead of the amount of
+             * entries on it. Listings asked for while one is streamed follow it.
+             *
+             * @param path the path of the directory to be listed; empty for the whole tree.
+             * @param node the node the listing is to be streamed to.
+             * @param id correlation id of the query, carried by every frame of the listing.
+             * @returns false if the node has too many listings pending, or its socket errored out.
+             * */
+            bool listSubtree(std::string path, connectedNode& node, uint32_t id = 0){
+                if(node.listings.size() >= maxPendingListings)
+                    return false;
+
+                std::vector<std::string> tokenizedPath = tokenizeTopicStr(path);
+                std::string currentPath;
+                for(size_t i = 0; i < tokenizedPath.size(); i++){
+                    currentPath.append(tokenizedPath[i]);
+                    currentPath.push_back('/');
+                }
+
+                listingCursor cursor;
+                cursor.stack.push_back(std::make_pair(currentPath, 0));
+                cursor.id = id;
+                node.listings.push_back(cursor);
+                if(node.listings.size() > 1)
+                    return true;
+
+                return continueListing(node) && deferFlush(node);
+            }
+
+            /**
+             * Handles a message received from an authenticated node.
+             *
+             * Messages are dispatched by type through the handler table, so types
+             * added with handle() go through the same path as built-in ones.
+             * Answers carry the correlation id of the request they answer, so a node can
+             * pipeline requests and match the answers without relying on their order.
+             *
+             * @param node the node that sent the message.
+             * @param msg the deserialized message.
+             * */
+            void handleMessage(connectedNode& node, message& msg){
+                messageHandler& handler = handlers[msg.data->dataType];
+                if(handler)
+                    handler(node, msg);
+            }
+
+            /**
+             * Registers a node to a topic or removes it from one, as asked by a registration message.
+             * */
+            void handleRegistration(connectedNode& node, message& msg){
+                registration* reg = static_cast<registration*>(msg.data);
+                std::string path(reg->name, strnlen(reg->name, reg->nameLen));
+                std::string address(reg->registrarName, strnlen(reg->registrarName, reg->registrarLen));
+                delete[] reg->name;
+                delete[] reg->registrarName;
+                //a name of separators alone has no topic to register to
+                if(tokenizeTopicStr(path).empty())
+                    return;
+
+                std::unique_lock<std::shared_mutex> guard(treeLock);
+                bool changed;
+                if(reg->type == 0)
+                    changed = registerToTopic(path, reg->topicType == 0 ? "pub" : "sub", node.socketFd, address, node.lease, node.generation);
+                else
+                    changed = unregisterFromTopic(path, reg->topicType == 0 ? "pub" : "sub", address);
+                trackLease(node, path, reg->topicType, address, reg->type == 0);
+
+                //the other side of the topic hears of the change without having to ask
+                if(changed){
+                    std::vector<recipient> interested = registrarNodes(path, reg->topicType == 0 ? 1 : 0);
+                    uint64_t sequence = changeLog ? changeLog->last() : 0;
+                    guard.unlock();
+                    announce(node.shard, sequence, encodeUpdate(path, reg->topicType, address, reg->type == 1), interested, node.socketFd);
+                }
+            }
+
+            /**
+             * Answers a topic query with the topic's endpoints.
+             * */
+            void handleTopicQuery(connectedNode& node, message& msg){
+                topicQuery* query = static_cast<topicQuery*>(msg.data);
+                std::string path(query->name, strnlen(query->name, query->nameLen));
+                delete[] query->name;
+
+                endpointList list;
+                list.count = 0;
+                list.dataLen = 0;
+                list.data = NULL;
+
+                //the cache is only rebuilt by the first query after a change, which needs the tree exclusively
+                std::shared_lock<std::shared_mutex> shared(treeLock);
+                std::unique_lock<std::shared_mutex> exclusive;
+                endpointCache* cache = cachedEndpoints(path, query->topicType);
+                if(cache && !cache->valid){
+                    shared.unlock();
+                    exclusive = std::unique_lock<std::shared_mutex>(treeLock);
+                    cache = queryTopic(path, query->topicType);
+                }
+                if(cache){
+                    list.count = cache->count;
+                    list.dataLen = cache->data.size();
+                    list.data = &cache->data[0];
+                }
+
+                message reply;
+                reply.data = &list;
+                reply.id = msg.id;
+                sendToNode(node, reply);
+            }
+
+            /**
+             * Answers a subtree query with a listing of the subtree.
+             * */
+            void handleSubtreeQuery(connectedNode& node, message& msg){
+                subtreeQuery* query = static_cast<subtreeQuery*>(msg.data);
+                std::string path(query->name, strnlen(query->name, query->nameLen));
+                delete[] query->name;
+                if(!listSubtree(path, node, msg.id))
+                    disconnectNode(node);
+            }
+
+            /**
+             * Lists the nodes registered to a topic; the tree must be held.
+             *
+             * @param path The path of the topic.
+             * @param topicType 0 for the topic's publishers, 1 for its subscribers.
+             * @returns the socket and generation of the registrars still bound to a socket, empty if the topic does not exist.
+             * */
+            std::vector<recipient> registrarNodes(std::string path, uint8_t topicType){
+                std::vector<recipient> nodes;
+                topicTreeNode* topic = findTopic(path);
+                if(!topic)
+                    return nodes;
+
+                std::vector<registrar>& registrars = topicType == 0 ? topic->publishers : topic->subscribers;
+                for(auto it = registrars.begin(); it != registrars.end(); it++){
+                    if(it->nodeSocketFd >= 0)
+                        nodes.push_back(recipient {it->nodeSocketFd, it->generation});
+                }
+                return nodes;
+            }
+
+            /**
+             * Serializes the topic update announcing a registrar's change into a frame, once for every recipient.
+             *
+             * @param path The path of the topic, sent as the update's address.
+             * @param topicType 0 if the registrar publishes to the topic, 1 if it subscribes.
+             * @param address The address of the registrar, sent as the update's registrar name.
+             * @param removed if the registrar left the topic instead of joining it.
+             * @returns the frame, size header included.
+             * */
+            std::shared_ptr<const std::string> encodeUpdate(std::string path, uint8_t topicType, std::string address, bool removed){
+                topicUpdate update;
+                update.type = (removed ? 1 : 0) | (topicType == 1 ? 2 : 0);
+                update.registrarLen = address.size();
+                update.registrarName = &address[0];
+                update.addressLen = path.size();
+                update.address = &path[0];
+
+                message msg;
+                msg.data = &update;
+
+                char buffer[1024];
+                uint16_t size = msg.serializeMessage(&buffer[2]);
+                buffer[0] = size;
+                buffer[1] = size >> 8;
+                return std::make_shared<const std::string>(buffer, size + 2);
+            }
+
+            /**
+             * Sends a frame to every node in [recipients] but [sender], without copying it.
+             *
+             * Nodes of the sender's shard get the frame queued right away and flushed
+             * along with the rest of the iteration; the frame is posted by socket to
+             * the mailbox of every other shard, which is woken once per fan-out, so
+             * the cost per recipient is queueing a reference to the shared frame.
+             *
+             * @param shardId the shard whose reactor is calling.
+             * @param frame the frame to be sent.
+             * @param recipients the nodes the frame is to be sent to.
+             * @param sender the socket of the node whose message caused the frame, which isn't sent it; -1 for none.
+             * */
+            void fanOut(int shardId, std::shared_ptr<const std::string> frame, std::vector<recipient>& recipients, int sender = -1){
+                std::vector<std::vector<recipient>> posted(shards.size());
+                for(auto it = recipients.begin(); it != recipients.end(); it++){
+                    if(it->socketFd == sender)
+                        continue;
+
+                    int shard = it->socketFd % shards.size();
+                    if(shard == shardId)
+                        queueFrame(*it, frame);
+                    else
+                        posted[shard].push_back(*it);
+                }
+
+                for(size_t i = 0; i < shards.size(); i++){
+                    if(posted[i].empty())
+                        continue;
+
+                    shardMailbox* mailbox = shards[i].mailbox;
+                    mailbox->lock.lock();
+                    bool asleep = mailbox->frames.empty();
+                    for(auto it = posted[i].begin(); it != posted[i].end(); it++)
+                        mailbox->frames.push_back(std::make_pair(*it, frame));
+                    mailbox->lock.unlock();
+
+                    //a shard with mail already pending was woken by whoever posted it
+                    if(asleep)
+                        shards[i].backend->wake();
+                }
+            }
+
+            /**
+             * Fans out the update of a change once the change is in the write-ahead log.
+             *
+             * A node told of a registration can act on it right away, so it isn't
+             * told of one a crash could still undo. Updates waiting on the log are
+             * kept by the shard in order and released by releaseLogged() once the
+             * committer wakes the reactor; if the log failed they are released
+             * anyway, since it will never catch up.
+             *
+             * @param shardId the shard whose reactor is calling.
+             * @param sequence log record of the change; see writeAheadLog::last().
+             * @param frame the update to be sent.
+             * @param recipients the nodes the update is for.
+             * @param sender the socket of the node that made the change; -1 for none.
+             * */
+            void announce(int shardId, uint64_t sequence, std::shared_ptr<const std::string> frame, std::vector<recipient>& recipients, int sender = -1){
+                std::deque<loggedUpdate>& awaiting = shards[shardId].awaitingLog;
+                if(awaiting.empty() && (!changeLog || changeLog->settled(sequence))){
+                    fanOut(shardId, frame, recipients, sender);
+                    return;
+                }
+
+                awaiting.push_back(loggedUpdate {sequence, frame, recipients, sender});
+            }
+
+            /**
+             * Fans out the updates of a shard whose changes have been committed since announce().
+             *
+             * @param shardId the shard whose held updates are to be released.
+             * */
+            void releaseLogged(int shardId){
+                std::deque<loggedUpdate>& awaiting = shards[shardId].awaitingLog;
+                while(!awaiting.empty() && (!changeLog || changeLog->settled(awaiting.front().sequence))){
+                    loggedUpdate& update = awaiting.front();
+                    fanOut(shardId, update.frame, update.recipients, update.sender);
+                    awaiting.pop_front();
+                }
+            }
+
+            /**
+             * Queues a shared topic update to a node, if it's still connected and agreed to get them.
+             *
+             * The node is looked up by socket and only queued to if it's still the
+             * generation that registered, so an update never reaches a node that
+             * was given the socket of a disconnected one.
+             * Must only be called from the reactor thread of the node's shard;
+             * slow consumers are disconnected like in sendToNode().
+             * */
+            void queueFrame(const recipient& to, const std::shared_ptr<const std::string>& frame){
+                connectedNode* node = nodeArray.find(to.socketFd);
+                if(!node || node->generation != to.generation || !node->active || !(node->features & feature::pushedUpdates))
+                    return;
+
+                if(!node->outQueue.pushShared(frame) || !deferFlush(*node))
+                    disconnectNode(*node);
+            }
+
+            /**
+             * Queues the frames posted to a shard's nodes by other shards.
+             *
+             * @param shardId the shard whose mailbox is to be emptied.
+             * */
+            void deliverMail(int shardId){
+                std::vector<std::pair<recipient, std::shared_ptr<const std::string>>> frames;
+                shardMailbox* mailbox = shards[shardId].mailbox;
+                mailbox->lock.lock();
+                frames.swap(mailbox->frames);
+                mailbox->lock.unlock();
+
+                for(auto it = frames.begin(); it != frames.end(); it++)
+                    queueFrame(it->first, it->second);
+            }
+
+            /**
+             * Queues a message to a node, to be sent along with the rest queued this iteration.
+             *
+             * If the node's write queue is over its high-water mark, the node is
+             * considered a slow consumer and disconnected, so that it can't hold
+             * the thread that writes to it.
+             *
+             * @param node the node the message is to be sent to.
+             * @param msg the message to be sent; its data pointer must be set.
+             * @returns false if the node was disconnected.
+             * */
+            bool sendToNode(connectedNode& node, message& msg){
+                if(!node.outQueue.push(msg) || !deferFlush(node)){
+                    disconnectNode(node);
+                    return false;
+                }
+
+                return true;
+            }
+
+            /**
+             * Has a node's queue flushed at the end of the reactor's iteration.
+             *
+             * Frames queued to a node while its shard handles a batch of events
+             * then go out in a single send. Queues past flushThreshold are
+             * flushed right away, so a long reply doesn't pile up.
+             *
+             * @param node the node whose queue is to be flushed.
+             * @returns false if the node's socket errored out.
+             * */
+            bool deferFlush(connectedNode& node){
+                if(node.outQueue.size() >= flushThreshold)
+                    return flushNode(node);
+
+                if(!node.flushQueued){
+                    node.flushQueued = true;
+                    shards[node.shard].queuedFlushes.push_back(&node);
+                }
+                return true;
+            }
+
+            /**
+             * Flushes the queues of a shard's nodes deferred by deferFlush().
+             *
+             * @param shardId the shard whose nodes are to be flushed.
+             * */
+            void flushQueuedNodes(int shardId){
+                std::vector<connectedNode*>& queuedFlushes = shards[shardId].queuedFlushes;
+                for(auto it = queuedFlushes.begin(); it != queuedFlushes.end(); it++){
+                    connectedNode* node = *it;
+                    node->flushQueued = false;
+                    if(node->active && !flushNode(*node))
+                        disconnectNode(*node);
+                }
+                queuedFlushes.clear();
+            }
+
+            /**
+             * Writes a node's queue without blocking.
+             *
+             * Asks the shard's backend for a writable event while there still
+             * are queued bytes or listings to stream, and stops asking once
+             * there are neither.
+             *
+             * @param node the node whose queue is to be flushed.
+             * @returns false if the node's socket errored out.
+             * */
+            bool flushNode(connectedNode& node){
+                queueStatus status = node.outQueue.flush(node.socketFd);
+                if(status == queueStatus::failed)
+                    return false;
+
+                bool writing = status == queueStatus::pending || !node.listings.empty();
+                if(writing != node.writing){
+                    shards[node.shard].backend->setWriting(node.socketFd, &node, writing);
+                    node.writing = writing;
+                }
+
+                return true;
+            }
+
+            /**
+             * Stops watching a node's socket and marks it inactive.
+             *
+             * The node is only removed from nodeArray by removeInactiveNodes(), so that
+             * it's safe to disconnect a node while handling one of its events; its socket
+             * is closed there too, so the descriptor isn't reused while the node holds its slot.
+             * Must only be called from the reactor thread of the node's shard.
+             *
+             * @param node the node to be disconnected.
+             * */
+            void disconnectNode(connectedNode& node){
+                if(!node.active)
+                    return;
+
+                shards[node.shard].backend->unwatch(node.socketFd);
+                node.active = false;
+                shards[node.shard].inactiveNodes.push_back(&node);
+            }
+
+            /**
+             * Disconnects a node, telling it why with a shutdown frame if its socket takes it right away.
+             *
+             * @param node the node to be shed.
+             * @param code the reason; see shutdownCode.
+             * */
+            void shedNode(connectedNode& node, uint8_t code){
+                shutdown reason;
+                reason.code = code;
+                message msg;
+                msg.data = &reason;
+
+                if(node.outQueue.push(msg))
+                    node.outQueue.flush(node.socketFd);
+                disconnectNode(node);
+            }
+
+            /**
+             * Removes the nodes of a shard disconnected by disconnectNode() from nodeArray and closes their sockets.
+             *
+             * @param shardId the shard whose nodes are to be removed.
+             * */
+            void removeInactiveNodes(int shardId){
+                std::vector<connectedNode*>& inactiveNodes = shards[shardId].inactiveNodes;
+                for(auto node = inactiveNodes.begin(); node != inactiveNodes.end(); node++){
+                    int fd = (*node)->socketFd;
+                    if(nodeArray.remove(*node))
+                        close(fd);
+                }
+                inactiveNodes.clear();
+            }
+
+            /**
+             * Pushes back the expiry of a node's lease, taking one out for it the first time.
+             *
+             * Nodes that didn't agree on leases hold none. Must only be called from the
+             * reactor thread of the node's shard, or before the reactors are started.
+             * */
+            void renewLease(connectedNode& node){
+                std::chrono::milliseconds time = leaseTime;
+                if(!time.count() || !(node.features & feature::leases))
+                    return;
+
+                masterShard& shard = shards[node.shard];
+                auto expiry = std::chrono::steady_clock::now() + time;
+                if(!node.lease){
+                    node.lease = nextLease++;
+                    shard.leaseWheel.schedule(node.lease, expiry);
+                }
+                nodeLease& lease = shard.leases[node.lease];
+                lease.socketFd = node.socketFd;
+                lease.expiry = expiry;
+            }
+
+            /**
+             * Expires the leases of a shard that ran out, dropping the registrations they held.
+             *
+             * Renewals only move the expiry kept in the shard's lease table, so a lease
+             * fired by the wheel that was renewed meanwhile is just scheduled again.
+             *
+             * @param shardId the shard whose leases are to be expired.
+             * */
+            void expireLeases(int shardId){
+                if(!leaseTime.load().count())
+                    return;
+
+                masterShard& shard = shards[shardId];
+                if(shardId == 0){
+                    std::lock_guard<std::mutex> guard(graceLock);
+                    for(auto it = graceLeases.begin(); it != graceLeases.end(); it++){
+                        shard.leaseWheel.schedule(it->first, it->second.expiry);
+                        shard.leases[it->first] = std::move(it->second);
+                    }
+                    graceLeases.clear();
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                shard.leaseWheel.advance(now, [&](uint64_t id){
+                    auto found = shard.leases.find(id);
+                    if(found == shard.leases.end())
+                        return;
+                    if(found->second.expiry > now){
+                        shard.leaseWheel.schedule(id, found->second.expiry);
+                        return;
+                    }
+
+                    int sockfd = found->second.socketFd;
+                    std::set<leasedRegistration> held = std::move(found->second.registrations);
+                    shard.leases.erase(found);
+                    dropLease(shardId, id, held);
+
+                    //a hung node is disconnected; one that's gone already may have had its socket reused
+                    connectedNode* node = nodeArray.find(sockfd);
+                    if(node && node->lease == id)
+                        disconnectNode(*node);
+                });
+            }
+
+            /**
+             * Holds the registrations restored with no node under a lease of their own.
+             *
+             * Nothing renews it, so the registrations are dropped once it runs out,
+             * unless their nodes register again meanwhile and take them over. The
+             * lease is taken by the first shard's reactor, the only one touching its
+             * lease table, the next time it expires leases.
+             * */
+            void leaseRestored(){
+                std::chrono::milliseconds time = leaseTime;
+                if(!time.count())
+                    return;
+
+                uint64_t id = nextLease++;
+                nodeLease grace {-1, std::chrono::steady_clock::now() + time, {}};
+
+                treeLock.lock();
+                std::vector<std::pair<topicTreeNode*, std::string>> stack;
+                stack.push_back(std::make_pair(rootNode, std::string()));
+                while(!stack.empty()){
+                    topicTreeNode* dir = stack.back().first;
+                    std::string path = stack.back().second;
+                    stack.pop_back();
+                    for(uint8_t topicType = 0; topicType < 2; topicType++){
+                        std::vector<registrar>& registrars = topicType == 0 ? dir->publishers : dir->subscribers;
+                        for(auto it = registrars.begin(); it != registrars.end(); it++){
+                            if(it->nodeSocketFd >= 0 || it->lease)
+                                continue;
+                            it->lease = id;
+                            grace.registrations.insert(leasedRegistration {path, topicType, it->address});
+                        }
+                    }
+                    for(auto it = dir->subNodes.begin(); it != dir->subNodes.end(); it++)
+                        stack.push_back(std::make_pair(&(*it), path.empty() ? it->name : path + "/" + it->name));
+                }
+                treeLock.unlock();
+
+                if(grace.registrations.empty())
+                    return;
+                std::lock_guard<std::mutex> guard(graceLock);
+                graceLeases.push_back(std::make_pair(id, std::move(grace)));
+            }
+
+            /**
+             * Notes a registration a node made under its lease, so it's dropped along with it.
+             *
+             * @param node the node that registered.
+             * @param path The path of the topic.
+             * @param topicType 0 for pub, 1 for sub.
+             * @param address The address of the registrar.
+             * @param registered false if the node unregistered instead.
+             * */
+            void trackLease(connectedNode& node, std::string& path, uint8_t topicType, std::string& address, bool registered){
+                if(!node.lease)
+                    return;
+                auto found = shards[node.shard].leases.find(node.lease);
+                if(found == shards[node.shard].leases.end())
+                    return;
+
+                leasedRegistration entry {path, topicType, address};
+                if(registered)
+                    found->second.registrations.insert(entry);
+                else
+                    found->second.registrations.erase(entry);
+            }
+
+            /**
+             * Removes the registrations held by a lease and tells the other side of their topics.
+             *
+             * Registrations taken over by another lease since, like a node registering
+             * again over a new connection, are left alone.
+             *
+             * @param shardId the shard whose reactor is calling.
+             * @param lease the lease whose registrations are to be removed.
+             * @param held the registrations made under the lease.
+             * */
+            void dropLease(int shardId, uint64_t lease, const std::set<leasedRegistration>& held){
+                std::vector<const leasedRegistration*> dropped;
+                std::vector<std::vector<recipient>> interested;
+
+                std::unique_lock<std::shared_mutex> guard(treeLock);
+                for(auto it = held.begin(); it != held.end(); it++){
+                    topicTreeNode* topic = findTopic(it->path);
+                    if(!topic)
+                        continue;
+
+                    std::vector<registrar>& registrars = it->topicType == 0 ? topic->publishers : topic->subscribers;
+                    auto registered = std::find_if(registrars.begin(), registrars.end(), [it](const registrar& entry){
+                        return entry.address == it->address;
+                    });
+                    if(registered == registrars.end() || registered->lease != lease)
+                        continue;
+
+                    unregisterFromTopic(it->path, it->topicType == 0 ? "pub" : "sub", it->address);
+                    dropped.push_back(&(*it));
+                    interested.push_back(registrarNodes(it->path, it->topicType == 0 ? 1 : 0));
+                }
+                uint64_t sequence = changeLog ? changeLog->last() : 0;
+                guard.unlock();
+
+                for(size_t i = 0; i < dropped.size(); i++)
+                    announce(shardId, sequence, encodeUpdate(dropped[i]->path, dropped[i]->topicType, dropped[i]->address, true), interested[i]);
+            }
+
+            /**
+             * Assembles messages from bytes received from a node, handling each once complete.
+             *
+             * @param node the node the bytes were received from.
+             * @param data bytes received.
+             * @param len amount of bytes in [data].
+             * */
+            void receiveFromNode(connectedNode& node, const char* data, int len){
+                renewLease(node);
+                while(len > 0 && node.active){
+                    int consumed = node.inbox.feed(data, len);
+                    if(consumed < 0){
+                        disconnectNode(node);
+                        return;
+                    }
+                    data += consumed;
+                    len -= consumed;
+
+                    if(node.inbox.state != msgStatus::ok)
+                        continue;
+
+                    if(!node.budgeted){
+                        node.frameBudget = admission.frameBucket();
+                        node.budgeted = true;
+                    }
+                    if(!node.frameBudget.take()){
+                        shedNode(node, shutdownCode::rateLimited);
+                        return;
+                    }
+
+                    if(!node.inbox.deserializeMessage()){
+                        disconnectNode(node);
+                        return;
+                    }
+
+                    handleMessage(node, node.inbox);
+                    delete node.inbox.data;
+                    node.inbox.data = NULL;
+                }
+            }
+
+            /**
+             * Event loop of the authenticated nodes of a shard.
+             *
+             * Waits on the shard's backend, handling the messages received from nodes
+             * and flushing the queues of writable ones, until isOk is false.
+             * Shards only share the topic tree (guarded by treeLock) and their
+             * mailboxes, through which topic updates reach the nodes of other shards.
+             *
+             * @param shardId the shard to be serviced.
+             * */
+            void serviceNodes(int shardId){
+                while(isOk){
+                    //leases are expired between waits, so waits are cut to the resolution of the wheel
+                    int timeout = 500;
+                    if(leaseTime.load().count())
+                        timeout = std::min<int>(timeout, shards[shardId].leaseWheel.resolution().count());
+                    serviceEvents(shardId, timeout);
+                }
+            }
+
+            /**
+             * Waits once on a shard's backend and handles the events it reports.
+             *
+             * @param shardId the shard to be serviced.
+             * @param timeout max time to wait for events, in milliseconds.
+             * @returns amount of events handled.
+             * */
+            int serviceEvents(int shardId, int timeout){
+                ioEvent events[maxEvents];
+                ioBackend* backend = shards[shardId].backend;
+
+                int n = backend->wait(events, maxEvents, timeout);
+                for(int i = 0; i < n; i++){
+                    connectedNode* node = static_cast<connectedNode*>(events[i].context);
+                    if(node->active){
+                        switch(events[i].type){
+                            case ioEvent::closed:
+                                disconnectNode(*node);
+                                break;
+                            case ioEvent::writable:
+                                node->writing = false;
+                                if(!continueListing(*node) || !flushNode(*node))
+                                    disconnectNode(*node);
+                                break;
+                            case ioEvent::received:
+                                receiveFromNode(*node, events[i].data, events[i].len);
+                                break;
+                        }
+                    }
+                    backend->done(events[i]);
+                }
+
+                expireLeases(shardId);
+                releaseLogged(shardId);
+                deliverMail(shardId);
+                flushQueuedNodes(shardId);
+                removeInactiveNodes(shardId);
+                return n;
+            }
+
+            /**
+             * Connection listener function.
+             *
+             * Will listen for connections on sockfd and when connected, the new file descriptor will
+             * be sent to the authentication queue.
+             * One of these runs for each shard on the same local socket; the kernel wakes them
+             * all on a new connection and only one wins the accept. Over TCP each shard
+             * has its own socket, so only the chosen listener is woken.
+             * 
+             * @param sockfd the listening socket, either local or TCP.
+             * */
+            void listenForNodes(int sockfd){
+                sockaddr_storage inSockaddr;
+                int newSockfd = 0; ///< set newSockfd to a positive number for error checking
+                int rv;
+                socklen_t addrlen;
+
+                struct pollfd pfd;
+                pfd.fd = sockfd;
+                pfd.events = POLLIN;
+
+                //simply accept all inbound connections and push them to authentication queue
+                //(while socket exists)
+                while(isOk && (newSockfd != EBADF || newSockfd != ENOTSOCK)){
+                    rv = poll(&pfd, 1, (0.5 * 1000));
+
+                    if(rv > 0){
+                        addrlen = sizeof(struct sockaddr_storage);
+                        newSockfd = accept(sockfd, (struct sockaddr *)&inSockaddr, &addrlen);
+                        if(newSockfd < 0)
+                            continue; //another listener accepted it
+
+                        //peers reconnecting in a loop are shed before they cost an authentication
+                        if(!admission.admitPeer(newSockfd, inSockaddr)){
+                            shedSocket(newSockfd, shutdownCode::rateLimited);
+                            continue;
+                        }
+
+                        if(inSockaddr.ss_family == AF_INET || inSockaddr.ss_family == AF_INET6)
+                            configureTcp(newSockfd);
 
-                    if(rv > 0){
-                        newSockfd = accept(sockfd, (struct sockaddr *)&inSockaddr, &addrlen);
                         autheableNode newNode;
                         newNode.sockfd = newSockfd;
                         newNode.timeout = std::chrono::steady_clock::now() + gracePeriod;
 
-                        authQueue.insertNode(newNode);
+                        if(!authQueue.insertNode(newNode))
+                            shedSocket(newSockfd, shutdownCode::overloaded);
                     }
                     if(rv < 0){
                         // TODO: proper error logging
@@ -1,4 +1,6 @@
 #include <chrono>
+#include <fstream>
+#include <iterator>
 #include <sys/socket.h>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include "master.cpp"
@@ -12,8 +14,8 @@ using semaphore = boost::interprocess::interprocess_semaphore;
 namespace Lodestar{
     class Master_test: Master{
         public:
-            Master_test(std::string sockPath): Master(){
-                master = new Master(sockPath);
+            Master_test(std::string sockPath, int nShards = 1, bool preferUring = false): Master(){
+                master = new Master(sockPath, nShards, preferUring);
                 setupPointers();
             };
 
@@ -30,10 +32,10 @@ namespace Lodestar{
             
             Master *master = NULL;
             topicTreeNode* rootNode = NULL;
-            std::list<Lodestar::connectedNode>* nodeArray = NULL;
+            Lodestar::connectionTable* nodeArray = NULL;
 
             //threading variables
-            bool* isOk;
+            std::atomic<bool>* isOk;
             int* sockfd;
             sockaddr_un* sockaddr;
             std::thread *listeningThread = NULL;
@@ -59,12 +61,75 @@ namespace Lodestar{
                 return master->getTopic(dir, topicName);
             };
 
-            void registerToTopic(std::string path, std::string registrarType, int nodeSocket, std::string address){
+            bool registerToTopic(std::string path, std::string registrarType, int nodeSocket, std::string address){
                 return master->registerToTopic(path, registrarType, nodeSocket, address);
             };
 
+            bool syncLog(){
+                return master->changeLog->sync();
+            };
+
+            bool unregisterFromTopic(std::string path, std::string registrarType, std::string address){
+                return master->unregisterFromTopic(path, registrarType, address);
+            };
+
+            endpointCache* queryTopic(std::string path, uint8_t topicType){
+                return master->queryTopic(path, topicType);
+            };
+
+            //flushes like the reactor would at the end of its iteration
+            bool listSubtree(std::string path, connectedNode& node, uint32_t id = 0){
+                bool listed = master->listSubtree(path, node, id);
+                master->flushQueuedNodes(node.shard);
+                return listed;
+            };
+
+            void receiveFromNode(connectedNode& node, const char* data, int len){
+                master->receiveFromNode(node, data, len);
+            };
+
+            //sends the next frame of a listing, like the reactor would on a writable event
+            bool continueListing(connectedNode& node){
+                return master->continueListing(node) && master->flushNode(node);
+            };
+
+            std::shared_ptr<const std::string> encodeUpdate(std::string path, uint8_t topicType, std::string address){
+                return master->encodeUpdate(path, topicType, address, false);
+            };
+
+            void announce(uint64_t sequence, std::shared_ptr<const std::string> frame, std::vector<Lodestar::recipient>& recipients){
+                master->announce(0, sequence, frame, recipients);
+            };
+
+            //releases like the reactor would once woken by the log, then flushes
+            void releaseLogged(){
+                master->releaseLogged(0);
+                master->flushQueuedNodes(0);
+            };
+
+            //expires leases like the first shard's reactor would
+            void expireLeases(){
+                master->expireLeases(0);
+            };
+
+            uint64_t lastLogged(){
+                return master->changeLog->last();
+            };
+
             void attachListener(){
-                listeningThread = master->listeningThread;
+                listeningThread = master->shards[0].listeningThread;
+            }
+
+            void setupTcpListener(std::string host, uint16_t port){
+                master->setupTcpListener(host, port);
+            }
+
+            uint16_t getTcpPort(){
+                return master->getTcpPort();
+            }
+
+            std::vector<masterShard>* shards(){
+                return &(master->shards);
             }
     };
 }
@@ -86,6 +151,8 @@ TEST_CASE("Master - business logic"){
         std::vector<std::string> returnedPath = master.tokenizeTopicStr(path);
 
         REQUIRE(returnedPath == supposedPath);
+        REQUIRE(master.tokenizeTopicStr("/dir1//dir2/lastdir/") == supposedPath);
+        REQUIRE(master.tokenizeTopicStr("//").empty());
     }
 
     SUBCASE("getDir - directory finding"){
@@ -169,6 +236,115 @@ TEST_CASE("Master - business logic"){
             REQUIRE(registrar->nodeSocketFd == nodeSocket);
         }
     }
+
+    SUBCASE("handleRegistration - names without a topic are refused"){
+        Lodestar::connectedNode node;
+        node.socketFd = -1;
+
+        for(std::string name : {"", "/", "//"}){
+            Lodestar::registration reg;
+            reg.type = 0;
+            reg.topicType = 0;
+            reg.nameLen = name.size();
+            reg.name = &name[0];
+            reg.registrarLen = 4;
+            reg.registrarName = (char*)"addr";
+
+            Lodestar::message msg;
+            msg.data = &reg;
+            char frame[64];
+            uint16_t size = msg.serializeMessage(&frame[2]);
+            frame[0] = size;
+            frame[1] = size >> 8;
+            master.receiveFromNode(node, frame, size + 2);
+
+            REQUIRE(node.active);
+            REQUIRE(master.rootNode->subNodes.empty());
+        }
+        REQUIRE(!master.unregisterFromTopic("/", "pub", "addr"));
+    }
+
+    SUBCASE("queryTopic - cached endpoint lists"){
+        REQUIRE(master.queryTopic("dir1/topic", 0) == NULL);
+
+        master.registerToTopic("dir1/topic", "pub", 0, "first");
+        Lodestar::endpointCache* cache = master.queryTopic("dir1/topic", 0);
+
+        REQUIRE(cache != NULL);
+        REQUIRE(cache->valid);
+        REQUIRE(cache->count == 1);
+        REQUIRE(cache->data == std::string("\x05\x00" "first", 7));
+
+        SUBCASE("subscribing doesn't invalidate publishers"){
+            master.registerToTopic("dir1/topic", "sub", 0, "sub");
+            REQUIRE(cache->valid);
+            REQUIRE(master.queryTopic("dir1/topic", 1)->count == 1);
+        }
+
+        SUBCASE("publishing invalidates publishers"){
+            master.registerToTopic("dir1/topic", "pub", 0, "second");
+            REQUIRE(!cache->valid);
+            REQUIRE(master.queryTopic("dir1/topic", 0)->count == 2);
+        }
+    }
+
+    SUBCASE("listSubtree - streamed listing"){
+        int fds[2];
+        REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+        //enough long topic names to need more than one frame
+        std::string longName(60, 'a');
+        for(int i = 0; i < 40; i++)
+            master.registerToTopic("dir1/dir2/" + longName + std::to_string(i), "pub", 0, "addr");
+        master.registerToTopic("other/topic", "pub", 0, "addr");
+
+        Lodestar::connectedNode node;
+        node.socketFd = fds[0];
+        REQUIRE(master.listSubtree("dir1", node, 7));
+        //asked for while the first is streamed, so it follows it
+        REQUIRE(master.listSubtree("other", node, 8));
+        REQUIRE(node.listings.size() == 2);
+        //the rest is left to writable events, which the node waits for while it has listings
+        REQUIRE(node.writing);
+
+        auto receiveListing = [&](uint32_t id, int& frames, int& entries){
+            bool last = false;
+            while(!last){
+                Lodestar::message frame;
+                frame.recvMessage(fds[1]);
+                REQUIRE(frame.deserializeMessage());
+
+                Lodestar::subtreeListing* listing = static_cast<Lodestar::subtreeListing*>(frame.data);
+                REQUIRE(listing->dataType == Lodestar::msgtype::subtreeLst);
+                REQUIRE(frame.id == id);
+                last = listing->last;
+                entries += listing->count;
+                frames++;
+                delete[] listing->data;
+                delete listing;
+
+                //a frame per writable event, not the whole listing at once
+                REQUIRE(master.continueListing(node));
+            }
+        };
+
+        int frames = 0;
+        int entries = 0;
+        receiveListing(7, frames, entries);
+        //dir2 plus its 40 topics, and nothing from "other"
+        REQUIRE(entries == 41);
+        REQUIRE(frames > 1);
+
+        frames = 0;
+        entries = 0;
+        receiveListing(8, frames, entries);
+        REQUIRE(entries == 1);
+        REQUIRE(node.listings.empty());
+        REQUIRE(!node.writing);
+
+        close(fds[0]);
+        close(fds[1]);
+    }
 }
 
 // NOTE: should test non-local networking since host info can be gotten from both sides
@@ -199,6 +375,7 @@ TEST_CASE("Master - local networking logic"){
         master.listeningThread->join();
 
         REQUIRE(rc == 0);
+        REQUIRE(master.shards()->size() == 1);
         // can't do this now, once i extract
         // the node listening pipeline into a
         // standalone class this can be done again
@@ -207,3 +384,233 @@ TEST_CASE("Master - local networking logic"){
     }
     
 }
+
+TEST_CASE("Master - sharded listeners"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/listener.socket");
+
+    Lodestar::Master_test master(socketPath, 4);
+
+    REQUIRE(master.shards()->size() == 4);
+    for(auto it = master.shards()->begin(); it != master.shards()->end(); it++){
+        REQUIRE(it->backend != NULL);
+        REQUIRE(it->listeningThread != NULL);
+        REQUIRE(it->reactorThread != NULL);
+    }
+
+    sockaddr_un testSockaddr;
+    testSockaddr.sun_family = AF_LOCAL;
+    std::strcpy(testSockaddr.sun_path, "listener.socket");
+
+    //listeners racing on the same socket don't get in the way of connecting
+    for(int i = 0; i < 8; i++){
+        int testSockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+        REQUIRE(connect(testSockfd, (struct sockaddr*) &testSockaddr, sizeof(sockaddr_un)) == 0);
+        close(testSockfd);
+    }
+
+}
+
+TEST_CASE("Master - io_uring shards"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/listener.socket");
+
+    //falls back to epoll on kernels without io_uring support
+    Lodestar::Master_test master(socketPath, 2, true);
+
+    REQUIRE(master.shards()->size() == 2);
+    for(auto it = master.shards()->begin(); it != master.shards()->end(); it++){
+        REQUIRE(it->backend != NULL);
+        REQUIRE(it->reactorThread != NULL);
+    }
+}
+
+TEST_CASE("Master - snapshot restart"){
+    std::string snapshotPath = std::string(getenv("PWD"));
+    snapshotPath.append("/master.snapshot");
+    unlink(snapshotPath.c_str());
+
+    {
+        Lodestar::Master_test master;
+        REQUIRE(!master.master->enableSnapshots(snapshotPath, std::chrono::seconds(60)));
+        master.registerToTopic("dir1/topic", "pub", 3, "first");
+        master.registerToTopic("dir1/topic", "sub", 4, "second");
+    }
+
+    //the final snapshot is taken on destruction
+    Lodestar::Master_test restarted;
+    REQUIRE(restarted.master->enableSnapshots(snapshotPath, std::chrono::seconds(60)));
+    REQUIRE(restarted.queryTopic("dir1/topic", 0)->count == 1);
+    REQUIRE(restarted.queryTopic("dir1/topic", 1)->count == 1);
+
+    //nodes registering again don't duplicate their restored registrations
+    restarted.registerToTopic("dir1/topic", "pub", 7, "first");
+    REQUIRE(restarted.queryTopic("dir1/topic", 0)->count == 1);
+
+    unlink(snapshotPath.c_str());
+}
+
+TEST_CASE("Master - restored registrations are leased"){
+    std::string snapshotPath = std::string(getenv("PWD"));
+    snapshotPath.append("/master.snapshot");
+    unlink(snapshotPath.c_str());
+
+    {
+        Lodestar::Master_test master;
+        master.master->enableSnapshots(snapshotPath, std::chrono::seconds(60));
+        master.registerToTopic("dir1/topic", "pub", 3, "gone");
+        master.registerToTopic("dir1/topic", "pub", 4, "back");
+    }
+
+    Lodestar::Master_test restarted;
+    restarted.master->enableLeases(std::chrono::milliseconds(100));
+    REQUIRE(restarted.master->enableSnapshots(snapshotPath, std::chrono::seconds(60)));
+    restarted.expireLeases();
+    REQUIRE(restarted.queryTopic("dir1/topic", 0)->count == 2);
+
+    //the node that registers again takes its registration over, the other's runs out
+    restarted.registerToTopic("dir1/topic", "pub", 7, "back");
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(restarted.queryTopic("dir1/topic", 0)->count == 2 && std::chrono::steady_clock::now() < deadline){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        restarted.expireLeases();
+    }
+    REQUIRE(restarted.queryTopic("dir1/topic", 0)->count == 1);
+    REQUIRE(restarted.queryTopic("dir1/topic", 0)->data == std::string("\x04\x00" "back", 6));
+
+    unlink(snapshotPath.c_str());
+}
+
+TEST_CASE("Master - write-ahead log recovery"){
+    std::string snapshotPath = std::string(getenv("PWD"));
+    snapshotPath.append("/master.snapshot");
+    std::string logPath = std::string(getenv("PWD"));
+    logPath.append("/master.log");
+    unlink(snapshotPath.c_str());
+    unlink(logPath.c_str());
+
+    auto readFile = [](std::string path){
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    };
+    auto writeFile = [](std::string path, std::string& data){
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+    };
+
+    std::string crashedSnapshot, crashedLog;
+    {
+        Lodestar::Master_test master;
+        master.master->enableSnapshots(snapshotPath, std::chrono::seconds(60));
+        REQUIRE(master.master->enableLog(logPath) == 0);
+        master.registerToTopic("dir1/topic", "pub", 3, "first");
+        master.registerToTopic("dir1/topic", "sub", 4, "second");
+
+        //the snapshot covers the changes so far, and the log starts over
+        REQUIRE(master.master->saveSnapshot());
+        master.registerToTopic("dir1/topic", "pub", 5, "third");
+        REQUIRE(master.unregisterFromTopic("dir1/topic", "sub", "second"));
+        REQUIRE(!master.unregisterFromTopic("dir1/topic", "sub", "second"));
+
+        //what a crash would leave behind, before the final snapshot on destruction
+        REQUIRE(master.syncLog());
+        crashedSnapshot = readFile(snapshotPath);
+        crashedLog = readFile(logPath);
+    }
+
+    writeFile(snapshotPath, crashedSnapshot);
+    writeFile(logPath, crashedLog);
+    {
+        Lodestar::Master_test restarted;
+        restarted.master->enableSnapshots(snapshotPath, std::chrono::seconds(60));
+        REQUIRE(restarted.master->enableLog(logPath) == 2);
+        REQUIRE(restarted.queryTopic("dir1/topic", 0)->count == 2);
+        REQUIRE(restarted.queryTopic("dir1/topic", 1)->count == 0);
+    }
+
+    unlink(snapshotPath.c_str());
+    unlink(logPath.c_str());
+}
+
+TEST_CASE("Master - updates wait on the write-ahead log"){
+    std::string logPath = std::string(getenv("PWD"));
+    logPath.append("/master.log");
+    unlink(logPath.c_str());
+
+    Lodestar::Master_test master;
+    REQUIRE(master.master->enableLog(logPath) == 0);
+
+    int fds[2];
+    REQUIRE(socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+    timeval timeout {1, 0};
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeval));
+    Lodestar::connectedNode subscriber;
+    subscriber.socketFd = fds[0];
+    subscriber.features = Lodestar::feature::pushedUpdates;
+    Lodestar::connectedNode* added = master.nodeArray->insert(subscriber);
+    REQUIRE(added);
+
+    //a change not yet committed holds its update back, and every update after it
+    std::vector<Lodestar::recipient> recipients {{fds[0], added->generation}};
+    master.announce(master.lastLogged() + 1, master.encodeUpdate("dir1/topic", 0, "first"), recipients);
+    master.announce(0, master.encodeUpdate("dir1/topic", 0, "second"), recipients);
+    master.releaseLogged();
+    REQUIRE(master.shards()->at(0).awaitingLog.size() == 2);
+
+    master.registerToTopic("dir1/topic", "pub", -1, "first");
+    REQUIRE(master.syncLog());
+    master.releaseLogged();
+    REQUIRE(master.shards()->at(0).awaitingLog.empty());
+
+    const char* expected[] = {"first", "second"};
+    for(int i = 0; i < 2; i++){
+        Lodestar::message frame;
+        REQUIRE(frame.recvMessage(fds[1]) == Lodestar::msgStatus::ok);
+        REQUIRE(frame.deserializeMessage());
+        Lodestar::topicUpdate* update = static_cast<Lodestar::topicUpdate*>(frame.data);
+        CHECK(std::string(update->registrarName, update->registrarLen) == expected[i]);
+        delete[] update->registrarName;
+        delete[] update->address;
+        delete update;
+    }
+
+    //a node that was given the socket of the one registered isn't sent its updates
+    std::vector<Lodestar::recipient> stale {{fds[0], added->generation - 1}};
+    master.announce(0, master.encodeUpdate("dir1/topic", 0, "third"), stale);
+    master.releaseLogged();
+    Lodestar::message frame;
+    CHECK(frame.recvMessage_for(fds[1], std::chrono::milliseconds(100)) == Lodestar::msgStatus::nomsg);
+
+    master.nodeArray->remove(master.nodeArray->find(fds[0]));
+    close(fds[0]);
+    close(fds[1]);
+    unlink(logPath.c_str());
+}
+
+TEST_CASE("Master - TCP networking logic"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/listener.socket");
+
+    Lodestar::Master_test master(socketPath, 2);
+    master.setupTcpListener("127.0.0.1", 0);
+
+    REQUIRE(master.getTcpPort() != 0);
+    for(auto it = master.shards()->begin(); it != master.shards()->end(); it++){
+        REQUIRE(it->tcpfd >= 0);
+        REQUIRE(it->tcpListeningThread != NULL);
+    }
+
+    SUBCASE("connecting over loopback"){
+        for(int i = 0; i < 4; i++){
+            int testSockfd = connectTcp("127.0.0.1", master.getTcpPort());
+            REQUIRE(testSockfd > 0);
+
+            int nodelay = 0;
+            socklen_t len = sizeof(int);
+            getsockopt(testSockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, &len);
+            REQUIRE(nodelay);
+
+            close(testSockfd);
+        }
+    }
+}
@@ -0,0 +1,284 @@
+#ifndef LODESNAP_H
+#define LODESNAP_H
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include "types.hpp"
+
+/**
+ * @file snapshot.cpp
+ * Binary snapshots of the topic tree.
+ *
+ * A snapshot is a header followed by flat arrays: a table of interned strings,
+ * the tree nodes in depth first order (each with its amount of subnodes and
+ * registrars) and the registrars in the order of their nodes, publishers first.
+ * Every name and address is an index into the string table, so a snapshot of
+ * many topics sharing names and endpoints stays small, and loading one is a
+ * single pass over a mapped file.
+ * */
+
+namespace Lodestar{
+    struct snapshotHeader {
+        char magic[4];        ///< "LDSN"
+        uint32_t version;
+        uint32_t nStrings;
+        uint32_t nNodes;
+        uint32_t nRegistrars;
+        uint32_t stringBytes; ///< size of the string data after the arrays
+    };
+
+    struct snapshotString {
+        uint32_t offset;      ///< offset into the string data
+        uint32_t len;
+    };
+
+    struct snapshotNode {
+        uint32_t name;        ///< index into the string table
+        uint32_t type;        ///< nodeType
+        uint32_t nSubNodes;
+        uint32_t nPublishers;
+        uint32_t nSubscribers;
+    };
+
+    struct snapshotRegistrar {
+        uint32_t address;     ///< index into the string table
+    };
+
+    static const uint32_t snapshotFormat = 1; ///< version of the snapshot layout
+
+    /**
+     * Packs a topic tree into a snapshot.
+     *
+     * Socket descriptors are not kept, since they are meaningless to another process.
+     *
+     * @param root the root of the tree.
+     * @returns the snapshot, ready to be written to a file.
+     * */
+    std::string packSnapshot(topicTreeNode& root){
+        std::unordered_map<std::string, uint32_t> interned;
+        std::vector<snapshotString> strings;
+        std::string stringData;
+        std::vector<snapshotNode> nodes;
+        std::vector<snapshotRegistrar> registrars;
+
+        auto intern = [&](const std::string& str){
+            auto found = interned.find(str);
+            if(found != interned.end())
+                return found->second;
+
+            uint32_t index = strings.size();
+            strings.push_back(snapshotString {(uint32_t)stringData.size(), (uint32_t)str.size()});
+            stringData.append(str);
+            interned[str] = index;
+            return index;
+        };
+
+        std::vector<topicTreeNode*> stack;
+        stack.push_back(&root);
+        while(!stack.empty()){
+            topicTreeNode* node = stack.back();
+            stack.pop_back();
+
+            nodes.push_back(snapshotNode {intern(node->name), (uint32_t)node->type, (uint32_t)node->subNodes.size(),
+                                          (uint32_t)node->publishers.size(), (uint32_t)node->subscribers.size()});
+            for(auto it = node->publishers.begin(); it != node->publishers.end(); it++)
+                registrars.push_back(snapshotRegistrar {intern(it->address)});
+            for(auto it = node->subscribers.begin(); it != node->subscribers.end(); it++)
+                registrars.push_back(snapshotRegistrar {intern(it->address)});
+
+            //pushed backwards so subnodes are popped in order
+            for(auto it = node->subNodes.rbegin(); it != node->subNodes.rend(); it++)
+                stack.push_back(&(*it));
+        }
+
+        snapshotHeader header;
+        std::memcpy(header.magic, "LDSN", 4);
+        header.version = snapshotFormat;
+        header.nStrings = strings.size();
+        header.nNodes = nodes.size();
+        header.nRegistrars = registrars.size();
+        header.stringBytes = stringData.size();
+
+        std::string snapshot;
+        snapshot.append((char*)&header, sizeof(header));
+        snapshot.append((char*)strings.data(), strings.size() * sizeof(snapshotString));
+        snapshot.append((char*)nodes.data(), nodes.size() * sizeof(snapshotNode));
+        snapshot.append((char*)registrars.data(), registrars.size() * sizeof(snapshotRegistrar));
+        snapshot.append(stringData);
+        return snapshot;
+    }
+
+    /**
+     * Writes a snapshot to [path], replacing the previous one atomically.
+     *
+     * @returns false if the snapshot could not be written; the previous one is kept.
+     * */
+    bool writeSnapshot(const std::string& snapshot, std::string path){
+        std::string tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if(fd < 0)
+            return false;
+
+        size_t written = 0;
+        while(written < snapshot.size()){
+            int rv = write(fd, &snapshot[written], snapshot.size() - written);
+            if(rv < 0){
+                if(errno == EINTR)
+                    continue;
+                close(fd);
+                unlink(tmpPath.c_str());
+                return false;
+            }
+            written += rv;
+        }
+
+        bool synced = fsync(fd) == 0;
+        close(fd);
+        if(!synced || rename(tmpPath.c_str(), path.c_str())){
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Unpacks a snapshot into a tree.
+     *
+     * Registrars are restored with a socket descriptor of -1.
+     *
+     * @param data the snapshot, as packed by packSnapshot().
+     * @param size size of [data].
+     * @param[out] root the root the tree is unpacked into; left untouched on failure.
+     * @returns false if the snapshot is malformed.
+     * */
+    bool unpackSnapshot(const char* data, size_t size, topicTreeNode& root){
+        if(size < sizeof(snapshotHeader))
+            return false;
+
+        snapshotHeader header;
+        std::memcpy(&header, data, sizeof(header));
+
+        size_t stringsAt = sizeof(snapshotHeader);
+        size_t nodesAt = stringsAt + (size_t)header.nStrings * sizeof(snapshotString);
+        size_t registrarsAt = nodesAt + (size_t)header.nNodes * sizeof(snapshotNode);
+        size_t dataAt = registrarsAt + (size_t)header.nRegistrars * sizeof(snapshotRegistrar);
+
+        if(std::memcmp(header.magic, "LDSN", 4) || header.version != snapshotFormat
+                || header.nNodes == 0 || dataAt + header.stringBytes != size)
+            return false;
+
+        const snapshotString* strings = (const snapshotString*)&data[stringsAt];
+        const snapshotNode* nodes = (const snapshotNode*)&data[nodesAt];
+        const snapshotRegistrar* registrars = (const snapshotRegistrar*)&data[registrarsAt];
+        const char* stringData = &data[dataAt];
+
+        bool valid = true;
+        auto lookup = [&](uint32_t index){
+            if(index >= header.nStrings || (uint64_t)strings[index].offset + strings[index].len > header.stringBytes){
+                valid = false;
+                return std::string();
+            }
+            return std::string(&stringData[strings[index].offset], strings[index].len);
+        };
+
+        struct pendingDir {
+            topicTreeNode* node;
+            uint32_t remaining; ///< subnodes still to be read
+        };
+
+        topicTreeNode loaded;
+        std::vector<pendingDir> stack;
+        uint32_t nextRegistrar = 0;
+
+        for(uint32_t i = 0; i < header.nNodes && valid; i++){
+            topicTreeNode* node;
+            if(i == 0){
+                node = &loaded;
+                node->type = (nodeType)nodes[i].type;
+                node->name = lookup(nodes[i].name);
+            }else{
+                //the node belongs to the closest directory still missing subnodes
+                while(!stack.empty() && stack.back().remaining == 0)
+                    stack.pop_back();
+                if(stack.empty()){
+                    valid = false;
+                    break;
+                }
+                stack.back().remaining--;
+                topicTreeNode* parent = stack.back().node;
+                parent->subNodes.push_back(topicTreeNode {(nodeType)nodes[i].type, lookup(nodes[i].name), {}, {}, {}, {}, {}});
+                node = &parent->subNodes.back();
+            }
+
+            if((uint64_t)nextRegistrar + nodes[i].nPublishers + nodes[i].nSubscribers > header.nRegistrars){
+                valid = false;
+                break;
+            }
+            for(uint32_t j = 0; j < nodes[i].nPublishers; j++)
+                node->publishers.push_back(registrar {lookup(registrars[nextRegistrar++].address), -1});
+            for(uint32_t j = 0; j < nodes[i].nSubscribers; j++)
+                node->subscribers.push_back(registrar {lookup(registrars[nextRegistrar++].address), -1});
+
+            //a count past the nodes left is a corrupt file, not something to allocate for
+            if(nodes[i].nSubNodes > header.nNodes - 1 - i){
+                valid = false;
+                break;
+            }
+            //subnodes are read right after, so their parent never moves while they are
+            node->subNodes.reserve(nodes[i].nSubNodes);
+            stack.push_back(pendingDir {node, nodes[i].nSubNodes});
+        }
+
+        for(auto it = stack.begin(); it != stack.end(); it++){
+            if(it->remaining)
+                valid = false;
+        }
+        if(!valid)
+            return false;
+
+        root = std::move(loaded);
+        return true;
+    }
+
+    /**
+     * Loads the snapshot at [path] into a tree.
+     *
+     * Registrars are restored with a socket descriptor of -1 until their
+     * nodes register again.
+     *
+     * @param path where the snapshot is.
+     * @param[out] root the root the tree is loaded into; left untouched on failure.
+     * @returns false if there's no snapshot at [path] or it is malformed.
+     * */
+    bool loadSnapshot(std::string path, topicTreeNode& root){
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+
+        struct stat info;
+        if(fstat(fd, &info) || info.st_size < (off_t)sizeof(snapshotHeader)){
+            close(fd);
+            return false;
+        }
+
+        size_t size = info.st_size;
+        char* mapped = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapped == MAP_FAILED)
+            return false;
+
+        bool loaded = unpackSnapshot(mapped, size, root);
+        munmap(mapped, size);
+        return loaded;
+    }
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "snapshot.cpp"
+#include "../common/doctest.h"
+
+TEST_CASE("snapshot - topic tree round trip"){
+    std::string path = std::string(getenv("PWD"));
+    path.append("/tree.snapshot");
+
+    auto treeNode = [](Lodestar::nodeType type, std::string name){
+        return Lodestar::topicTreeNode {type, name, {}, {}, {}, {}, {}};
+    };
+
+    Lodestar::topicTreeNode root = treeNode(Lodestar::nodeType::dir, "");
+    root.subNodes.push_back(treeNode(Lodestar::nodeType::dir, "dir1"));
+    root.subNodes.push_back(treeNode(Lodestar::nodeType::topic, "topic"));
+
+    Lodestar::topicTreeNode& dir1 = root.subNodes[0];
+    dir1.subNodes.push_back(treeNode(Lodestar::nodeType::topic, "topic"));
+    dir1.subNodes.push_back(treeNode(Lodestar::nodeType::dir, "dir2"));
+    dir1.subNodes[0].publishers.push_back(Lodestar::registrar {"pub:1", 4});
+    dir1.subNodes[0].subscribers.push_back(Lodestar::registrar {"sub:1", 5});
+    dir1.subNodes[0].subscribers.push_back(Lodestar::registrar {"pub:1", 6});
+    root.subNodes[1].publishers.push_back(Lodestar::registrar {"pub:1", 4});
+
+    std::string snapshot = Lodestar::packSnapshot(root);
+
+    SUBCASE("names and addresses are interned"){
+        Lodestar::snapshotHeader header;
+        std::memcpy(&header, &snapshot[0], sizeof(header));
+        CHECK(header.nNodes == 5);
+        CHECK(header.nRegistrars == 4);
+        //"", dir1, topic, pub:1, sub:1, dir2
+        CHECK(header.nStrings == 6);
+    }
+
+    SUBCASE("loading a written snapshot"){
+        REQUIRE(Lodestar::writeSnapshot(snapshot, path));
+
+        Lodestar::topicTreeNode loaded;
+        REQUIRE(Lodestar::loadSnapshot(path, loaded));
+
+        REQUIRE(loaded.subNodes.size() == 2);
+        CHECK(loaded.subNodes[1].name == "topic");
+        CHECK(loaded.subNodes[1].type == Lodestar::nodeType::topic);
+
+        Lodestar::topicTreeNode& loadedDir = loaded.subNodes[0];
+        CHECK(loadedDir.name == "dir1");
+        REQUIRE(loadedDir.subNodes.size() == 2);
+        CHECK(loadedDir.subNodes[1].name == "dir2");
+
+        Lodestar::topicTreeNode& topic = loadedDir.subNodes[0];
+        REQUIRE(topic.publishers.size() == 1);
+        REQUIRE(topic.subscribers.size() == 2);
+        CHECK(topic.publishers[0].address == "pub:1");
+        CHECK(topic.subscribers[1].address == "pub:1");
+        //sockets of another process mean nothing
+        CHECK(topic.publishers[0].nodeSocketFd == -1);
+    }
+
+    SUBCASE("malformed snapshots are refused"){
+        snapshot.resize(snapshot.size() - 1);
+        REQUIRE(Lodestar::writeSnapshot(snapshot, path));
+
+        Lodestar::topicTreeNode loaded = treeNode(Lodestar::nodeType::dir, "untouched");
+        REQUIRE(!Lodestar::loadSnapshot(path, loaded));
+        CHECK(loaded.name == "untouched");
+        CHECK(!Lodestar::loadSnapshot(path + ".missing", loaded));
+    }
+
+    SUBCASE("subnode counts past the nodes left are refused"){
+        Lodestar::snapshotHeader header;
+        std::memcpy(&header, &snapshot[0], sizeof(header));
+        size_t rootAt = sizeof(header) + header.nStrings * sizeof(Lodestar::snapshotString);
+
+        Lodestar::snapshotNode rootRecord;
+        std::memcpy(&rootRecord, &snapshot[rootAt], sizeof(rootRecord));
+        rootRecord.nSubNodes = 0xffffffff;
+        std::memcpy(&snapshot[rootAt], &rootRecord, sizeof(rootRecord));
+
+        Lodestar::topicTreeNode loaded;
+        CHECK(!Lodestar::unpackSnapshot(snapshot.data(), snapshot.size(), loaded));
+    }
+
+    unlink(path.c_str());
+}
@@ -3,9 +3,21 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <deque>
+#include <set>
+#include <tuple>
+#include <memory>
+#include <utility>
 #include <mutex>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
 #include "../common/types.h"
 #include "../common/communication.cpp"
+#include "../common/writeQueue.cpp"
+#include "../common/ioBackend.cpp"
+#include "../common/timerWheel.cpp"
+#include "../common/tokenBucket.cpp"
 
 namespace Lodestar{
     /**
@@ -14,8 +26,33 @@ namespace Lodestar{
     struct registrar {
         std::string address;  ///< string used by the node to identify an instance of a publisher/subscriber.*/
         int nodeSocketFd;     ///< the socket file descriptor of the node.*/
+        uint64_t lease = 0;   ///< lease the registration is held by; 0 if it's held by none.
+        uint64_t generation = 0; ///< generation of the node at nodeSocketFd when it registered; see connectedNode::generation.
+    };
+
+    /**
+     * A node an update is to be sent to.
+     *
+     * Sockets are reused once closed, so the node is told apart from any
+     * later one at the same socket by its generation.
+     * */
+    struct recipient {
+        int socketFd;        ///< socket of the node.
+        uint64_t generation; ///< generation of the node; see connectedNode::generation.
     };
     
+    /**
+     * A pre-serialized list of the endpoints registered to a topic.
+     *
+     * Holds the data of an endpointList so that queries can be answered
+     * without re-encoding the registrars on every request.
+     * */
+    struct endpointCache {
+        std::string data;   ///< endpoints packed as in endpointList::data.
+        uint16_t count = 0; ///< amount of endpoints packed into data.
+        bool valid = false; ///< false if the registrars changed since data was built.
+    };
+
     /**
      * A struct that defined a node of the topic tree.
      *
@@ -28,6 +65,8 @@ namespace Lodestar{
         std::vector<topicTreeNode> subNodes; ///< Subdirectories of a directory; empty if a topic.
         std::vector<registrar> publishers;   ///< a vector of nodes that publish to this topic; empty if a directory.
         std::vector<registrar> subscribers;  ///< a vector of nodes that subscribe to this topic; empty if a directory.
+        endpointCache publisherCache;        ///< cached endpoint list of publishers.
+        endpointCache subscriberCache;       ///< cached endpoint list of subscribers.
     };
     
     /**
@@ -39,6 +78,18 @@ namespace Lodestar{
         registrar* directPointer;    ///< a direct pointer to the registrar.
     };
     
+    /**
+     * Where a subtree listing being streamed to a node is at.
+     *
+     * Directories are kept by path rather than by pointer, since the tree may
+     * change between the frames of a listing; entries added or removed meanwhile
+     * may be listed or not, but the walk always stays within the tree.
+     * */
+    struct listingCursor {
+        std::vector<std::pair<std::string, size_t>> stack; ///< path of each directory being walked, '/' terminated, and index of its next subnode.
+        uint32_t id = 0;                                   ///< correlation id of the query, carried by every frame of the listing.
+    };
+
     /**
      * A struct that represents a connected node.
      *
@@ -49,6 +100,78 @@ namespace Lodestar{
         int socketFd;                          ///< The file descriptor of the nodes' socket.
         std::vector<topicTreeRef> publishers;  ///< vector of topics the node publishes to.
         std::vector<topicTreeRef> subscribers; ///< vector of topics the node subscribes to.
+        message inbox;                         ///< message currently being received from the node.
+        writeQueue outQueue;                   ///< frames waiting to be sent to the node.
+        bool writing = false;                  ///< if a writable event of the node's socket is awaited.
+        bool flushQueued = false;              ///< if the node's queue is to be flushed at the end of the reactor's iteration.
+        bool active = true;                    ///< false once the node is disconnected.
+        int shard = 0;                         ///< the master shard whose reactor services the node.
+        uint32_t features = 0;                 ///< features agreed on with the node when it authenticated; see feature.
+        uint64_t lease = 0;                    ///< lease holding the node's registrations; 0 until it's first renewed.
+        tokenBucket frameBudget;               ///< frames the node may still send before it's shed.
+        bool budgeted = false;                 ///< if frameBudget was set from the master's limits yet.
+        std::deque<listingCursor> listings;    ///< subtree listings being streamed to the node, oldest first.
+        uint64_t generation = 0;               ///< unique to this connection, unlike its socket; set by connectionTable::insert().
+    };
+
+    /**
+     * Frames handed to a shard for its nodes by the reactors of other shards.
+     *
+     * Only a shard's own reactor touches its nodes, so frames for them are
+     * posted here by socket and queued by that reactor once it's woken.
+     * */
+    struct shardMailbox {
+        std::mutex lock;
+        std::vector<std::pair<recipient, std::shared_ptr<const std::string>>> frames; ///< node and frame to be queued to it.
+    };
+
+    /**
+     * A topic update held back until the change it announces is in the write-ahead log.
+     * */
+    struct loggedUpdate {
+        uint64_t sequence;                         ///< log record of the change.
+        std::shared_ptr<const std::string> frame;  ///< the update, ready to be fanned out.
+        std::vector<recipient> recipients;         ///< nodes the update is for.
+        int sender;                                ///< socket of the node that made the change; -1 for none.
+    };
+
+    /**
+     * A lease of a node on its registrations, renewed by every frame the node sends.
+     * */
+    struct leasedRegistration {
+        std::string path;    ///< path of the topic, as the node sent it.
+        uint8_t topicType;   ///< 0 for pub, 1 for sub.
+        std::string address; ///< address of the registrar.
+
+        bool operator<(const leasedRegistration& other) const {
+            return std::tie(path, topicType, address) < std::tie(other.path, other.topicType, other.address);
+        }
+    };
+
+    struct nodeLease {
+        int socketFd;                                        ///< socket of the node holding the lease.
+        std::chrono::time_point<std::chrono::steady_clock> expiry; ///< when the lease runs out unless renewed.
+        std::set<leasedRegistration> registrations;          ///< registrations made under the lease, so it's dropped without walking the tree.
+    };
+
+    /**
+     * A struct that represents a shard of the Master.
+     *
+     * Each shard has a thread accepting connections and a thread servicing
+     * the events of the authenticated nodes that belong to it.
+     * */
+    struct masterShard {
+        ioBackend* backend = NULL;                 ///< socket layer the shard's nodes are watched by.
+        int tcpfd = -1;                            ///< the shard's TCP listening socket, if listening over TCP.
+        std::thread* listeningThread = NULL;       ///< pointer to the shard's listener thread.
+        std::thread* tcpListeningThread = NULL;    ///< pointer to the shard's TCP listener thread.
+        std::thread* reactorThread = NULL;         ///< pointer to the thread servicing the shard's nodes.
+        std::vector<connectedNode*> inactiveNodes; ///< nodes disconnected since the last removeInactiveNodes().
+        std::vector<connectedNode*> queuedFlushes; ///< nodes whose queues are flushed at the end of the reactor's iteration.
+        shardMailbox* mailbox = NULL;              ///< frames posted to the shard's nodes by other shards.
+        timerWheel leaseWheel = timerWheel(std::chrono::milliseconds(50)); ///< expiry of the leases of the shard's nodes.
+        std::unordered_map<uint64_t, nodeLease> leases; ///< leases of the shard's nodes, by id; kept after they disconnect, until they expire.
+        std::deque<loggedUpdate> awaitingLog;      ///< updates of changes made by the shard's nodes not yet committed, oldest first.
     };
     
     /**
@@ -60,14 +183,16 @@ namespace Lodestar{
      * */
     struct autheableNode {
         std::mutex lock;
-        message authmsg; ///< where the auth message will be
+        message* authmsg = NULL; ///< where the auth message will be; only taken from a pool once bytes arrive
         std::chrono::time_point<std::chrono::steady_clock> timeout; ///< when it will timeout
+        std::chrono::time_point<std::chrono::steady_clock> lastServiced; ///< when it was last inserted or managed
         int sockfd = 0;      ///< the file descriptor of the authenticable socket
         bool active = true;
         
         autheableNode(const autheableNode& node){
             authmsg = node.authmsg;
             timeout = node.timeout;
+            lastServiced = node.lastServiced;
             sockfd = node.sockfd;
             active = node.active;
         }
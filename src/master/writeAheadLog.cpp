@@ -0,0 +1,379 @@
+#ifndef LODEWAL_H
+#define LODEWAL_H
+#include <string>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace Lodestar{
+    /**
+     * A change of the topic tree, as kept in the write-ahead log.
+     * */
+    struct logRecord {
+        enum operation: uint8_t {registered, unregistered};
+
+        operation op;
+        uint8_t topicType;   ///< 0 for pub, 1 for sub
+        std::string path;    ///< path of the topic
+        std::string address; ///< address of the registrar
+    };
+
+    /**
+     * An append only log of topic tree changes, made durable with group commit.
+     *
+     * append() only copies the record into memory and returns; a committer thread
+     * writes everything appended since its last pass with a single write() and
+     * fdatasync(), so while one sync is in flight every record appended meanwhile
+     * is batched into the next. Callers that need a record on disk wait for it
+     * with waitDurable().
+     *
+     * Each record is framed as a 4 byte length, the record and a 4 byte checksum,
+     * so a record torn by a crash is detected and dropped on replay.
+     * */
+    class writeAheadLog{
+        public:
+            /**
+             * Opens the log at [path] for appending, creating it if needed.
+             * */
+            writeAheadLog(std::string path): path(path){
+                fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+                committer = std::thread(&writeAheadLog::commit, this);
+            }
+
+            writeAheadLog(const writeAheadLog& log) = delete;
+
+            /**
+             * Commits whatever is still pending before closing the log.
+             * */
+            ~writeAheadLog(){
+                lock.lock();
+                stopping = true;
+                lock.unlock();
+                pendingSignal.notify_one();
+
+                committer.join();
+                if(fd >= 0)
+                    close(fd);
+            }
+
+            bool ok(){
+                return fd >= 0;
+            }
+
+            /**
+             * Queues a record to be committed.
+             *
+             * @returns the sequence number of the record, to be given to waitDurable().
+             * */
+            uint64_t append(const logRecord& record){
+                std::string framed = frame(record);
+
+                std::unique_lock<std::mutex> guard(lock);
+                pending.append(framed);
+                uint64_t sequence = ++appended;
+                guard.unlock();
+
+                pendingSignal.notify_one();
+                return sequence;
+            }
+
+            /**
+             * Waits until the record [sequence] and every one before it is on disk.
+             *
+             * @returns false if the log failed to write them.
+             * */
+            bool waitDurable(uint64_t sequence){
+                std::unique_lock<std::mutex> guard(lock);
+                durableSignal.wait(guard, [this, sequence](){return durable >= sequence || failed;});
+                return !failed;
+            }
+
+            /**
+             * @returns the sequence number of the last record appended.
+             * */
+            uint64_t last(){
+                std::lock_guard<std::mutex> guard(lock);
+                return appended;
+            }
+
+            /**
+             * @returns if the record [sequence] and every one before it is on disk,
+             * or will never be, since the log failed.
+             * */
+            bool settled(uint64_t sequence){
+                std::lock_guard<std::mutex> guard(lock);
+                return durable >= sequence || failed;
+            }
+
+            /**
+             * Sets a function to be called, from the committer, after every commit.
+             *
+             * Lets those who can't block on waitDurable() check on their records
+             * with settled() once they may have been written.
+             * */
+            void onCommit(std::function<void()> callback){
+                std::lock_guard<std::mutex> guard(lock);
+                committed = callback;
+            }
+
+            /**
+             * Waits until every record appended so far is on disk.
+             * */
+            bool sync(){
+                lock.lock();
+                uint64_t sequence = appended;
+                lock.unlock();
+                return waitDurable(sequence);
+            }
+
+            /**
+             * Moves the records committed so far to [oldPath] and starts an empty log.
+             *
+             * Meant to be called once the tree is about to be snapshotted, so the old
+             * log can be deleted once the snapshot is safely written. If [oldPath]
+             * is still there from a snapshot that failed, nothing is moved, since
+             * replaying records twice is harmless but losing them is not.
+             *
+             * @returns true if the log was rotated.
+             * */
+            bool rotate(std::string oldPath){
+                std::unique_lock<std::mutex> guard(lock);
+                //records before the ones swapped here may still be on their way to the file
+                durableSignal.wait(guard, [this](){return inFlight == 0;});
+                std::string batch;
+                batch.swap(pending);
+                uint64_t sequence = appended;
+
+                std::unique_lock<std::mutex> fileGuard(fileLock);
+                bool written = writeAndSync(batch);
+                if(written)
+                    durable = sequence;
+                failed = failed || !written;
+                durableSignal.notify_all();
+                std::function<void()> callback = committed;
+
+                bool rotated = written && rotateFile(oldPath);
+                fileGuard.unlock();
+                guard.unlock();
+
+                if(callback)
+                    callback();
+                return rotated;
+            }
+
+            /**
+             * @returns amount of syncs done, each committing every record pending at the time.
+             * */
+            uint64_t commits(){
+                std::lock_guard<std::mutex> guard(lock);
+                return nCommits;
+            }
+
+            /**
+             * Calls [apply] on every intact record of the log at [path], in order.
+             *
+             * A torn record at the end of the log is cut off, so that the
+             * records appended afterwards aren't hidden behind it.
+             *
+             * @returns amount of records replayed, -1 if there is no log at [path].
+             * */
+            static int replay(std::string path, std::function<void(logRecord&)> apply){
+                int logfd = open(path.c_str(), O_RDWR);
+                if(logfd < 0)
+                    return -1;
+
+                std::string data;
+                char chunk[4096];
+                int rv;
+                while((rv = read(logfd, chunk, sizeof(chunk))) > 0)
+                    data.append(chunk, rv);
+
+                int replayed = 0;
+                size_t offset = 0;
+                logRecord record;
+                while(parse(data, offset, record)){
+                    apply(record);
+                    replayed++;
+                }
+
+                if(offset < data.size())
+                    ftruncate(logfd, offset);
+                close(logfd);
+                return replayed;
+            }
+
+        private:
+            std::string path;
+            int fd = -1;
+
+            std::mutex lock;                         ///< guards everything below but the file itself
+            std::condition_variable pendingSignal;   ///< wakes the committer when there are records
+            std::condition_variable durableSignal;   ///< wakes waitDurable() callers after a commit
+            std::string pending;                     ///< framed records not yet written
+            uint64_t appended = 0;                   ///< sequence number of the last appended record
+            uint64_t durable = 0;                    ///< sequence number of the last record on disk
+            uint64_t inFlight = 0;                   ///< sequence number of the last record the committer is writing; 0 if none
+            uint64_t nCommits = 0;
+            bool failed = false;                     ///< if a write or sync ever failed
+            bool stopping = false;
+            std::function<void()> committed;         ///< called after every commit; see onCommit()
+
+            std::mutex fileLock;                     ///< held while writing to or swapping the file
+            std::thread committer;
+
+            /**
+             * Loop of the committer thread.
+             * */
+            void commit(){
+                std::unique_lock<std::mutex> guard(lock);
+                while(true){
+                    pendingSignal.wait(guard, [this](){return stopping || !pending.empty();});
+                    if(pending.empty())
+                        return;
+
+                    std::string batch;
+                    batch.swap(pending);
+                    uint64_t sequence = appended;
+                    inFlight = sequence;
+                    guard.unlock();
+
+                    fileLock.lock();
+                    bool written = writeAndSync(batch);
+                    fileLock.unlock();
+
+                    guard.lock();
+                    if(written)
+                        durable = std::max(durable, sequence);
+                    failed = failed || !written;
+                    inFlight = 0;
+                    nCommits++;
+                    durableSignal.notify_all();
+
+                    std::function<void()> callback = committed;
+                    if(callback){
+                        guard.unlock();
+                        callback();
+                        guard.lock();
+                    }
+                }
+            }
+
+            /**
+             * Moves the file to [oldPath] and opens an empty one; must be called with fileLock taken.
+             *
+             * If [oldPath] is still there from a snapshot that failed, nothing is moved.
+             * */
+            bool rotateFile(const std::string& oldPath){
+                struct stat info;
+                if(stat(oldPath.c_str(), &info) == 0)
+                    return false;
+
+                if(rename(path.c_str(), oldPath.c_str()))
+                    return false;
+                close(fd);
+                fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+                return fd >= 0;
+            }
+
+            /**
+             * Writes [batch] and syncs it; must be called with fileLock taken.
+             * */
+            bool writeAndSync(const std::string& batch){
+                if(fd < 0)
+                    return false;
+
+                size_t written = 0;
+                while(written < batch.size()){
+                    int rv = write(fd, &batch[written], batch.size() - written);
+                    if(rv < 0){
+                        if(errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    written += rv;
+                }
+
+                return fdatasync(fd) == 0;
+            }
+
+            static uint32_t checksum(const char* data, size_t len){
+                //FNV-1a
+                uint32_t hash = 2166136261u;
+                for(size_t i = 0; i < len; i++){
+                    hash ^= (uint8_t)data[i];
+                    hash *= 16777619u;
+                }
+                return hash;
+            }
+
+            static std::string frame(const logRecord& record){
+                std::string body;
+                body.push_back(record.op);
+                body.push_back(record.topicType);
+                uint16_t len = record.path.size();
+                body.append((char*)&len, sizeof(uint16_t));
+                body.append(record.path);
+                len = record.address.size();
+                body.append((char*)&len, sizeof(uint16_t));
+                body.append(record.address);
+
+                uint32_t bodyLen = body.size();
+                uint32_t sum = checksum(body.data(), body.size());
+
+                std::string framed;
+                framed.append((char*)&bodyLen, sizeof(uint32_t));
+                framed.append(body);
+                framed.append((char*)&sum, sizeof(uint32_t));
+                return framed;
+            }
+
+            /**
+             * Parses the record at [offset] of [data], moving [offset] past it.
+             *
+             * @returns false if there is no intact record at [offset].
+             * */
+            static bool parse(const std::string& data, size_t& offset, logRecord& record){
+                uint32_t bodyLen;
+                if(offset + sizeof(uint32_t) > data.size())
+                    return false;
+                std::memcpy(&bodyLen, &data[offset], sizeof(uint32_t));
+
+                size_t bodyAt = offset + sizeof(uint32_t);
+                if(bodyLen < 6 || bodyAt + bodyLen + sizeof(uint32_t) > data.size())
+                    return false;
+
+                uint32_t sum;
+                std::memcpy(&sum, &data[bodyAt + bodyLen], sizeof(uint32_t));
+                if(sum != checksum(&data[bodyAt], bodyLen))
+                    return false;
+
+                const char* body = &data[bodyAt];
+                uint16_t pathLen, addressLen;
+                std::memcpy(&pathLen, &body[2], sizeof(uint16_t));
+                if(6u + pathLen > bodyLen)
+                    return false;
+                std::memcpy(&addressLen, &body[4 + pathLen], sizeof(uint16_t));
+                if(6u + pathLen + addressLen != bodyLen)
+                    return false;
+
+                record.op = (logRecord::operation)body[0];
+                record.topicType = body[1];
+                record.path = std::string(&body[4], pathLen);
+                record.address = std::string(&body[6 + pathLen], addressLen);
+
+                offset = bodyAt + bodyLen + sizeof(uint32_t);
+                return true;
+            }
+    };
+}
+
+#endif
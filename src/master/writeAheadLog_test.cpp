@@ -0,0 +1,139 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include "writeAheadLog.cpp"
+#include "../common/doctest.h"
+
+TEST_CASE("writeAheadLog - append and replay"){
+    std::string path = std::string(getenv("PWD"));
+    path.append("/changes.log");
+    unlink(path.c_str());
+    unlink((path + ".old").c_str());
+
+    std::vector<Lodestar::logRecord> replayed;
+    auto collect = [&replayed](Lodestar::logRecord& record){ replayed.push_back(record); };
+
+    {
+        Lodestar::writeAheadLog log(path);
+        REQUIRE(log.ok());
+        log.append(Lodestar::logRecord {Lodestar::logRecord::registered, 0, "dir1/topic", "pub:1"});
+        uint64_t last = log.append(Lodestar::logRecord {Lodestar::logRecord::unregistered, 1, "topic", ""});
+        REQUIRE(log.waitDurable(last));
+    }
+
+    SUBCASE("records come back in order"){
+        REQUIRE(Lodestar::writeAheadLog::replay(path, collect) == 2);
+        CHECK(replayed[0].op == Lodestar::logRecord::registered);
+        CHECK(replayed[0].topicType == 0);
+        CHECK(replayed[0].path == "dir1/topic");
+        CHECK(replayed[0].address == "pub:1");
+        CHECK(replayed[1].op == Lodestar::logRecord::unregistered);
+        CHECK(replayed[1].topicType == 1);
+        CHECK(replayed[1].address == "");
+        CHECK(Lodestar::writeAheadLog::replay(path + ".missing", collect) == -1);
+    }
+
+    SUBCASE("a torn record is cut off"){
+        int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+        write(fd, "\x20\x00\x00\x00\x00\x01", 6);
+        close(fd);
+
+        REQUIRE(Lodestar::writeAheadLog::replay(path, collect) == 2);
+        {
+            Lodestar::writeAheadLog log(path);
+            log.append(Lodestar::logRecord {Lodestar::logRecord::registered, 1, "topic", "sub:1"});
+        }
+
+        replayed.clear();
+        REQUIRE(Lodestar::writeAheadLog::replay(path, collect) == 3);
+        CHECK(replayed[2].address == "sub:1");
+    }
+
+    SUBCASE("rotation"){
+        Lodestar::writeAheadLog log(path);
+        log.append(Lodestar::logRecord {Lodestar::logRecord::registered, 1, "topic", "sub:1"});
+        REQUIRE(log.rotate(path + ".old"));
+        //an old log not yet dropped is never overwritten
+        REQUIRE(!log.rotate(path + ".old"));
+        log.append(Lodestar::logRecord {Lodestar::logRecord::registered, 1, "topic", "sub:2"});
+        REQUIRE(log.sync());
+
+        CHECK(Lodestar::writeAheadLog::replay(path + ".old", collect) == 3);
+        CHECK(Lodestar::writeAheadLog::replay(path, collect) == 1);
+        CHECK(replayed.back().address == "sub:2");
+    }
+
+    unlink(path.c_str());
+    unlink((path + ".old").c_str());
+}
+
+TEST_CASE("writeAheadLog - group commit"){
+    std::string path = std::string(getenv("PWD"));
+    path.append("/changes.log");
+    unlink(path.c_str());
+
+    const int nThreads = 4;
+    const int nRecords = 500;
+    {
+        Lodestar::writeAheadLog log(path);
+        std::vector<std::thread> appenders;
+        for(int i = 0; i < nThreads; i++){
+            appenders.push_back(std::thread([&log, i](){
+                for(int j = 0; j < nRecords; j++)
+                    log.append(Lodestar::logRecord {Lodestar::logRecord::registered, 0, "topic", std::to_string(i)});
+            }));
+        }
+        for(auto it = appenders.begin(); it != appenders.end(); it++)
+            it->join();
+
+        REQUIRE(log.sync());
+        //records appended during a sync share the next one
+        CHECK(log.commits() < nThreads * nRecords);
+    }
+
+    int count = Lodestar::writeAheadLog::replay(path, [](Lodestar::logRecord&){});
+    CHECK(count == nThreads * nRecords);
+    unlink(path.c_str());
+}
+
+TEST_CASE("writeAheadLog - rotating while the committer writes"){
+    std::string path = std::string(getenv("PWD"));
+    path.append("/changes.log");
+    unlink(path.c_str());
+    unlink((path + ".old").c_str());
+
+    const int nRecords = 2000;
+    std::atomic<int> notified = 0;
+    {
+        Lodestar::writeAheadLog log(path);
+        log.onCommit([&notified](){ notified++; });
+
+        std::thread appender([&log](){
+            for(int i = 0; i < nRecords; i++)
+                log.append(Lodestar::logRecord {Lodestar::logRecord::registered, 0, "topic", std::to_string(i)});
+        });
+        while(log.last() < nRecords / 4)
+            std::this_thread::yield();
+
+        //whatever rotate() claims to be durable was written before the file was moved
+        uint64_t before = log.last();
+        REQUIRE(log.rotate(path + ".old"));
+        CHECK(log.settled(before));
+        CHECK(Lodestar::writeAheadLog::replay(path + ".old", [](Lodestar::logRecord&){}) >= (int)before);
+
+        appender.join();
+        uint64_t last = log.last();
+        REQUIRE(log.sync());
+        CHECK(log.settled(last));
+        CHECK(notified > 0);
+    }
+
+    int count = Lodestar::writeAheadLog::replay(path + ".old", [](Lodestar::logRecord&){});
+    count += Lodestar::writeAheadLog::replay(path, [](Lodestar::logRecord&){});
+    CHECK(count == nRecords);
+    unlink(path.c_str());
+    unlink((path + ".old").c_str());
+}
@@ -0,0 +1,562 @@
+#ifndef LODENODE_H
+#define LODENODE_H
+
+#include <vector>
+#include <array>
+#include <map>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../common/communication.cpp"
+#include "../common/frameReader.cpp"
+#include "../common/types.h"
+#include "../common/utils.hpp"
+
+namespace Lodestar{
+
+    /**
+     * Client side of the service discovery, used by each publisher/subscriber.
+     *
+     * Registrations and endpoint queries are queued locally and sent by sync()
+     * as a single batch, right behind the authentication frame on a fresh
+     * connection, so booting a node costs one round trip however many topics it
+     * has. Queries carry correlation ids, so answers are matched to them in
+     * whatever order they arrive, and are read through a frameReader, so the
+     * answers to a batch take one recv per wakeup rather than two per answer.
+     * Endpoints the master answers with are cached until refreshed, and kept
+     * current by the topic updates it pushes as endpoints join or leave, which
+     * are applied whenever they're read: by sync() or by receiveUpdates().
+     * If the connection drops, the next sync() reconnects with exponential
+     * backoff and replays every registration.
+     * */
+    class Node {
+        public:
+            /**
+             * @param pass the master password the node authenticates with.
+             * */
+            Node(std::string pass): password(pass){
+                handlers[msgtype::topicUpd] = [this](message& msg){ applyUpdate(msg); };
+                handlers[msgtype::authAns] = [this](message& msg){
+                    agreedFeatures = static_cast<authAnswer*>(msg.data)->features;
+                    leaseTime = std::chrono::milliseconds(static_cast<authAnswer*>(msg.data)->leaseTime);
+                    negotiating = false;
+                };
+                handlers[msgtype::shutdwn] = [this](message& msg){
+                    lastShutdown = static_cast<shutdown*>(msg.data)->code;
+                };
+            }
+
+            Node(const Node& node) = delete;
+
+            ~Node(){
+                disconnect();
+            }
+
+            /**
+             * Connects to a master listening on a local socket.
+             *
+             * @param sockPath path of the master's socket.
+             * @returns true if connected and authenticated, along with anything already queued.
+             * */
+            bool connect(std::string sockPath){
+                dial = [sockPath](){ return connectLocal(sockPath); };
+                return sync();
+            }
+
+            /**
+             * Connects to a master listening over TCP.
+             *
+             * @param host IPv4 address of the master.
+             * @param port port the master listens on.
+             * @returns true if connected and authenticated, along with anything already queued.
+             * */
+            bool connect(std::string host, uint16_t port){
+                dial = [host, port](){ return connectTcp(host, port); };
+                return sync();
+            }
+
+            /**
+             * Closes the connection to the master; queued registrations are kept.
+             * */
+            void disconnect(){
+                if(sockfd >= 0)
+                    close(sockfd);
+                sockfd = -1;
+                agreedFeatures = 0;
+                leaseTime = std::chrono::milliseconds(0);
+            }
+
+            bool connected(){
+                return sockfd >= 0;
+            }
+
+            /**
+             * Queues the registration of this node as a publisher of [topic].
+             *
+             * The subscribers of [topic] are queried along with it.
+             *
+             * @param topic path of the topic.
+             * @param address endpoint subscribers reach this node's publisher at.
+             * */
+            void publish(std::string topic, std::string address){
+                registrations.push_back(topicRegistration {topic, 0, address});
+                queries.push_back(endpointKey(topic, 1));
+            }
+
+            /**
+             * Queues the registration of this node as a subscriber of [topic].
+             *
+             * The publishers of [topic] are queried along with it.
+             *
+             * @param topic path of the topic.
+             * @param address endpoint publishers reach this node's subscriber at.
+             * */
+            void subscribe(std::string topic, std::string address){
+                registrations.push_back(topicRegistration {topic, 1, address});
+                queries.push_back(endpointKey(topic, 0));
+            }
+
+            /**
+             * Queues a query for the current endpoints of every cached topic.
+             * */
+            void refresh(){
+                for(auto it = endpoints.begin(); it != endpoints.end(); it++)
+                    queries.push_back(it->first);
+            }
+
+            /**
+             * Sends everything queued in a single batch and waits for the answers.
+             *
+             * Connects first if not connected, retrying with backoff. With nothing
+             * queued, a heartbeat is sent instead if the lease is due for renewal.
+             *
+             * @returns false if the master could not be reached or didn't answer,
+             * in which case what was queued stays queued.
+             * */
+            bool sync(){
+                bool fresh = false;
+                if(!connected()){
+                    if(!reconnect())
+                        return false;
+                    fresh = true;
+                }
+
+                std::string batch;
+                if(fresh){
+                    //the master forgets registrations along with the connection
+                    sentRegistrations = 0;
+                    lastShutdown = shutdownCode::unspecified;
+                    agreedFeatures = 0;
+                    leaseTime = std::chrono::milliseconds(0);
+                    negotiating = true;
+
+                    auth authMsg;
+                    authMsg.size = password.size() + 1;
+                    authMsg.identifier = &password[0];
+                    authMsg.version = protocolVersion;
+                    authMsg.features = offeredFeatures;
+                    appendFrame(batch, authMsg);
+                }
+
+                for(size_t i = sentRegistrations; i < registrations.size(); i++){
+                    registration reg;
+                    reg.type = 0;
+                    reg.topicType = registrations[i].topicType;
+                    reg.nameLen = registrations[i].topic.size() + 1;
+                    reg.name = &registrations[i].topic[0];
+                    reg.registrarLen = registrations[i].address.size() + 1;
+                    reg.registrarName = &registrations[i].address[0];
+                    appendFrame(batch, reg);
+                }
+
+                std::map<uint32_t, endpointKey> pending;
+                for(auto it = queries.begin(); it != queries.end(); it++){
+                    topicQuery query;
+                    query.topicType = it->second;
+                    query.nameLen = it->first.size() + 1;
+                    query.name = &it->first[0];
+
+                    uint32_t id = takeId();
+                    pending[id] = *it;
+                    appendFrame(batch, query, id);
+                }
+
+                //syncing with nothing queued still has to renew the lease
+                if(batch.empty() && leaseDue()){
+                    Lodestar::heartbeat beat;
+                    appendFrame(batch, beat);
+                }
+
+                if(!sendAll(batch)){
+                    //the master may have said why before closing the connection
+                    receiveBuffered();
+                    disconnect();
+                    return false;
+                }
+                if(!receiveAnswers(pending)){
+                    disconnect();
+                    return false;
+                }
+
+                sentRegistrations = registrations.size();
+                queries.clear();
+                return true;
+            }
+
+            /**
+             * @returns the features agreed on with the master over the current connection, see feature.
+             * */
+            uint32_t features(){
+                return agreedFeatures;
+            }
+
+            /**
+             * @returns why the master last closed the connection, as told by its shutdown
+             * frame; unspecified if it told nothing. See shutdownCode.
+             * */
+            uint8_t shutdownReason(){
+                return lastShutdown;
+            }
+
+            /**
+             * Sets what handles the frames of [type] the master sends on its own.
+             *
+             * Such frames are handled whenever they're read, by sync() or by
+             * receiveUpdates(), and the message is freed once the handler returns.
+             * The type must also be in messageRegistry for its frames to be decoded.
+             *
+             * @param type a type byte of at least firstUserType.
+             * @param handler what handles the frames.
+             * @returns false if [type] is reserved.
+             * */
+            bool onMessage(uint8_t type, std::function<void(message&)> handler){
+                if(type < msgtype::firstUserType || type >= messageRegistry::maxTypes)
+                    return false;
+                handlers[type] = handler;
+                return true;
+            }
+
+            /**
+             * Sends a message to the master right away, outside of the batch sync() sends.
+             *
+             * Meant for message types added by the application; whatever the master
+             * sends back is handled by the handler set with onMessage().
+             *
+             * @returns false if not connected or the connection was lost.
+             * */
+            bool send(transmittable& data){
+                if(!connected())
+                    return false;
+
+                std::string frame;
+                appendFrame(frame, data);
+                if(!sendAll(frame)){
+                    disconnect();
+                    return false;
+                }
+                return true;
+            }
+
+            /**
+             * Renews the node's lease on its registrations, if nothing was sent for a while.
+             *
+             * The master drops the registrations of a node that sends nothing for as
+             * long as a lease lasts, so when leases were agreed on, this or
+             * receiveUpdates() must be called often; a heartbeat is only sent once
+             * a third of the lease went by without anything else being sent.
+             *
+             * @returns false if not connected or the connection was lost.
+             * */
+            bool heartbeat(){
+                if(!connected())
+                    return false;
+                if(!leaseDue())
+                    return true;
+
+                Lodestar::heartbeat beat;
+                std::string frame;
+                appendFrame(frame, beat);
+                if(!sendAll(frame)){
+                    disconnect();
+                    return false;
+                }
+                return true;
+            }
+
+            /**
+             * Applies the topic updates the master pushed so far, without waiting for more.
+             *
+             * Frames of types set with onMessage() are handled along with them, and
+             * the lease is renewed with heartbeat().
+             *
+             * @returns false if the connection to the master was lost.
+             * */
+            bool receiveUpdates(){
+                if(!connected())
+                    return false;
+
+                while(true){
+                    message update;
+                    msgStatus status = reader.next(update);
+                    if(status == msgStatus::ok){
+                        if(dispatch(update))
+                            continue;
+                        delete update.data;
+                        break;
+                    }
+                    if(status == msgStatus::broken)
+                        break;
+
+                    int rv = reader.fill(sockfd, MSG_DONTWAIT);
+                    if(rv > 0 || (rv < 0 && errno == EINTR))
+                        continue;
+                    if(rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return heartbeat();
+                    break;
+                }
+
+                disconnect();
+                return false;
+            }
+
+            /**
+             * Gets the cached endpoints of a topic.
+             *
+             * @param topic path of the topic.
+             * @param topicType relation to be looked up; 0 for publishers, 1 for subscribers.
+             * @returns the endpoints of the last answer about [topic], empty if never asked.
+             * */
+            std::vector<std::string> getEndpoints(std::string topic, uint8_t topicType){
+                auto it = endpoints.find(endpointKey(topic, topicType));
+                if(it == endpoints.end())
+                    return std::vector<std::string>();
+                return it->second;
+            }
+
+            std::chrono::milliseconds initialBackoff = std::chrono::milliseconds(50); ///< wait before the first retry.
+            std::chrono::milliseconds maxBackoff = std::chrono::seconds(5);          ///< cap of the doubling wait between retries.
+            int maxAttempts = 5;                                                     ///< connection attempts per sync().
+            std::chrono::milliseconds replyTimeout = std::chrono::seconds(2);        ///< time the master has to answer a batch.
+
+            ///< features offered to the master when authenticating
+            static constexpr uint32_t offeredFeatures = feature::batchedRegistration | feature::pipelining | feature::pushedUpdates
+                                                      | feature::leases;
+
+        private:
+            typedef std::pair<std::string, uint8_t> endpointKey; ///< topic path and relation queried
+
+            /**
+             * A registration of this node, kept to be replayed on reconnection.
+             * */
+            struct topicRegistration {
+                std::string topic;
+                uint8_t topicType;   ///< 0 for pub, 1 for sub
+                std::string address;
+            };
+
+            std::string password;
+            int sockfd = -1;
+            std::function<int()> dial;                   ///< opens a new connection to the master
+
+            std::vector<topicRegistration> registrations;
+            size_t sentRegistrations = 0;                 ///< registrations already sent over the current connection
+            std::vector<endpointKey> queries;             ///< queries to be sent on the next sync()
+            uint32_t nextId = 1;                          ///< correlation id of the next query
+            uint32_t agreedFeatures = 0;                  ///< features the master agreed on, see feature
+            bool negotiating = false;                     ///< if the master is yet to answer the auth frame
+            uint8_t lastShutdown = shutdownCode::unspecified; ///< code of the last shutdown frame received
+            std::chrono::milliseconds leaseTime = std::chrono::milliseconds(0); ///< how long the lease lasts; 0 if none was agreed on
+            std::chrono::steady_clock::time_point lastSent; ///< when a frame was last sent to the master
+            std::map<endpointKey, std::vector<std::string>> endpoints; ///< cached answers
+            frameReader reader;                           ///< answers received but not yet handled
+            std::array<std::function<void(message&)>, messageRegistry::maxTypes> handlers; ///< handler of each type of unrequested frame
+
+            /**
+             * Dials the master until connected or out of attempts, doubling the wait between attempts.
+             * */
+            bool reconnect(){
+                if(!dial)
+                    return false;
+
+                std::chrono::milliseconds backoff = initialBackoff;
+                for(int attempt = 0; attempt < maxAttempts; attempt++){
+                    if(attempt > 0){
+                        std::this_thread::sleep_for(backoff);
+                        backoff = std::min(backoff * 2, maxBackoff);
+                    }
+
+                    sockfd = dial();
+                    if(sockfd >= 0){
+                        reader.clear();
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            /**
+             * @returns a new correlation id; never 0, which marks frames without one.
+             * */
+            uint32_t takeId(){
+                if(nextId == 0)
+                    nextId = 1;
+                return nextId++;
+            }
+
+            /**
+             * Serializes [data] into a frame at the end of [batch].
+             *
+             * @param id correlation id of the frame; 0 for none.
+             * */
+            void appendFrame(std::string& batch, transmittable& data, uint32_t id = 0){
+                char buffer[1024];
+                message msg;
+                msg.data = &data;
+                msg.id = id;
+
+                uint16_t size = msg.serializeMessage(&buffer[2]);
+                buffer[0] = size;
+                buffer[1] = size >> 8;
+                batch.append(buffer, size + 2);
+            }
+
+            bool sendAll(std::string& batch){
+                size_t sent = 0;
+                while(sent < batch.size()){
+                    int rv = ::send(sockfd, &batch[sent], batch.size() - sent, MSG_NOSIGNAL);
+                    if(rv == -1){
+                        if(errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    sent += rv;
+                }
+                //only frames actually sent renew the lease
+                if(sent)
+                    lastSent = std::chrono::steady_clock::now();
+                return true;
+            }
+
+            /**
+             * @returns true if leases were agreed on and a third of the lease went by since anything was sent.
+             * */
+            bool leaseDue(){
+                return leaseTime.count() && std::chrono::steady_clock::now() - lastSent >= leaseTime / 3;
+            }
+
+            /**
+             * Receives endpoint lists until every pending query is answered, and
+             * the auth frame too if it was just sent.
+             *
+             * @param pending the queries sent, by correlation id.
+             * */
+            bool receiveAnswers(std::map<uint32_t, endpointKey>& pending){
+                auto deadline = std::chrono::steady_clock::now() + replyTimeout;
+
+                while(!pending.empty() || negotiating){
+                    message answer;
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    if(reader.recv_for(sockfd, answer, remaining) != msgStatus::ok)
+                        return false;
+
+                    if(dispatch(answer))
+                        continue;
+
+                    auto query = pending.find(answer.id);
+                    if(answer.data->dataType != msgtype::endpointLst || query == pending.end()){
+                        delete answer.data;
+                        return false;
+                    }
+
+                    endpoints[query->second] = unpackEndpoints(*static_cast<endpointList*>(answer.data));
+                    pending.erase(query);
+                    delete[] static_cast<endpointList*>(answer.data)->data;
+                    delete answer.data;
+                }
+
+                return true;
+            }
+
+            /**
+             * Handles the frames the master already sent, without waiting for more.
+             * */
+            void receiveBuffered(){
+                reader.fill(sockfd, MSG_DONTWAIT);
+
+                message msg;
+                while(reader.next(msg) == msgStatus::ok){
+                    if(!dispatch(msg))
+                        delete msg.data;
+                }
+            }
+
+            /**
+             * Hands a frame the master sent on its own to the handler of its type.
+             *
+             * @param msg a message received from the master; freed if it was handled.
+             * @returns false if there's no handler for the type of [msg].
+             * */
+            bool dispatch(message& msg){
+                std::function<void(message&)>& handler = handlers[msg.data->dataType];
+                if(!handler)
+                    return false;
+
+                handler(msg);
+                delete msg.data;
+                msg.data = NULL;
+                return true;
+            }
+
+            /**
+             * Applies a topic update to the cached endpoints of its topic, if they're cached.
+             * */
+            void applyUpdate(message& msg){
+                topicUpdate* update = static_cast<topicUpdate*>(msg.data);
+                std::string topic(update->address, strnlen(update->address, update->addressLen));
+                std::string address(update->registrarName, strnlen(update->registrarName, update->registrarLen));
+
+                auto cached = endpoints.find(endpointKey(topic, update->type & 2 ? 1 : 0));
+                if(cached != endpoints.end()){
+                    std::vector<std::string>& addresses = cached->second;
+                    auto found = std::find(addresses.begin(), addresses.end(), address);
+                    if(update->type & 1){
+                        if(found != addresses.end())
+                            addresses.erase(found);
+                    }else if(found == addresses.end()){
+                        addresses.push_back(address);
+                    }
+                }
+
+                delete[] update->registrarName;
+                delete[] update->address;
+            }
+
+            /**
+             * @returns the addresses packed in [list], without trailing null characters.
+             * */
+            std::vector<std::string> unpackEndpoints(endpointList& list){
+                std::vector<std::string> addresses;
+                int offset = 0;
+                for(int i = 0; i < list.count && offset + 2 <= list.dataLen; i++){
+                    uint16_t len;
+                    std::memcpy((char*)&len, &list.data[offset], sizeof(uint16_t));
+                    offset += 2;
+                    if(offset + len > list.dataLen)
+                        break;
+
+                    addresses.push_back(std::string(&list.data[offset], strnlen(&list.data[offset], len)));
+                    offset += len;
+                }
+                return addresses;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,408 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "node.cpp"
+#include "../master/master.cpp"
+#include "../common/doctest.h"
+
+TEST_CASE("Node - registration batching"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    unlink(socketPath.c_str());
+
+    Lodestar::Master master(socketPath);
+    master.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+
+    Lodestar::Node publisher("secret");
+    publisher.publish("dir/topic", "publisher:1");
+    publisher.publish("dir/other", "publisher:2");
+    REQUIRE(publisher.connect(socketPath));
+    REQUIRE(publisher.connected());
+
+    //registrations and queries queued before connecting go along with the auth frame
+    Lodestar::Node subscriber("secret");
+    subscriber.subscribe("dir/topic", "subscriber:1");
+    REQUIRE(subscriber.connect(socketPath));
+    REQUIRE(subscriber.getEndpoints("dir/topic", 0) == std::vector<std::string>{"publisher:1"});
+    REQUIRE(subscriber.getEndpoints("dir/other", 0).empty());
+
+    SUBCASE("refreshing cached endpoints"){
+        REQUIRE(publisher.getEndpoints("dir/topic", 1).empty());
+        publisher.refresh();
+        REQUIRE(publisher.sync());
+        REQUIRE(publisher.getEndpoints("dir/topic", 1) == std::vector<std::string>{"subscriber:1"});
+    }
+
+    SUBCASE("reconnecting"){
+        publisher.disconnect();
+        publisher.publish("dir/third", "publisher:3");
+        REQUIRE(publisher.sync());
+        REQUIRE(publisher.connected());
+
+        subscriber.subscribe("dir/third", "subscriber:3");
+        REQUIRE(subscriber.sync());
+        REQUIRE(subscriber.getEndpoints("dir/third", 0) == std::vector<std::string>{"publisher:3"});
+    }
+}
+
+TEST_CASE("Node - unreachable master"){
+    Lodestar::Node node("secret");
+    node.maxAttempts = 3;
+    node.initialBackoff = std::chrono::milliseconds(1);
+
+    node.subscribe("dir/topic", "subscriber:1");
+    REQUIRE(!node.connect("/nonexistent/lodestar.socket"));
+    REQUIRE(!node.connected());
+}
+
+TEST_CASE("Node - master handoff"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    std::string handoffPath = std::string(getenv("PWD"));
+    handoffPath.append("/handoff.socket");
+    unlink(socketPath.c_str());
+
+    Lodestar::Master* previous = new Lodestar::Master(socketPath, 2);
+    previous->startAuthentication("secret", 2, std::chrono::milliseconds(10));
+
+    Lodestar::Node publisher("secret");
+    publisher.publish("dir/topic", "publisher:1");
+    REQUIRE(publisher.connect(socketPath));
+
+    bool handed = false;
+    std::thread handing([&](){ handed = previous->handOff(handoffPath, std::chrono::seconds(5)); });
+
+    Lodestar::Master successor(false, 2);
+    successor.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+    REQUIRE(successor.takeOver(handoffPath, std::chrono::seconds(5)));
+    handing.join();
+    REQUIRE(handed);
+    delete previous;
+
+    //the connection made to the previous master is serviced by the successor, along with the tree
+    publisher.subscribe("dir/topic", "publisher:2");
+    REQUIRE(publisher.sync());
+    REQUIRE(publisher.getEndpoints("dir/topic", 0) == std::vector<std::string>{"publisher:1"});
+
+    //and so is the listening socket
+    Lodestar::Node subscriber("secret");
+    subscriber.subscribe("dir/topic", "subscriber:1");
+    REQUIRE(subscriber.connect(socketPath));
+    REQUIRE(subscriber.getEndpoints("dir/topic", 0) == std::vector<std::string>{"publisher:1"});
+
+    SUBCASE("nobody taking over"){
+        REQUIRE(!successor.handOff(handoffPath, std::chrono::milliseconds(50)));
+        //the master carries on
+        subscriber.refresh();
+        REQUIRE(subscriber.sync());
+    }
+}
+
+TEST_CASE("Node - pushed topic updates"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    unlink(socketPath.c_str());
+
+    //nodes land on both shards, so updates cross between them
+    Lodestar::Master master(socketPath, 2);
+    master.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+
+    Lodestar::Node subscriber("secret");
+    subscriber.subscribe("dir/topic", "subscriber:1");
+    REQUIRE(subscriber.connect(socketPath));
+    REQUIRE(subscriber.getEndpoints("dir/topic", 0).empty());
+
+    std::vector<Lodestar::Node*> publishers;
+    std::vector<std::string> expected;
+    for(int i = 0; i < 4; i++){
+        publishers.push_back(new Lodestar::Node("secret"));
+        publishers.back()->publish("dir/topic", "publisher:" + std::to_string(i));
+        REQUIRE(publishers.back()->connect(socketPath));
+        expected.push_back("publisher:" + std::to_string(i));
+    }
+
+    //no query needed; the publishers are pushed to the subscriber as they register
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(subscriber.getEndpoints("dir/topic", 0).size() < expected.size() && std::chrono::steady_clock::now() < deadline){
+        REQUIRE(subscriber.receiveUpdates());
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    std::vector<std::string> pushed = subscriber.getEndpoints("dir/topic", 0);
+    std::sort(pushed.begin(), pushed.end());
+    REQUIRE(pushed == expected);
+
+    //and publishers hear of subscribers the same way
+    Lodestar::Node late("secret");
+    late.subscribe("dir/topic", "subscriber:2");
+    REQUIRE(late.connect(socketPath));
+
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(publishers[0]->getEndpoints("dir/topic", 1).size() < 2 && std::chrono::steady_clock::now() < deadline){
+        REQUIRE(publishers[0]->receiveUpdates());
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    REQUIRE(publishers[0]->getEndpoints("dir/topic", 1) == std::vector<std::string>{"subscriber:1", "subscriber:2"});
+
+    //updates read along with answers don't get in their way
+    subscriber.refresh();
+    REQUIRE(subscriber.sync());
+    REQUIRE(subscriber.getEndpoints("dir/topic", 0).size() == expected.size());
+
+    for(auto it = publishers.begin(); it != publishers.end(); it++)
+        delete *it;
+}
+
+TEST_CASE("Node - feature negotiation"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    unlink(socketPath.c_str());
+
+    Lodestar::Master master(socketPath);
+    master.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+
+    Lodestar::Node node("secret");
+    REQUIRE(node.features() == 0);
+    REQUIRE(node.connect(socketPath));
+    //leases aren't agreed on unless the master holds them
+    REQUIRE(node.features() == (Lodestar::Node::offeredFeatures & ~Lodestar::feature::leases));
+    node.disconnect();
+    REQUIRE(node.features() == 0);
+
+    //a node that predates negotiation sends a bare auth frame, and is never sent frames it doesn't know
+    int legacy = connectLocal(socketPath);
+    REQUIRE(legacy >= 0);
+
+    char password[] = "secret";
+    Lodestar::auth authMsg;
+    authMsg.identifier = password;
+    authMsg.size = sizeof(password);
+    Lodestar::message msg;
+    msg.data = &authMsg;
+    REQUIRE(msg.sendMessage(legacy) > 0);
+
+    char name[] = "dir/topic";
+    char address[] = "subscriber:legacy";
+    Lodestar::registration reg;
+    reg.type = 0;
+    reg.topicType = 1;
+    reg.nameLen = sizeof(name);
+    reg.name = name;
+    reg.registrarLen = sizeof(address);
+    reg.registrarName = address;
+    msg.data = &reg;
+    REQUIRE(msg.sendMessage(legacy) > 0);
+
+    Lodestar::Node publisher("secret");
+    publisher.publish("dir/topic", "publisher:1");
+    REQUIRE(publisher.connect(socketPath));
+
+    Lodestar::topicQuery query;
+    query.topicType = 0;
+    query.nameLen = sizeof(name);
+    query.name = name;
+    msg.data = &query;
+    REQUIRE(msg.sendMessage(legacy) > 0);
+
+    //the first frame back is the answer to its query
+    Lodestar::frameReader reader;
+    Lodestar::message answer;
+    REQUIRE(reader.recv_for(legacy, answer, std::chrono::seconds(2)) == Lodestar::msgStatus::ok);
+    REQUIRE(answer.data->dataType == Lodestar::msgtype::endpointLst);
+    delete[] static_cast<Lodestar::endpointList*>(answer.data)->data;
+    delete answer.data;
+    close(legacy);
+}
+
+TEST_CASE("Node - registration leases"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    unlink(socketPath.c_str());
+
+    Lodestar::Master master(socketPath, 2);
+    master.enableLeases(std::chrono::milliseconds(300));
+    master.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+
+    Lodestar::Node subscriber("secret");
+    subscriber.subscribe("dir/topic", "subscriber:1");
+    REQUIRE(subscriber.connect(socketPath));
+    REQUIRE((subscriber.features() & Lodestar::feature::leases) != 0);
+
+    Lodestar::Node live("secret");
+    live.publish("dir/topic", "publisher:live");
+    REQUIRE(live.connect(socketPath));
+
+    //only ever syncs, with nothing queued past its registration
+    Lodestar::Node synced("secret");
+    synced.publish("dir/topic", "publisher:synced");
+    REQUIRE(synced.connect(socketPath));
+
+    //registers and then never sends anything again
+    Lodestar::Node hung("secret");
+    hung.publish("dir/topic", "publisher:hung");
+    REQUIRE(hung.connect(socketPath));
+
+    auto pump = [&](std::chrono::milliseconds time){
+        auto deadline = std::chrono::steady_clock::now() + time;
+        while(std::chrono::steady_clock::now() < deadline){
+            REQUIRE(subscriber.receiveUpdates());
+            REQUIRE(live.receiveUpdates());
+            REQUIRE(synced.sync());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    };
+
+    pump(std::chrono::milliseconds(100));
+    std::vector<std::string> endpoints = subscriber.getEndpoints("dir/topic", 0);
+    std::sort(endpoints.begin(), endpoints.end());
+    REQUIRE(endpoints == std::vector<std::string>{"publisher:hung", "publisher:live", "publisher:synced"});
+
+    //heartbeats keep the live and synced publishers, and the subscriber is told the hung one is gone
+    pump(std::chrono::milliseconds(700));
+    endpoints = subscriber.getEndpoints("dir/topic", 0);
+    std::sort(endpoints.begin(), endpoints.end());
+    REQUIRE(endpoints == std::vector<std::string>{"publisher:live", "publisher:synced"});
+    REQUIRE(!hung.receiveUpdates());
+
+    //registering again over a new connection takes out a new lease
+    REQUIRE(hung.sync());
+    pump(std::chrono::milliseconds(100));
+    endpoints = subscriber.getEndpoints("dir/topic", 0);
+    std::sort(endpoints.begin(), endpoints.end());
+    REQUIRE(endpoints == std::vector<std::string>{"publisher:hung", "publisher:live", "publisher:synced"});
+}
+
+TEST_CASE("Node - admission control"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    unlink(socketPath.c_str());
+
+    Lodestar::Master master(socketPath, 2);
+    master.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+    Lodestar::admissionLimits limits;
+
+    SUBCASE("nodes sending too many frames are shed"){
+        limits.framesPerSecond = 1;
+        limits.frameBurst = 20;
+        master.setAdmission(limits);
+
+        Lodestar::Node wellBehaved("secret");
+        wellBehaved.subscribe("dir/topic", "subscriber:1");
+        REQUIRE(wellBehaved.connect(socketPath));
+
+        Lodestar::Node rogue("secret");
+        for(int i = 0; i < 50; i++)
+            rogue.publish("dir/topic" + std::to_string(i), "rogue:1");
+        REQUIRE(!rogue.connect(socketPath));
+        REQUIRE(rogue.shutdownReason() == Lodestar::shutdownCode::rateLimited);
+
+        wellBehaved.refresh();
+        REQUIRE(wellBehaved.sync());
+    }
+
+    SUBCASE("sockets past the cap on pending ones are shed"){
+        limits.maxPending = 1;
+        master.setAdmission(limits);
+
+        //stays pending, since it never authenticates
+        int idle = connectLocal(socketPath);
+        REQUIRE(idle >= 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        int shed = connectLocal(socketPath);
+        REQUIRE(shed >= 0);
+        Lodestar::frameReader reader;
+        Lodestar::message msg;
+        REQUIRE(reader.recv_for(shed, msg, std::chrono::seconds(2)) == Lodestar::msgStatus::ok);
+        REQUIRE(msg.data->dataType == Lodestar::msgtype::shutdwn);
+        REQUIRE(static_cast<Lodestar::shutdown*>(msg.data)->code == Lodestar::shutdownCode::overloaded);
+        delete msg.data;
+        close(shed);
+
+        //and there's room again once the pending one goes away
+        close(idle);
+        Lodestar::Node node("secret");
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while(!node.connect(socketPath) && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        REQUIRE(node.connected());
+    }
+
+    SUBCASE("peers reconnecting too fast are shed"){
+        limits.connectionsPerSecond = 0.1;
+        limits.connectionBurst = 2;
+        master.setAdmission(limits);
+
+        Lodestar::Node first("secret"), second("secret"), third("secret");
+        REQUIRE(first.connect(socketPath));
+        REQUIRE(second.connect(socketPath));
+        third.maxAttempts = 1;
+        REQUIRE(!third.connect(socketPath));
+        REQUIRE(third.shutdownReason() == Lodestar::shutdownCode::rateLimited);
+    }
+}
+
+//a request and answer pair added by an application
+struct echoMessage: public Lodestar::transmittable{
+    uint32_t value = 0;
+
+    echoMessage(){
+        dataType = (Lodestar::msgtype)101;
+    }
+
+    int serialize(char* buffer){
+        std::memcpy(buffer, &value, sizeof(uint32_t));
+        return sizeof(uint32_t);
+    }
+
+    void deserialize(char* buffer){
+        std::memcpy(&value, buffer, sizeof(uint32_t));
+    }
+};
+
+TEST_CASE("Node - application message types"){
+    std::string socketPath = std::string(getenv("PWD"));
+    socketPath.append("/node.socket");
+    unlink(socketPath.c_str());
+
+    REQUIRE(Lodestar::messageRegistry::add(101, &Lodestar::makeMessage<echoMessage>));
+
+    Lodestar::Master master(socketPath, 2);
+    master.startAuthentication("secret", 2, std::chrono::milliseconds(10));
+    REQUIRE(!master.handle(Lodestar::msgtype::topicQry, [](Lodestar::connectedNode&, Lodestar::message&){}));
+    REQUIRE(master.handle(101, [&master](Lodestar::connectedNode& node, Lodestar::message& msg){
+        echoMessage answer;
+        answer.value = static_cast<echoMessage*>(msg.data)->value + 1;
+        Lodestar::message reply;
+        reply.data = &answer;
+        master.reply(node, reply);
+    }));
+
+    Lodestar::Node node("secret");
+    std::vector<uint32_t> echoed;
+    REQUIRE(!node.onMessage(Lodestar::msgtype::topicUpd, [](Lodestar::message&){}));
+    REQUIRE(node.onMessage(101, [&echoed](Lodestar::message& msg){
+        echoed.push_back(static_cast<echoMessage*>(msg.data)->value);
+    }));
+
+    node.subscribe("dir/topic", "subscriber:1");
+    REQUIRE(node.connect(socketPath));
+
+    echoMessage request;
+    for(uint32_t i = 0; i < 3; i++){
+        request.value = i * 10;
+        REQUIRE(node.send(request));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(echoed.size() < 3 && std::chrono::steady_clock::now() < deadline){
+        REQUIRE(node.receiveUpdates());
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    REQUIRE(echoed == std::vector<uint32_t>{1, 11, 21});
+
+    //built-in messages keep working alongside
+    node.refresh();
+    REQUIRE(node.sync());
+}
@@ -1,5 +1,19 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "master/master_test.cpp"
 #include "master/authQueue.cpp"
+#include "master/snapshot_test.cpp"
+#include "master/writeAheadLog_test.cpp"
+#include "master/connectionTable_test.cpp"
+#include "master/admission_test.cpp"
 #include "common/communication_test.cpp"
 #include "common/managedList_test.cpp"
+#include "common/writeQueue_test.cpp"
+#include "common/messagePool_test.cpp"
+#include "common/workerPool_test.cpp"
+#include "common/epochList_test.cpp"
+#include "common/ioBackend_test.cpp"
+#include "common/eventLoop_test.cpp"
+#include "common/frameReader_test.cpp"
+#include "common/timerWheel_test.cpp"
+#include "common/tokenBucket_test.cpp"
+#include "node/node_test.cpp"